@@ -0,0 +1,74 @@
+#include <iostream>
+#include <optional>
+#include <string>
+
+#include <core/scene.h>
+#include <core/lightmap_baker.h>
+#include <core/visibility_baker.h>
+#include <core/vertex_animation.h>
+
+// Bakes the lightmap of a scene into <scene>.lightmap and the potentially visible sets along its camera path into
+// <scene>.pvs, and imports the vertex animation frames of its keyframe meshes into <scene>.vat, where LuisaVR picks
+// them up. Creates neither a window nor an OpenGL context, so it runs on headless machines.
+int main(int argc, char *argv[]) {
+    
+    std::string scene_path{"data/scenes/sun_temple/SunTemple.scene"};
+    LightmapBaker::Settings settings;
+    VisibilityBaker::Settings visibility_settings;
+    auto force = false;
+    for (auto i = 1; i < argc; i++) {
+        std::string arg{argv[i]};
+        if (arg == "--force") {
+            force = true;
+        } else if (arg == "--size" && i + 1 < argc) {
+            settings.size = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--samples" && i + 1 < argc) {
+            settings.bounce_samples = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--segment" && i + 1 < argc) {
+            visibility_settings.segment_duration = std::stof(argv[++i]);
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cout << "Usage: " << argv[0] << " [scene] [--size <texels>] [--samples <rays per texel>] "
+                      << "[--segment <seconds of camera path per visibility set>] [--force]" << std::endl;
+            return -1;
+        } else {
+            scene_path = arg;
+        }
+    }
+    
+    std::cout << "Loading scene: " << scene_path << std::endl;
+    auto scene = SceneInfo::load(scene_path);
+    
+    auto lightmap_path = scene_path + ".lightmap";
+    auto key = LightmapBaker::cache_key(scene_path, scene);
+    auto cached_lightmap = force ? std::nullopt : LightmapData::load(lightmap_path, key);
+    auto lightmap_valid = cached_lightmap && cached_lightmap->settings_key == LightmapBaker::settings_key(settings);
+    cached_lightmap.reset();
+    auto visibility_path = scene_path + ".pvs";
+    auto visibility_key = VisibilityBaker::cache_key(scene_path, scene);
+    auto cached_visibility = force ? std::nullopt : VisibilityData::load(visibility_path, visibility_key);
+    auto visibility_valid = cached_visibility && cached_visibility->settings_key == VisibilityBaker::settings_key(visibility_settings);
+    cached_visibility.reset();
+    auto vertex_animation_path = scene_path + ".vat";
+    auto vertex_animation_key = VertexAnimationData::cache_key(scene_path, scene);
+    auto vertex_animation_valid = !force && VertexAnimationData::load(vertex_animation_path, vertex_animation_key);
+    if (lightmap_valid && visibility_valid && vertex_animation_valid) {
+        std::cout << "Lightmap, visibility sets and vertex animation are up to date" << std::endl;
+        return 0;
+    }
+    
+    auto geometry = GeometryData::load(scene);
+    if (!lightmap_valid) {
+        auto lightmap = LightmapBaker::bake(scene, geometry, settings);
+        lightmap.key = key;
+        lightmap.save(lightmap_path);
+    }
+    if (!visibility_valid) {
+        auto visibility = VisibilityBaker::bake(scene, geometry, visibility_settings);
+        visibility.key = visibility_key;
+        visibility.save(visibility_path);
+    }
+    if (!vertex_animation_valid) {
+        VertexAnimationData::import(scene, geometry, vertex_animation_path, vertex_animation_key);
+    }
+    return 0;
+}
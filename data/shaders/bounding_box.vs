@@ -0,0 +1,12 @@
+#version 410 core
+
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProjection;
+uniform vec3 boundsMin;
+uniform vec3 boundsMax;
+
+// the unit cube stretched over an axis-aligned box, for occlusion queries
+void main() {
+    gl_Position = viewProjection * vec4(mix(boundsMin, boundsMax, aPos), 1.0f);
+}
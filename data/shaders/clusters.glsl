@@ -0,0 +1,25 @@
+#pragma once
+
+#include "lights.glsl"
+
+// clustered light lists built on the CPU, see LightCuller
+const int CLUSTER_GRID_X = ${CLUSTER_GRID_X};
+const int CLUSTER_GRID_Y = ${CLUSTER_GRID_Y};
+const int CLUSTER_GRID_Z = ${CLUSTER_GRID_Z};
+
+uniform mat4 view;
+uniform usampler2D clusterRanges;        // (offset, count) per cluster
+uniform usampler2D clusterLightIndices;  // concatenated light lists, addressed like the light textures
+uniform vec2 clusterTileSize;            // size of a screen tile in pixels
+uniform vec2 clusterDepthParams;         // slice = log(depth) * x - y
+
+// range of the light list of the cluster containing the fragment at the given view-space depth
+uvec2 clusterLightRange(float viewDepth) {
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    int slice = clamp(int(log(viewDepth) * clusterDepthParams.x - clusterDepthParams.y), 0, CLUSTER_GRID_Z - 1);
+    return texelFetch(clusterRanges, ivec2(tile.x + tile.y * CLUSTER_GRID_X, slice), 0).xy;
+}
+
+int clusterLightIndex(uint offset) {
+    return int(texelFetch(clusterLightIndices, lightTexel(int(offset)), 0).r);
+}
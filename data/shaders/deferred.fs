@@ -0,0 +1,33 @@
+#version 410 core
+
+layout (location = 0) out highp vec4 FragColor;
+
+#include "gbuffer.glsl"
+#include "shading.glsl"
+
+uniform sampler2D gBufferAlbedo;
+uniform sampler2D gBufferNormal;
+uniform sampler2D gBufferDepth;
+uniform mat4 inverseViewProjection;
+uniform vec3 cameraPos;
+
+void main()
+{
+    ivec2 Texel = ivec2(gl_FragCoord.xy);
+    float Depth = texelFetch(gBufferDepth, Texel, 0).r;
+    if (Depth >= 1.0f) {
+        discard;
+    }
+
+    // reconstruct the world-space position from the depth buffer
+    vec2 Coord = (vec2(Texel) + 0.5f) / vec2(textureSize(gBufferDepth, 0));
+    vec4 Position = inverseViewProjection * vec4(vec3(Coord, Depth) * 2.0f - 1.0f, 1.0f);
+    vec3 P = Position.xyz / Position.w;
+
+    vec4 AlbedoSpecular = texelFetch(gBufferAlbedo, Texel, 0);
+    vec4 NormalRoughness = texelFetch(gBufferNormal, Texel, 0);
+    vec3 N = decodeNormal(NormalRoughness.xy);
+    vec3 V = normalize(cameraPos - P);
+
+    FragColor = vec4(shadeSurface(P, N, V, AlbedoSpecular.rgb, AlbedoSpecular.a, NormalRoughness.z), 1.0f);
+}
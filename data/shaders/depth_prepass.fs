@@ -0,0 +1,5 @@
+#version 410 core
+
+// depth only, color writes are masked during the pre-pass
+
+void main() {}
@@ -0,0 +1,20 @@
+#version 410 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 7) in uint aTransformSlot;
+layout (location = 8) in int aVertexFrameIndex;
+
+#include "transforms.glsl"
+#include "vertex_animation.glsl"
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// must match ggx.vs bit for bit, the shading pass tests depth with GL_EQUAL
+invariant gl_Position;
+
+void main() {
+    vec4 PosInWorld = meshTransform(aTransformSlot) * vec4(animatedPosition(aPos, aVertexFrameIndex, aTransformSlot), 1.0f);
+    vec4 PosInView = view * PosInWorld;
+    gl_Position = projection * PosInView;
+}
@@ -0,0 +1,9 @@
+#version 410 core
+
+#include "surface.glsl"
+
+// depth only, but alpha-tested texels must still be discarded
+
+void main() {
+    fetchAlbedo();
+}
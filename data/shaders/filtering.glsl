@@ -0,0 +1,28 @@
+#pragma once
+
+// Catmull-Rom bicubic filtering from five bilinear taps, dropping the four corner taps whose weights are small.
+// Reproduces the source exactly when sampled at its texel centers, i.e. at a scale of one.
+vec3 sampleCatmullRom(sampler2D Source, vec2 Coord) {
+    vec2 SourceSize = vec2(textureSize(Source, 0));
+    vec2 Position = Coord * SourceSize;
+    vec2 Center = floor(Position - 0.5f) + 0.5f;
+    vec2 f = Position - Center;
+
+    vec2 w0 = f * (-0.5f + f * (1.0f - 0.5f * f));
+    vec2 w1 = 1.0f + f * f * (-2.5f + 1.5f * f);
+    vec2 w2 = f * (0.5f + f * (2.0f - 1.5f * f));
+    vec2 w3 = f * f * (-0.5f + 0.5f * f);
+    vec2 w12 = w1 + w2;
+
+    vec2 Coord0 = (Center - 1.0f) / SourceSize;
+    vec2 Coord12 = (Center + w2 / w12) / SourceSize;
+    vec2 Coord3 = (Center + 2.0f) / SourceSize;
+
+    vec3 Result = texture(Source, vec2(Coord12.x, Coord0.y)).rgb * (w12.x * w0.y) +
+                  texture(Source, vec2(Coord0.x, Coord12.y)).rgb * (w0.x * w12.y) +
+                  texture(Source, Coord12).rgb * (w12.x * w12.y) +
+                  texture(Source, vec2(Coord3.x, Coord12.y)).rgb * (w3.x * w12.y) +
+                  texture(Source, vec2(Coord12.x, Coord3.y)).rgb * (w12.x * w3.y);
+    float Weight = w12.x * w0.y + w0.x * w12.y + w12.x * w12.y + w3.x * w12.y + w12.x * w3.y;
+    return max(Result / Weight, 0.0f);
+}
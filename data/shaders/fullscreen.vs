@@ -0,0 +1,8 @@
+#version 410 core
+
+// fullscreen triangle generated from the vertex index, drawn without vertex attributes
+
+void main() {
+    vec2 Coord = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+    gl_Position = vec4(Coord * 2.0f - 1.0f, 0.0f, 1.0f);
+}
@@ -0,0 +1,14 @@
+#version 410 core
+
+layout (location = 0) out vec4 GBufferAlbedo;  // rgb: albedo, a: specular
+layout (location = 1) out vec4 GBufferNormal;  // xy: octahedral normal, z: square root of roughness
+
+#include "surface.glsl"
+#include "gbuffer.glsl"
+
+void main()
+{
+    vec3 V = normalize(cameraPos - Position);
+    GBufferAlbedo = vec4(fetchAlbedo(), Specular);
+    GBufferNormal = vec4(encodeNormal(viewFacingNormal(V)), sqrt(Roughness), 0.0f);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// octahedral normal encoding for the G-buffer, maps unit vectors to [0, 1]^2
+
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0f ? n.xy : (1.0f - abs(n.yx)) * signNotZero(n.xy);
+    return e * 0.5f + 0.5f;
+}
+
+vec3 decodeNormal(vec2 e) {
+    e = e * 2.0f - 1.0f;
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f) {
+        n.xy = (1.0f - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n);
+}
@@ -2,28 +2,11 @@
 
 layout (location = 0) out vec4 FragColor;
 
-flat in float TexId;
-flat in vec2 TexOffset;
-flat in vec2 TexSize;
-in vec2 TexCoord;
-in vec3 Position;
-in vec3 Normal;
-in vec3 Color;
-in float Specular;
-in float Roughness;
-
-uniform sampler2DArray textures;
-uniform vec3 cameraPos;
-
-const int LIGHT_COUNT = ${LIGHT_COUNT};
-const float PI = 3.1415926536f;
-
-struct Light {
-    vec3 Position;
-    vec3 Color;
-};
+#include "surface.glsl"
+#include "clusters.glsl"
+#include "shadows.glsl"
 
-uniform Light lights[LIGHT_COUNT];
+const float PI = 3.1415926536f;
 
 float DistributionGGX(vec3 m, vec3 n, float alpha)
 {
@@ -72,27 +55,21 @@ float fresnel(float cos_theta, float eta) {
 void main()
 {
     vec3 V = normalize(cameraPos - Position);
-    vec3 N = normalize(dot(Normal, V) >= 0.0f ? Normal : -Normal);
+    vec3 N = viewFacingNormal(V);
 
 //    FragColor = vec4(0.5f * N + 0.5f, 1.0f);
 //    return;
 
-    vec3 Albedo = Color;
-    if (TexId >= 0) {
-        vec2 Coord = (fract(fract(TexCoord) + 1.0f) * TexSize + TexOffset) / ${TEXTURE_MAX_SIZE};
-        vec4 Sample = texture(textures, vec3(Coord, TexId));
-        if (Sample.a < 0.01f) {
-            discard;
-        }
-        Albedo = pow(Sample.rgb, vec3(2.2f));
-    }
+    vec3 Albedo = fetchAlbedo();
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for (int i = 0; i < LIGHT_COUNT; i++) {
+    uvec2 Cluster = clusterLightRange(-(view * vec4(Position, 1.0f)).z);
+    for (uint k = 0u; k < Cluster.y; k++) {
 
-        vec3 LightPosition = lights[i].Position;
-        vec3 LightColor = lights[i].Color;
+        int i = clusterLightIndex(Cluster.x + k);
+        vec3 LightPosition = lightPosition(i);
+        vec3 LightColor = lightEmission(i);
 
         // calculate per-light radiance
         vec3 L = normalize(LightPosition - Position);
@@ -103,8 +80,8 @@ void main()
         if (NdotL > 0.0f) {
 
             float distance = length(LightPosition - Position);
-            float attenuation = 1.0 / (distance * distance);
-            vec3 radiance = LightColor * attenuation;
+            float attenuation = lightAttenuation(distance, lightRange(i));
+            vec3 radiance = LightColor * attenuation * lightShadow(i, Position, N);
 
             vec3 H = normalize(V + L);
 
@@ -6,6 +6,12 @@ layout (location = 2) in vec3 aColor;
 layout (location = 3) in vec3 aTexCoords;
 layout (location = 4) in vec4 aTexProperty;
 layout (location = 5) in vec2 aGloss;
+layout (location = 6) in vec2 aLightmapCoord;
+layout (location = 7) in uint aTransformSlot;
+layout (location = 8) in int aVertexFrameIndex;
+
+#include "transforms.glsl"
+#include "vertex_animation.glsl"
 
 flat out float TexId;
 flat out vec2 TexOffset;
@@ -16,20 +22,31 @@ out vec3 Normal;
 out vec3 Color;
 out float Specular;
 out float Roughness;
+out vec2 LightmapCoord;
 
 uniform mat4 view;
 uniform mat4 projection;
 
+// must match depth_prepass.vs bit for bit, see Geometry::render_depth
+invariant gl_Position;
+
 void main() {
-    Position = aPos;
+    mat4 Model = meshTransform(aTransformSlot);
+    vec4 PosInWorld = Model * vec4(animatedPosition(aPos, aVertexFrameIndex, aTransformSlot), 1.0f);
+    Position = PosInWorld.xyz;
     TexCoord = aTexCoords.xy;
     TexId = aTexCoords.z;
     TexOffset = aTexProperty.xy;
     TexSize = aTexProperty.zw;
+    LightmapCoord = aLightmapCoord;
 
-    vec4 PosInView = view * vec4(aPos, 1.0f);
+    vec4 PosInView = view * PosInWorld;
 
-    Normal = aNormal;
+    // the animation tracks compose rotation and per-axis scale without shear, so the inverse transpose of the model
+    // matrix is the model matrix with each column divided by its squared length; mirrors flip the normals with it
+    mat3 NormalMatrix = mat3(Model);
+    vec3 ScaleSquared = vec3(dot(NormalMatrix[0], NormalMatrix[0]), dot(NormalMatrix[1], NormalMatrix[1]), dot(NormalMatrix[2], NormalMatrix[2]));
+    Normal = NormalMatrix * (animatedNormal(aNormal, aVertexFrameIndex, aTransformSlot) / max(ScaleSquared, vec3(1e-12f)));
     Color = aColor;
 
     Specular = clamp(aGloss.x, 0.0f, 1.0f);
@@ -0,0 +1,23 @@
+#version 410 core
+
+layout (location = 0) out highp vec4 FragColor;
+
+#include "surface.glsl"
+#include "shading.glsl"
+
+in vec2 LightmapCoord;
+
+uniform sampler2D lightmap;
+
+void main()
+{
+    vec3 V = normalize(cameraPos - Position);
+    vec3 N = viewFacingNormal(V);
+    vec3 Albedo = fetchAlbedo();
+
+    // diffuse irradiance baked by LightmapBaker, the view-dependent specular lobe is still evaluated per light
+    vec3 Irradiance = texture(lightmap, LightmapCoord).rgb;
+    vec3 Diffuse = (1.0f - Specular) * Albedo / PI * Irradiance;
+    FragColor = vec4(Diffuse + shadeSurfaceSpecular(Position, N, V, sqrt(Roughness)), 1.0f);
+
+}
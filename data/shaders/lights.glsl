@@ -0,0 +1,31 @@
+#pragma once
+
+// light list in structure-of-arrays textures, one light per texel
+const int LIGHT_TEXTURE_WIDTH = ${LIGHT_TEXTURE_WIDTH};
+
+uniform sampler2D lightPositions;
+uniform sampler2D lightEmissions;
+uniform int lightCount;
+
+ivec2 lightTexel(int index) {
+    return ivec2(index % LIGHT_TEXTURE_WIDTH, index / LIGHT_TEXTURE_WIDTH);
+}
+
+vec3 lightPosition(int index) {
+    return texelFetch(lightPositions, lightTexel(index), 0).xyz;
+}
+
+vec3 lightEmission(int index) {
+    return texelFetch(lightEmissions, lightTexel(index), 0).rgb;
+}
+
+float lightRange(int index) {
+    return texelFetch(lightEmissions, lightTexel(index), 0).a;
+}
+
+// inverse-square falloff windowed to reach exactly zero at the influence range of the light
+float lightAttenuation(float distance, float range) {
+    float ratio = distance / range;
+    float window = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+    return window * window / max(distance * distance, 0.0001f);
+}
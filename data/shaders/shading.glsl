@@ -0,0 +1,97 @@
+#pragma once
+
+// approximate GGX shading of a surface point against its cluster's lights, shared by the forward and deferred paths
+
+#include "clusters.glsl"
+#include "shadows.glsl"
+
+const float PI = 3.1415926536f;
+
+float DistributionGGX(vec3 N, vec3 H, float roughness) {
+    float a      = roughness*roughness;
+    float a2     = a*a;
+    float NdotH  = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+
+    float nom   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return nom / denom;
+}
+
+float GeometrySchlickGGX(float NdotV, float roughness) {
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float nom   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return nom / denom;
+}
+
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness) {
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+
+vec3 fresnelSchlick(float cosTheta, vec3 F0) {
+    return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+// outgoing radiance from P towards V, Alpha is the square root of the vertex roughness
+vec3 shadeSurface(vec3 P, vec3 N, vec3 V, vec3 Albedo, float SpecularWeight, float Alpha) {
+
+    float Metallic = 0.0f;
+
+    vec3 F0 = mix(vec3(0.04), Albedo, Metallic);
+    vec3 Lo = vec3(0.0);
+    uvec2 Cluster = clusterLightRange(-(view * vec4(P, 1.0f)).z);
+    for (uint k = 0u; k < Cluster.y; k++) {
+
+        int i = clusterLightIndex(Cluster.x + k);
+        vec3 LightPosition = lightPosition(i);
+        vec3 LightColor = lightEmission(i);
+
+        // calculate per-light radiance
+        vec3 L = normalize(LightPosition - P);
+
+        float distance = length(LightPosition - P);
+        float attenuation = lightAttenuation(distance, lightRange(i));
+        vec3 radiance = LightColor * attenuation * lightShadow(i, P, N);
+
+        vec3 H = normalize(V + L);
+
+        // Cook-Torrance BRDF
+        float NDF = DistributionGGX(N, H, Alpha);
+        float G = GeometrySmith(N, V, L, Alpha);
+        vec3 F = fresnelSchlickRoughness(max(dot(H, V), 0.0), F0, Alpha);
+
+        vec3 Ks = vec3(SpecularWeight);
+        vec3 Kd = vec3(1.0) - Ks;
+        Kd *= 1.0 - Metallic;
+
+        vec3 nominator    = NDF * G * F;
+        float denominator = 4.0 * max(dot(N, V), 0.0) + 0.001;
+        vec3 specular     = nominator / denominator;
+
+        // add to outgoing radiance Lo
+        float NdotL = max(dot(N, L), 0.0);
+        Lo += (Kd * Albedo / PI * NdotL + specular) * radiance;
+    }
+    return Lo;
+}
+
+// the specular lobe of shadeSurface alone, for surfaces whose diffuse lighting comes from a lightmap
+vec3 shadeSurfaceSpecular(vec3 P, vec3 N, vec3 V, float Alpha) {
+    return shadeSurface(P, N, V, vec3(0.0f), 0.0f, Alpha);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "lights.glsl"
+
+// omnidirectional point-light shadows, six cube-face tiles per light in a depth atlas, see ShadowAtlas
+uniform sampler2DShadow shadowAtlas;
+uniform isampler2D lightShadowSlots;  // first atlas tile of each light, -1 if the light casts no shadow
+uniform vec4 shadowParams;            // x: tiles per row, y: tile size in atlas uv, z: face scale, w: tile size in texels
+uniform float shadowNearRatio;        // near plane of the shadow frusta relative to the light range
+
+// must match face_forwards and face_ups in shadow_atlas.cpp
+const vec3 SHADOW_FACE_FORWARDS[6] = vec3[6](
+    vec3(1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f),
+    vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f));
+const vec3 SHADOW_FACE_UPS[6] = vec3[6](
+    vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, -1.0f),
+    vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+int shadowFace(vec3 d) {
+    vec3 a = abs(d);
+    if (a.x >= a.y && a.x >= a.z) {
+        return d.x >= 0.0f ? 0 : 1;
+    }
+    if (a.y >= a.z) {
+        return d.y >= 0.0f ? 2 : 3;
+    }
+    return d.z >= 0.0f ? 4 : 5;
+}
+
+// fraction of the light reaching P, N is the geometric normal used to offset the lookup against acne
+float lightShadow(int index, vec3 P, vec3 N) {
+
+    int slot = texelFetch(lightShadowSlots, lightTexel(index), 0).r;
+    if (slot < 0) {
+        return 1.0f;
+    }
+
+    // offset along the normal by about a shadow texel at the distance of the point
+    vec3 LightPosition = lightPosition(index);
+    vec3 d = P - LightPosition;
+    float texel = 2.0f * max(max(abs(d.x), abs(d.y)), abs(d.z)) / (shadowParams.z * shadowParams.w);
+    d += N * (1.5f * texel);
+
+    int face = shadowFace(d);
+    vec3 F = SHADOW_FACE_FORWARDS[face];
+    vec3 U = SHADOW_FACE_UPS[face];
+    vec3 R = cross(F, U);
+    float m = dot(d, F);
+    vec2 ndc = vec2(dot(d, R), dot(d, U)) / m * shadowParams.z;
+
+    // same depth mapping as the perspective projection the face was rendered with
+    float f = lightRange(index);
+    float n = f * shadowNearRatio;
+    float depth = ((f + n) / (f - n) - 2.0f * f * n / ((f - n) * m)) * 0.5f + 0.5f;
+
+    int tile = slot + face;
+    int tilesPerRow = int(shadowParams.x);
+    vec2 uv = (vec2(tile % tilesPerRow, tile / tilesPerRow) + ndc * 0.5f + 0.5f) * shadowParams.y;
+    return texture(shadowAtlas, vec3(uv, depth));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// fragment inputs and material lookup shared by the GGX fragment shaders
+
+flat in float TexId;
+flat in vec2 TexOffset;
+flat in vec2 TexSize;
+in vec2 TexCoord;
+in vec3 Position;
+in vec3 Normal;
+in vec3 Color;
+in float Specular;
+in float Roughness;
+
+uniform sampler2DArray textures;
+uniform vec3 cameraPos;
+
+// returns the linear albedo of the fragment, discarding alpha-tested texels
+vec3 fetchAlbedo() {
+    vec3 Albedo = Color;
+    if (TexId >= 0.0f) {
+        vec2 Coord = (fract(fract(TexCoord) + 1.0f) * TexSize + TexOffset) / float(${TEXTURE_MAX_SIZE});
+        vec4 Sample = texture(textures, vec3(Coord, TexId));
+        if (Sample.a < 0.01f) {
+            discard;
+        }
+        Albedo = pow(Sample.rgb, vec3(2.2f));
+    }
+    return Albedo;
+}
+
+// shading normal facing the viewer
+vec3 viewFacingNormal(vec3 V) {
+    return normalize(dot(Normal, V) >= 0.0f ? Normal : -Normal);
+}
@@ -0,0 +1,74 @@
+#version 410 core
+
+layout (location = 0) out highp vec4 FragColor;
+
+#include "filtering.glsl"
+
+// temporal anti-aliasing resolve: blends the jittered frame into the reprojected history, see TemporalAA
+
+uniform sampler2D sceneColor;
+uniform sampler2D sceneDepth;
+uniform sampler2D historyColor;
+uniform mat4 reprojection;    // current to previous clip space, both without jitter
+uniform float historyWeight;  // zero while the history is invalid
+
+vec3 toYCoCg(vec3 Color) {
+    return vec3(dot(Color, vec3(0.25f, 0.5f, 0.25f)), dot(Color, vec3(0.5f, 0.0f, -0.5f)), dot(Color, vec3(-0.25f, 0.5f, -0.25f)));
+}
+
+vec3 fromYCoCg(vec3 Color) {
+    return vec3(Color.x + Color.y - Color.z, Color.x + Color.z, Color.x - Color.y - Color.z);
+}
+
+// moves the color along the line to the center of the box until it lies inside, which keeps its hue unlike a
+// per-channel clamp
+vec3 clipToBox(vec3 Color, vec3 Lo, vec3 Hi) {
+    vec3 Center = 0.5f * (Hi + Lo);
+    vec3 Extent = 0.5f * (Hi - Lo) + 1e-4f;
+    vec3 Offset = Color - Center;
+    vec3 Units = abs(Offset / Extent);
+    float MaxUnit = max(Units.x, max(Units.y, Units.z));
+    return MaxUnit > 1.0f ? Center + Offset / MaxUnit : Color;
+}
+
+void main()
+{
+    ivec2 Size = textureSize(sceneColor, 0);
+    ivec2 Texel = ivec2(gl_FragCoord.xy);
+    vec2 Coord = gl_FragCoord.xy / vec2(Size);
+
+    // neighborhood statistics of the current frame, and the closest depth so that edges move with the foreground
+    vec3 Current = vec3(0.0f);
+    vec3 Mean = vec3(0.0f);
+    vec3 Moment = vec3(0.0f);
+    float ClosestDepth = 1.0f;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 Neighbor = clamp(Texel + ivec2(x, y), ivec2(0), Size - 1);
+            vec3 Color = toYCoCg(texelFetch(sceneColor, Neighbor, 0).rgb);
+            Mean += Color;
+            Moment += Color * Color;
+            ClosestDepth = min(ClosestDepth, texelFetch(sceneDepth, Neighbor, 0).r);
+            if (x == 0 && y == 0) { Current = Color; }
+        }
+    }
+    Mean /= 9.0f;
+    vec3 Deviation = sqrt(max(Moment / 9.0f - Mean * Mean, 0.0f));
+
+    // camera motion, the only motion in the scene, from the depth and the two view-projections
+    vec4 Previous = reprojection * vec4(vec3(Coord, ClosestDepth) * 2.0f - 1.0f, 1.0f);
+    vec2 PreviousCoord = Previous.xy / Previous.w * 0.5f + 0.5f;
+    float Weight = historyWeight;
+    if (Previous.w <= 0.0f || any(lessThan(PreviousCoord, vec2(0.0f))) || any(greaterThan(PreviousCoord, vec2(1.0f)))) {
+        Weight = 0.0f;
+    }
+
+    // variance clipping rejects history that the current neighborhood does not support (disocclusion, lighting)
+    vec3 History = clipToBox(toYCoCg(sampleCatmullRom(historyColor, PreviousCoord)), Mean - 1.25f * Deviation, Mean + 1.25f * Deviation);
+
+    // weighting by inverse luminance keeps bright sub-pixel features from flickering
+    float CurrentWeight = (1.0f - Weight) / (1.0f + Current.x);
+    float HistoryWeight = Weight / (1.0f + History.x);
+    vec3 Result = (Current * CurrentWeight + History * HistoryWeight) / (CurrentWeight + HistoryWeight);
+    FragColor = vec4(max(fromYCoCg(Result), 0.0f), 1.0f);
+}
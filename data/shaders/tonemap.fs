@@ -0,0 +1,26 @@
+#version 410 core
+
+layout (location = 0) out highp vec4 FragColor;
+
+#include "filtering.glsl"
+
+// filters the HDR scene color, rendered at a lower resolution or accumulated by TAA, onto the window and maps it
+// into the displayable range; the sRGB encoding is left to the framebuffer. Offline renders keep the exposed color
+// linear for OpenEXR.
+
+uniform sampler2D sceneColor;
+uniform vec2 outputSize;
+uniform float exposure;
+uniform bool linearOutput;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemapACES(vec3 Color) {
+    return clamp(Color * (2.51f * Color + 0.03f) / (Color * (2.43f * Color + 0.59f) + 0.14f), 0.0f, 1.0f);
+}
+
+void main()
+{
+    vec3 Color = sampleCatmullRom(sceneColor, gl_FragCoord.xy / outputSize);
+    Color *= exposure;
+    FragColor = vec4(linearOutput ? max(Color, vec3(0.0f)) : tonemapACES(Color), 1.0f);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// model matrices of the animated meshes, the rows of the affine part in three texels per slot; slot 0 is the
+// identity shared by the static meshes
+const int TRANSFORM_TEXTURE_WIDTH = ${TRANSFORM_TEXTURE_WIDTH};
+
+uniform sampler2D meshTransforms;
+
+vec4 transformTexel(int index) {
+    return texelFetch(meshTransforms, ivec2(index % TRANSFORM_TEXTURE_WIDTH, index / TRANSFORM_TEXTURE_WIDTH), 0);
+}
+
+mat4 meshTransform(uint slot) {
+    int first = int(slot) * 3;
+    return transpose(mat4(transformTexel(first), transformTexel(first + 1), transformTexel(first + 2), vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
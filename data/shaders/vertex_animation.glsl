@@ -0,0 +1,51 @@
+#pragma once
+
+#include "transforms.glsl"
+
+// keyframes of the vertex-animated meshes, blended per mesh by the weight of the second frame texture; the frames
+// hold quantized displacements from the rest pose and 8:8 octahedral normals, see VertexAnimationData
+const int VERTEX_FRAME_TEXTURE_WIDTH = ${VERTEX_FRAME_TEXTURE_WIDTH};
+
+uniform isampler2D vertexFrames0;
+uniform isampler2D vertexFrames1;
+uniform sampler2D vertexAnimationTracks;  // per transform slot: weight, scale of frame 0, scale of frame 1
+
+ivec2 vertexFrameTexel(int index) {
+    return ivec2(index % VERTEX_FRAME_TEXTURE_WIDTH, index / VERTEX_FRAME_TEXTURE_WIDTH);
+}
+
+vec4 vertexAnimationTrack(uint slot) {
+    int index = int(slot);
+    return texelFetch(vertexAnimationTracks, ivec2(index % TRANSFORM_TEXTURE_WIDTH, index / TRANSFORM_TEXTURE_WIDTH), 0);
+}
+
+vec3 decodeOctahedral(int bits) {
+    vec2 e = vec2(float((bits >> 8) & 0xff), float(bits & 0xff)) / 127.5f - 1.0f;
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f) {
+        n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+
+vec3 animatedPosition(vec3 position, int index, uint slot) {
+    if (index < 0) {
+        return position;
+    }
+    vec4 track = vertexAnimationTrack(slot);
+    ivec2 texel = vertexFrameTexel(index);
+    vec3 d0 = vec3(texelFetch(vertexFrames0, texel, 0).xyz) * track.y;
+    vec3 d1 = vec3(texelFetch(vertexFrames1, texel, 0).xyz) * track.z;
+    return position + mix(d0, d1, track.x);
+}
+
+vec3 animatedNormal(vec3 normal, int index, uint slot) {
+    if (index < 0) {
+        return normal;
+    }
+    vec4 track = vertexAnimationTrack(slot);
+    ivec2 texel = vertexFrameTexel(index);
+    vec3 n0 = decodeOctahedral(texelFetch(vertexFrames0, texel, 0).w);
+    vec3 n1 = decodeOctahedral(texelFetch(vertexFrames1, texel, 0).w);
+    return mix(n0, n1, track.x);
+}
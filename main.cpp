@@ -5,13 +5,38 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <map>
+#include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <optional>
+#include <filesystem>
 
 #include <core/scene.h>
 #include <core/shader.h>
 #include <core/camera.h>
 #include <core/serialize.h>
 #include <core/camera_animator.h>
+#include <core/shader_watcher.h>
+#include <core/light_buffer.h>
+#include <core/light_culler.h>
+#include <core/light_animator.h>
+#include <core/mesh_animator.h>
+#include <core/vertex_animation.h>
+#include <core/gbuffer.h>
+#include <core/shadow_atlas.h>
+#include <core/lightmap.h>
+#include <core/lightmap_baker.h>
+#include <core/gpu_timer.h>
+#include <core/color_format.h>
+#include <core/render_target.h>
+#include <core/resolution_scaler.h>
+#include <core/temporal_aa.h>
+#include <core/occlusion_culler.h>
+#include <core/occlusion_queries.h>
+#include <core/visibility_baker.h>
+#include <core/framebuffer.h>
 
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
@@ -31,6 +56,19 @@ float lastX = (float)screen_width;
 float lastY = (float)screen_height / 2.0;
 bool firstMouse = true;
 bool camera_animation_enabled = true;
+enum struct ShadingMode {
+    FORWARD,
+    DEFERRED,
+    LIGHTMAP
+};
+
+ShadingMode shading_mode = ShadingMode::FORWARD;
+bool depth_prepass_enabled = true;
+bool dynamic_resolution_enabled = true;
+bool temporal_aa_enabled = true;
+bool occlusion_culling_enabled = true;
+bool lod_enabled = true;
+float exposure = 1.0f;
 
 // timing
 float deltaTime = 0.0f;
@@ -43,8 +81,44 @@ constexpr auto fov = 60.0f;
 int main(int argc, char *argv[]) {
     
     std::string scene_path{"data/scenes/sun_temple/SunTemple.scene"};
-    if (argc > 1) {
-        scene_path = argv[1];
+    auto bake_lightmap = false;  // --bake: (re-)bake the lightmap and visibility sets if the cached ones are missing or stale
+    ResolutionScaler::Settings resolution_settings;  // --frame-time <ms>: GPU time budget of dynamic resolution
+    auto hdr_format = ColorFormat::R11G11B10F;       // --hdr-format <r11g11b10f|rgba16f|rgba32f>: scene color target
+    std::string render_folder;                       // --render <folder>: render the camera path offline into frames
+    auto render_fps = 30.0;                          // --fps <rate>: frames per second of animation time
+    auto render_frame_count = 0u;                    // --frames <count>: defaults to one pass along the camera path
+    uint32_t output_width = screen_width;            // --width <pixels>: of offline frames
+    uint32_t output_height = screen_height;          // --height <pixels>
+    ExrWriter::Settings exr_settings;                // --exr-float: full instead of half floats, --exr-uncompressed
+    for (auto i = 1; i < argc; i++) {
+        if (std::string{argv[i]} == "--bake") {
+            bake_lightmap = true;
+        } else if (std::string{argv[i]} == "--render" && i + 1 < argc) {
+            render_folder = argv[++i];
+        } else if (std::string{argv[i]} == "--fps" && i + 1 < argc) {
+            render_fps = std::stod(argv[++i]);
+        } else if (std::string{argv[i]} == "--frames" && i + 1 < argc) {
+            render_frame_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (std::string{argv[i]} == "--width" && i + 1 < argc) {
+            output_width = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (std::string{argv[i]} == "--height" && i + 1 < argc) {
+            output_height = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (std::string{argv[i]} == "--exr-float") {
+            exr_settings.half = false;
+        } else if (std::string{argv[i]} == "--exr-uncompressed") {
+            exr_settings.compression = ExrWriter::Compression::NONE;
+        } else if (std::string{argv[i]} == "--frame-time" && i + 1 < argc) {
+            resolution_settings.target_frame_time = std::stof(argv[++i]);
+        } else if (std::string{argv[i]} == "--hdr-format" && i + 1 < argc) {
+            auto format = parse_color_format(argv[++i]);
+            if (!format || !color_format_info(*format).hdr) {
+                std::cout << "Unsupported HDR format: " << argv[i] << std::endl;
+                return -1;
+            }
+            hdr_format = *format;
+        } else {
+            scene_path = argv[i];
+        }
     }
     
     std::cout << "Loading scene: " << scene_path << std::endl;
@@ -70,7 +144,18 @@ int main(int argc, char *argv[]) {
     
     // glfw window creation
     // ====================
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_SAMPLES, 0);  // the scene is anti-aliased offscreen, the window only receives the tonemapped result
+    
+    // Offline rendering steps the animation time at a fixed frame rate and writes every frame to an OpenEXR file
+    // instead of the window, which stays hidden and only provides the context. The wall clock, input, vsync, shader
+    // reloading and dynamic resolution are all left out, so the frames are reproducible and come as fast as the GPU
+    // and the EXR writer allow.
+    auto offline = !render_folder.empty();
+    if (offline) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        camera_animation_enabled = true;
+        dynamic_resolution_enabled = false;
+    }
     GLFWwindow *window = glfwCreateWindow(screen_width, screen_height, "LuisaVR", nullptr, nullptr);
     if (window == nullptr) {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -82,6 +167,8 @@ int main(int argc, char *argv[]) {
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
     
+    glfwSwapInterval(offline ? 0 : 1);
+    
     // tell GLFW to capture our mouse
     if (!camera_animation_enabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -94,79 +181,423 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     
-    // create scene
-    auto geometry = Geometry::create(scene);
-    auto far_plane = glm::length(geometry.aabb().max - geometry.aabb().min) * 1.1f;
-    
-    // build and compile shaders
-    Shader shader{"data/shaders/ggx.vs", "data/shaders/ggx_approx.fs", {}, {
-        {std::string{"LIGHT_COUNT"}, serialize(scene.lights().size())},
-        {std::string{"TEXTURE_MAX_SIZE"}, serialize(4096)}}};
-    
-    auto animation_time = 0.0f;
-    auto camera_animator = CameraAnimator::create(scene);
-    
-    double last_fps_time = glfwGetTime();
-    int nbFrames = 0;
-    
-    auto count = 0;
-    
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    glEnable(GL_MULTISAMPLE);
-    
-    while (!glfwWindowShouldClose(window)) {
+    // everything owning OpenGL objects lives in this scope, so it is released before the context is destroyed
+    {
+        // create scene, with the diffuse lighting baked into a lightmap and the visibility along the camera path into
+        // potentially visible sets, both cached next to the scene file (see LuisaBake for baking without a window), as
+        // are the vertex animation frames imported from the keyframe meshes
+        auto lightmap_path = scene_path + ".lightmap";
+        auto lightmap_key = LightmapBaker::cache_key(scene_path, scene);
+        auto lightmap_data = LightmapData::load(lightmap_path, lightmap_key);
+        auto visibility_path = scene_path + ".pvs";
+        auto visibility_key = VisibilityBaker::cache_key(scene_path, scene);
+        auto visibility_data = VisibilityData::load(visibility_path, visibility_key);
+        auto vertex_animation_path = scene_path + ".vat";
+        auto vertex_animation_key = VertexAnimationData::cache_key(scene_path, scene);
+        auto vertex_animation_data = VertexAnimationData::load(vertex_animation_path, vertex_animation_key);
+        // the occluders for software occlusion culling are picked from the same geometry data
+        std::optional<OcclusionCuller> occlusion_culler;
+        auto geometry = [&] {
+            auto geometry_data = GeometryData::load(scene);
+            occlusion_culler.emplace(OcclusionCuller::create(geometry_data));
+            if (!lightmap_data && bake_lightmap) {
+                lightmap_data = LightmapBaker::bake(scene, geometry_data);
+                lightmap_data->key = lightmap_key;
+                lightmap_data->save(lightmap_path);
+            }
+            if (!visibility_data && bake_lightmap) {
+                visibility_data = VisibilityBaker::bake(scene, geometry_data);
+                visibility_data->key = visibility_key;
+                visibility_data->save(visibility_path);
+            }
+            if (!vertex_animation_data) {
+                vertex_animation_data = VertexAnimationData::import(scene, geometry_data, vertex_animation_path, vertex_animation_key);
+            }
+            return Geometry::create(geometry_data);
+        }();
+        auto vertex_animation = VertexAnimationStreamer::create(std::move(*vertex_animation_data), geometry);
+        if (visibility_data && (visibility_data->empty() || visibility_data->meshlet_count != geometry.meshlets().size())) {
+            visibility_data.reset();
+        }
+        std::vector<bool> potentially_visible;
+        auto last_visibility_segment = std::numeric_limits<size_t>::max();
+        if (lightmap_data) {
+            geometry.set_lightmap_coords(lightmap_data->coords);
+        }
+        auto lightmap = Lightmap::create(lightmap_data.value_or(LightmapData{}));
+        lightmap_data.reset();
+        
+        auto far_plane = glm::length(geometry.aabb().max - geometry.aabb().min) * 1.1f;
+        auto light_buffer = LightBuffer::create(scene);
+        auto light_animator = LightAnimator::create(scene);
+        auto mesh_animator = MeshAnimator::create(scene);
+        auto light_culler = LightCuller::create();
+        auto shadow_atlas = ShadowAtlas::create();
         
-        auto current_time = static_cast<float>(glfwGetTime());
-        animation_time = static_cast<float>(current_time);
+        // build and compile shaders
+        Shader::TemplateList shader_templates{
+            {std::string{"LIGHT_TEXTURE_WIDTH"}, serialize(LightBuffer::texture_width)},
+            {std::string{"TRANSFORM_TEXTURE_WIDTH"}, serialize(Geometry::transform_texture_width)},
+            {std::string{"VERTEX_FRAME_TEXTURE_WIDTH"}, serialize(Geometry::vertex_frame_texture_width)},
+            {std::string{"CLUSTER_GRID_X"}, serialize(LightCuller::grid_x)},
+            {std::string{"CLUSTER_GRID_Y"}, serialize(LightCuller::grid_y)},
+            {std::string{"CLUSTER_GRID_Z"}, serialize(LightCuller::grid_z)},
+            {std::string{"TEXTURE_MAX_SIZE"}, serialize(4096)}};
+        Shader shader{"data/shaders/ggx.vs", "data/shaders/ggx_approx.fs", {}, shader_templates};
+        Shader lightmap_shader{"data/shaders/ggx.vs", "data/shaders/ggx_lightmap.fs", {}, shader_templates};
+        Shader gbuffer_shader{"data/shaders/ggx.vs", "data/shaders/gbuffer.fs", {}, shader_templates};
+        Shader deferred_shader{"data/shaders/fullscreen.vs", "data/shaders/deferred.fs", {}, shader_templates};
+        Shader depth_prepass_shader{"data/shaders/depth_prepass.vs", "data/shaders/depth_prepass.fs", {}, shader_templates};
+        Shader depth_prepass_alpha_shader{"data/shaders/ggx.vs", "data/shaders/depth_prepass_alpha.fs", {}, shader_templates};
+        Shader tonemap_shader{"data/shaders/fullscreen.vs", "data/shaders/tonemap.fs", {}, shader_templates};
+        Shader taa_shader{"data/shaders/fullscreen.vs", "data/shaders/taa.fs", {}, shader_templates};
+        Shader box_shader{"data/shaders/bounding_box.vs", "data/shaders/depth_prepass.fs", {}, shader_templates};
         
-        nbFrames++;
-        if (nbFrames == 30) {
-            std::cout << "FPS: " << nbFrames / (current_time - last_fps_time) << std::endl;
-            last_fps_time = current_time;
-            nbFrames = 0;
+        // rebuild shaders in the background whenever their sources are edited, not while rendering offline
+        std::optional<ShaderWatcher> shader_watcher;
+        if (!offline) {
+            shader_watcher.emplace("data/shaders");
+            shader_watcher->watch(shader);
+            shader_watcher->watch(lightmap_shader);
+            shader_watcher->watch(gbuffer_shader);
+            shader_watcher->watch(deferred_shader);
+            shader_watcher->watch(depth_prepass_shader);
+            shader_watcher->watch(depth_prepass_alpha_shader);
+            shader_watcher->watch(tonemap_shader);
+            shader_watcher->watch(taa_shader);
+            shader_watcher->watch(box_shader);
         }
         
-        deltaTime = current_time - last_frame_time;
-        last_frame_time = current_time;
+        // shading mode, switched at runtime with F (forward), G (deferred) and B (forward with the baked lightmap)
+        auto gbuffer = GBuffer::create(screen_width, screen_height);
+        auto last_shading_mode = ShadingMode::DEFERRED;
         
-        processInput(window);
+        // depth pre-pass, toggled at runtime with Z (on) and X (off)
+        auto last_depth_prepass_enabled = depth_prepass_enabled;
         
-        auto view_matrix = get_camera().GetViewMatrix();
-        auto camera_position = get_camera().GetPosition();
-        if (camera_animation_enabled && !camera_animator.empty()) {
-            auto state = camera_animator.state(animation_time);
-            camera_position = state.eye;
-            view_matrix = glm::lookAt(state.eye, state.lookat, state.up);
-        }
+        // the scene is rendered into an HDR target and tonemapped onto the window, with the exposure adjusted at
+        // runtime with - and =
+        std::cout << "HDR format: " << color_format_info(hdr_format).name << std::endl;
+        auto scene_target = RenderTarget::create(screen_width, screen_height, 1u, hdr_format);
+        
+        // dynamic resolution, toggled at runtime with R (on) and T (off): the scene is rendered at a scale chosen from
+        // the measured GPU time and filtered onto the window
+        auto gpu_timer = GpuTimer::create();
+        ResolutionScaler resolution_scaler{resolution_settings};
+        auto last_dynamic_resolution_enabled = !dynamic_resolution_enabled;
+        
+        // anti-aliasing, switched at runtime with H (temporal) and N (4x MSAA): TAA renders single-sampled
+        // with a jittered projection and accumulates the frames, which also covers the deferred path
+        auto temporal_aa = TemporalAA::create(screen_width, screen_height);
+        auto last_temporal_aa_enabled = !temporal_aa_enabled;
         
-        auto frame_width = 0;
-        auto frame_height = 0;
-        glfwGetFramebufferSize(window, &frame_width, &frame_height);
+        Geometry::DrawList draw_list;
+        auto last_occlusion_culling_enabled = !occlusion_culling_enabled;
         
-        auto projection = glm::perspective(glm::radians(fov), static_cast<float>(frame_width) / static_cast<float>(frame_height), near_plane, far_plane);
+        // hardware occlusion queries in free flight, where no visibility sets apply, on with occlusion culling
+        auto occlusion_queries = OcclusionQueries::create(geometry);
+        auto last_occlusion_queries_enabled = false;
         
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(static_cast<uint32_t>(GL_COLOR_BUFFER_BIT) | static_cast<uint32_t>(GL_DEPTH_BUFFER_BIT));
-        glViewport(0, 0, frame_width, frame_height);
-        shader.use();
-        for (auto i = 0ul; i < scene.lights().size(); i++) {
-            shader.setVec3(serialize("lights[", i, "].Position"), scene.lights()[i].position);
-            shader.setVec3(serialize("lights[", i, "].Color"), scene.lights()[i].emission);
+        auto animation_time = 0.0f;
+        auto camera_animator = CameraAnimator::create(scene);
+        CameraAnimator::Cursor camera_cursor;
+        
+        // offline frames start at the first camera keyframe, the frame count covers the path once unless given
+        auto render_start_time = scene.cameras().empty() ? 0.0 : static_cast<double>(scene.cameras().front().time);
+        if (offline && render_frame_count == 0u) {
+            auto duration = scene.cameras().empty() ? 0.0 : static_cast<double>(scene.cameras().back().time) - render_start_time;
+            render_frame_count = std::max(static_cast<uint32_t>(std::ceil(duration * render_fps)), 1u);
+        }
+        std::optional<Framebuffer> render_framebuffer;
+        if (offline) {
+            std::filesystem::create_directories(render_folder);
+            // rendered and read back in full floats, the EXR writer narrows them to half floats unless --exr-float is given
+            render_framebuffer.emplace(output_width, output_height, ColorFormat::RGBA32F, exr_settings);
+            std::cout << "Rendering " << render_frame_count << " frames at " << render_fps << " fps and "
+                      << output_width << "x" << output_height << " into " << render_folder << std::endl;
         }
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view_matrix);
-        shader.setVec3("cameraPos", camera_position);
-        geometry.render(shader);
+        auto render_frame_index = 0u;
+        
+        double last_fps_time = glfwGetTime();
+        int nbFrames = 0;
         
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        auto count = 0;
+        
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        glEnable(GL_MULTISAMPLE);
+        
+        while (offline ? render_frame_index < render_frame_count : !glfwWindowShouldClose(window)) {
+            
+            // swap in programs reloaded since the last frame
+            if (shader_watcher) { shader_watcher->update(); }
+            
+            // offline frames compute their time from the index, without accumulating rounding errors
+            auto current_time = static_cast<float>(glfwGetTime());
+            animation_time = offline ? static_cast<float>(render_start_time + render_frame_index / render_fps) : current_time;
+            
+            nbFrames++;
+            if (nbFrames == 30) {
+                std::cout << "FPS: " << nbFrames / (current_time - last_fps_time)
+                          << ", triangles: " << draw_list.triangle_count << " / " << geometry.triangle_count() << std::endl;
+                last_fps_time = current_time;
+                nbFrames = 0;
+            }
+            
+            deltaTime = current_time - last_frame_time;
+            last_frame_time = current_time;
+            
+            if (!offline) {
+                processInput(window);
+            }
+            
+            auto view_matrix = get_camera().GetViewMatrix();
+            auto camera_position = get_camera().GetPosition();
+            if (camera_animation_enabled && !camera_animator.empty()) {
+                auto state = camera_animator.state(animation_time, camera_cursor);
+                camera_position = state.eye;
+                view_matrix = glm::lookAt(state.eye, state.lookat, state.up);
+            }
+            
+            auto frame_width = static_cast<int>(output_width);
+            auto frame_height = static_cast<int>(output_height);
+            if (!offline) {
+                glfwGetFramebufferSize(window, &frame_width, &frame_height);
+            }
+            
+            auto aspect = static_cast<float>(frame_width) / static_cast<float>(frame_height);
+            auto projection = glm::perspective(glm::radians(fov), aspect, near_plane, far_plane);
+            auto view_projection = projection * view_matrix;  // without the TAA jitter, for reprojection
+            
+            // the scene is rendered at a lower resolution under dynamic resolution scaling
+            auto render_width = frame_width;
+            auto render_height = frame_height;
+            if (dynamic_resolution_enabled) {
+                auto resolution = resolution_scaler.resolution(glm::uvec2{frame_width, frame_height});
+                render_width = static_cast<int>(resolution.x);
+                render_height = static_cast<int>(resolution.y);
+            }
+            if (dynamic_resolution_enabled != last_dynamic_resolution_enabled) {
+                std::cout << "Dynamic resolution: " << (dynamic_resolution_enabled ? "on" : "off")
+                          << ", frame time budget: " << resolution_scaler.settings().target_frame_time << " ms" << std::endl;
+                last_dynamic_resolution_enabled = dynamic_resolution_enabled;
+            }
+            if (temporal_aa_enabled != last_temporal_aa_enabled) {
+                std::cout << "Anti-aliasing: " << (temporal_aa_enabled ? "TAA" : "4x MSAA") << std::endl;
+                temporal_aa.invalidate();
+                last_temporal_aa_enabled = temporal_aa_enabled;
+            }
+            if (temporal_aa_enabled) {
+                temporal_aa.resize(render_width, render_height);
+                projection = temporal_aa.jittered(projection);
+            }
+            
+            gpu_timer.begin();
+            
+            light_animator.update(light_buffer, animation_time);
+            light_buffer.upload();
+            // animated meshes only upload their model matrices and the vertex frames they move on to, the shadows
+            // they sweep through are rendered again
+            if (mesh_animator.update(geometry, animation_time)) {
+                for (auto &&bounds : mesh_animator.swept_bounds()) {
+                    shadow_atlas.invalidate(bounds);
+                }
+            }
+            if (vertex_animation.update(geometry, animation_time)) {
+                for (auto &&bounds : vertex_animation.swept_bounds()) {
+                    shadow_atlas.invalidate(bounds);
+                }
+            }
+            light_culler.update(light_buffer, view_matrix, glm::radians(fov), aspect, near_plane, far_plane);
+            shadow_atlas.update(light_buffer, geometry, depth_prepass_shader, depth_prepass_alpha_shader);
+            
+            if (shading_mode == ShadingMode::LIGHTMAP && lightmap.empty()) {
+                std::cout << "No lightmap baked for this scene, run with --bake or use LuisaBake" << std::endl;
+                shading_mode = last_shading_mode;
+            }
+            if (shading_mode != last_shading_mode || depth_prepass_enabled != last_depth_prepass_enabled) {
+                std::cout << "Shading mode: "
+                          << (shading_mode == ShadingMode::DEFERRED ? "deferred" : (shading_mode == ShadingMode::LIGHTMAP ? "lightmap" : "forward"))
+                          << ", depth pre-pass: " << (depth_prepass_enabled ? "on" : "off") << std::endl;
+                last_shading_mode = shading_mode;
+                last_depth_prepass_enabled = depth_prepass_enabled;
+            }
+            
+            // frustum, occlusion and back-facing meshlet culling against the draw range BVH, shared by all camera passes
+            // of the frame; the occluders are rasterized on the CPU without the TAA jitter, toggled with O and P
+            if (occlusion_culling_enabled != last_occlusion_culling_enabled) {
+                std::cout << "Occlusion culling: " << (occlusion_culling_enabled ? "on" : "off")
+                          << ", occluders: " << occlusion_culler->occluder_triangle_count() << " triangles" << std::endl;
+                last_occlusion_culling_enabled = occlusion_culling_enabled;
+            }
+            if (occlusion_culling_enabled) {
+                occlusion_culler->render(view_projection, aspect);
+            }
+            // levels of detail within a pixel of error, toggled with I and U; the lightmap has no charts for them
+            Geometry::CullSettings cull_settings;
+            cull_settings.occlusion = occlusion_culling_enabled ? &*occlusion_culler : nullptr;
+            cull_settings.back_faces = true;
+            if (lod_enabled && shading_mode != ShadingMode::LIGHTMAP) {
+                cull_settings.lod_scale = projection[1][1] * 0.5f * static_cast<float>(render_height);
+            }
+            // only the potentially visible set of the current path segment while the camera follows the path
+            if (camera_animation_enabled && visibility_data) {
+                auto segment = visibility_data->segment(animation_time);
+                if (segment != last_visibility_segment) {
+                    visibility_data->decode(segment, potentially_visible);
+                    last_visibility_segment = segment;
+                }
+                cull_settings.potentially_visible = &potentially_visible;
+            }
+            // ranges occluded by their last finished query are drawn only under conditional rendering of the next one
+            auto occlusion_queries_enabled = occlusion_culling_enabled && !camera_animation_enabled;
+            if (occlusion_queries_enabled != last_occlusion_queries_enabled) {
+                occlusion_queries.invalidate();
+                last_occlusion_queries_enabled = occlusion_queries_enabled;
+            }
+            if (occlusion_queries_enabled) {
+                occlusion_queries.poll();
+                cull_settings.occluded = &occlusion_queries.occluded();
+            }
+            geometry.cull(projection * view_matrix, draw_list, cull_settings);
+            
+            // draws the scene with a surface shader whose uniforms are already set, after the depth pre-pass if enabled
+            auto render_surfaces = [&](const Shader &surface_shader) {
+                if (depth_prepass_enabled) {
+                    for (auto prepass_shader : {&depth_prepass_shader, &depth_prepass_alpha_shader}) {
+                        prepass_shader->use();
+                        prepass_shader->setMat4("projection", projection);
+                        prepass_shader->setMat4("view", view_matrix);
+                    }
+                    geometry.render_depth(depth_prepass_shader, depth_prepass_alpha_shader, draw_list);
+                    if (occlusion_queries_enabled) {
+                        occlusion_queries.query(box_shader, geometry, draw_list, projection * view_matrix);
+                        occlusion_queries.render_conditional(geometry, [&](const Geometry::DrawList &list) {
+                            geometry.render_depth(depth_prepass_shader, depth_prepass_alpha_shader, list);
+                        });
+                    }
+                    glDepthFunc(GL_EQUAL);
+                    glDepthMask(GL_FALSE);
+                }
+                surface_shader.use();
+                geometry.render(surface_shader, draw_list);
+                if (occlusion_queries_enabled) {
+                    if (!depth_prepass_enabled) {
+                        occlusion_queries.query(box_shader, geometry, draw_list, projection * view_matrix);
+                        surface_shader.use();
+                    }
+                    occlusion_queries.render_conditional(geometry, [&](const Geometry::DrawList &list) {
+                        geometry.render(surface_shader, list);
+                    });
+                }
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+            };
+            
+            if (shading_mode == ShadingMode::DEFERRED) {
+                gbuffer.resize(render_width, render_height);
+                gbuffer.with([&] {
+                    gbuffer_shader.use();
+                    gbuffer_shader.setMat4("projection", projection);
+                    gbuffer_shader.setMat4("view", view_matrix);
+                    gbuffer_shader.setVec3("cameraPos", camera_position);
+                    render_surfaces(gbuffer_shader);
+                });
+            }
+            
+            // shades the scene into the bound framebuffer, which is render_width x render_height
+            auto shade_scene = [&] {
+                auto viewport_size = glm::vec2{render_width, render_height};
+                if (shading_mode == ShadingMode::DEFERRED) {
+                    deferred_shader.use();
+                    light_buffer.bind(deferred_shader, 1);
+                    light_culler.bind(deferred_shader, 3, viewport_size);
+                    shadow_atlas.bind(deferred_shader, 8);
+                    deferred_shader.setMat4("view", view_matrix);
+                    deferred_shader.setMat4("inverseViewProjection", glm::inverse(projection * view_matrix));
+                    deferred_shader.setVec3("cameraPos", camera_position);
+                    gbuffer.resolve(deferred_shader, 5);
+                } else if (shading_mode == ShadingMode::LIGHTMAP) {
+                    lightmap_shader.use();
+                    light_buffer.bind(lightmap_shader, 1);
+                    light_culler.bind(lightmap_shader, 3, viewport_size);
+                    shadow_atlas.bind(lightmap_shader, 8);
+                    lightmap.bind(lightmap_shader, 10);
+                    lightmap_shader.setMat4("projection", projection);
+                    lightmap_shader.setMat4("view", view_matrix);
+                    lightmap_shader.setVec3("cameraPos", camera_position);
+                    render_surfaces(lightmap_shader);
+                } else {
+                    shader.use();
+                    light_buffer.bind(shader, 1);
+                    light_culler.bind(shader, 3, viewport_size);
+                    shadow_atlas.bind(shader, 8);
+                    shader.setMat4("projection", projection);
+                    shader.setMat4("view", view_matrix);
+                    shader.setVec3("cameraPos", camera_position);
+                    render_surfaces(shader);
+                }
+            };
+            
+            // 4x MSAA for the forward paths without TAA, the deferred one shades whole pixels anyway
+            auto msaa = !temporal_aa_enabled && shading_mode != ShadingMode::DEFERRED;
+            scene_target.resize(render_width, render_height, msaa ? 4u : 1u);
+            scene_target.with(shade_scene);
+            if (temporal_aa_enabled) {
+                // the deferred resolve does not write depth, the G-buffer has it
+                auto depth_texture = shading_mode == ShadingMode::DEFERRED ? gbuffer.depth_texture() : scene_target.depth_texture();
+                temporal_aa.resolve(taa_shader, scene_target.color_texture(), depth_texture, view_projection, 12);
+            }
+            
+            gpu_timer.end();
+            
+            auto present = [&] {
+                tonemap_shader.use();
+                tonemap_shader.setVec2("outputSize", glm::vec2{frame_width, frame_height});
+                tonemap_shader.setFloat("exposure", exposure);
+                tonemap_shader.setBool("linearOutput", offline);
+                if (temporal_aa_enabled) {
+                    temporal_aa.present(tonemap_shader, 11);
+                } else {
+                    scene_target.present(tonemap_shader, 11);
+                }
+            };
+            if (offline) {
+                // read back asynchronously, the EXR is written a few frames later on another thread
+                render_framebuffer->with(present);
+                char file_name[32];
+                std::snprintf(file_name, sizeof(file_name), "frame_%05u.exr", render_frame_index);
+                render_framebuffer->save((std::filesystem::path{render_folder} / file_name).string());
+                render_frame_index++;
+            } else {
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glViewport(0, 0, frame_width, frame_height);
+                present();
+            }
+            
+            // measurements arrive a few frames late, the scaler accounts for that
+            for (auto frame_time = gpu_timer.poll(); frame_time; frame_time = gpu_timer.poll()) {
+                if (dynamic_resolution_enabled && resolution_scaler.update(*frame_time)) {
+                    auto resolution = resolution_scaler.resolution(glm::uvec2{frame_width, frame_height});
+                    std::cout << "Render resolution: " << resolution.x << "x" << resolution.y
+                              << " (GPU time: " << resolution_scaler.average_frame_time() << " ms)" << std::endl;
+                }
+            }
+            
+            if (!offline) {
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+            }
+            
+            count++;
+        }
         
-        count++;
+        if (render_framebuffer) {
+            render_framebuffer->flush();
+        }
     }
-    
     glfwTerminate();
     return 0;
 }
@@ -197,6 +628,58 @@ void processInput(GLFWwindow *window) {
         get_camera().SetWeight(0.0);
     }
     
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
+        shading_mode = ShadingMode::FORWARD;
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+        shading_mode = ShadingMode::DEFERRED;
+    }
+    if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+        shading_mode = ShadingMode::LIGHTMAP;
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+        dynamic_resolution_enabled = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+        dynamic_resolution_enabled = false;
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS) {
+        exposure = std::max(exposure * std::exp2(-deltaTime), 1.0f / 64.0f);
+    }
+    if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS) {
+        exposure = std::min(exposure * std::exp2(deltaTime), 64.0f);
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
+        temporal_aa_enabled = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) {
+        temporal_aa_enabled = false;
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+        occlusion_culling_enabled = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+        occlusion_culling_enabled = false;
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
+        lod_enabled = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS) {
+        lod_enabled = false;
+    }
+    
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
+        depth_prepass_enabled = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
+        depth_prepass_enabled = false;
+    }
+    
     if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
         camera_animation_enabled = true;
         firstMouse = true;
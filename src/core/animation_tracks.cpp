@@ -0,0 +1,190 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "animation_tracks.h"
+
+AnimationTracks AnimationTracks::create(const SceneInfo &info) {
+
+    AnimationTracks tracks;
+
+    // ids in the order of the names, so they do not depend on the hashing
+    std::vector<std::string> names;
+    for (auto &&item : info.animations()) {
+        if (!item.second.empty()) { names.emplace_back(item.first); }
+    }
+    std::sort(names.begin(), names.end());
+
+    auto add = [&tracks](const Keyframe &keyframe) {
+        tracks._times.emplace_back(keyframe.time);
+        tracks._translation_x.emplace_back(keyframe.translation.x);
+        tracks._translation_y.emplace_back(keyframe.translation.y);
+        tracks._translation_z.emplace_back(keyframe.translation.z);
+        tracks._rotation_x.emplace_back(keyframe.rotation.x);
+        tracks._rotation_y.emplace_back(keyframe.rotation.y);
+        tracks._rotation_z.emplace_back(keyframe.rotation.z);
+        tracks._rotation_w.emplace_back(keyframe.rotation.w);
+        tracks._scale_x.emplace_back(keyframe.scale.x);
+        tracks._scale_y.emplace_back(keyframe.scale.y);
+        tracks._scale_z.emplace_back(keyframe.scale.z);
+    };
+    for (auto &&name : names) {
+        tracks._ids.emplace(name, static_cast<uint32_t>(tracks._first_keyframes.size()));
+        tracks._first_keyframes.emplace_back(static_cast<uint32_t>(tracks._times.size()));
+        std::vector<Keyframe> keyframes;
+        for (auto &&keyframe : info.animations().at(name)) {  // already sorted by SceneInfo::load()
+            if (!keyframes.empty() && keyframe.time <= keyframes.back().time) { continue; }
+            keyframes.emplace_back(decompose(keyframe.time, keyframe.transform));
+            // q and -q are the same rotation, the one closer to the last keyframe takes the short way
+            if (keyframes.size() > 1u && glm::dot(keyframes[keyframes.size() - 2u].rotation, keyframes.back().rotation) < 0.0f) {
+                keyframes.back().rotation = -keyframes.back().rotation;
+            }
+        }
+        // a single keyframe holds still over a pair of them
+        if (keyframes.size() == 1u) {
+            keyframes.emplace_back(keyframes.front());
+            keyframes.back().time += 1.0f;
+        }
+        for (auto &&keyframe : keyframes) { add(keyframe); }
+    }
+    tracks._first_keyframes.emplace_back(static_cast<uint32_t>(tracks._times.size()));
+    tracks._cursors.resize(tracks.size(), 0u);
+    return tracks;
+}
+
+std::optional<uint32_t> AnimationTracks::id(const std::string &name) const noexcept {
+    auto iter = _ids.find(name);
+    if (iter == _ids.end()) { return std::nullopt; }
+    return iter->second;
+}
+
+AnimationTracks::Keyframe AnimationTracks::decompose(float time, const glm::mat4 &transform) noexcept {
+    glm::mat3 basis{transform};
+    glm::vec3 scale{glm::length(basis[0]), glm::length(basis[1]), glm::length(basis[2])};
+    if (glm::determinant(basis) < 0.0f) { scale.x = -scale.x; }  // a mirror is a rotation with one axis negated
+    for (auto i = 0; i < 3; i++) {
+        if (scale[i] != 0.0f) { basis[i] /= scale[i]; }
+    }
+    return {time, glm::vec3{transform[3]}, glm::normalize(glm::quat_cast(basis)), scale};
+}
+
+uint32_t AnimationTracks::_keyframe_pair(uint32_t track, float time, float &t) noexcept {
+
+    auto first = _first_keyframes[track];
+    auto last = _first_keyframes[track + 1u] - 1u;
+    auto start_time = _times[first];
+    auto total_time = _times[last] - start_time;
+    auto delta_time = time - start_time;
+    if (delta_time > total_time && total_time > 0.0f) {
+        delta_time -= std::floor(delta_time / total_time) * total_time;
+    }
+    auto period_time = std::clamp(delta_time, 0.0f, total_time) + start_time;
+
+    // the pair of the last sample or the one after it, a binary search over the inner keyframes otherwise
+    auto before = first + _cursors[track];
+    if (period_time < _times[before] || period_time > _times[before + 1u]) {
+        if (before + 2u <= last && period_time >= _times[before + 1u] && period_time <= _times[before + 2u]) {
+            before++;
+        } else {
+            auto iter = std::upper_bound(_times.cbegin() + first + 1u, _times.cbegin() + last, period_time);
+            before = static_cast<uint32_t>(iter - _times.cbegin()) - 1u;
+        }
+    }
+    _cursors[track] = before - first;
+    t = (period_time - _times[before]) / (_times[before + 1u] - _times[before]);
+    return before;
+}
+
+void AnimationTracks::sample(float time, std::vector<glm::mat4> &transforms) {
+
+    using namespace simd;
+
+    auto count = size();
+    transforms.resize(count);
+    if (count == 0u) { return; }
+
+    constexpr auto block_size = 256ul;
+    ThreadPool::global().parallel_for((count + block_size - 1u) / block_size, [&](size_t block) {
+        auto end = std::min(count, (block + 1u) * block_size);
+        for (auto i = block * block_size; i < end; i += 4u) {
+
+            // the lanes past the last track repeat it and are not stored
+            uint32_t before[4];
+            alignas(16) float lane_t[4];
+            for (auto lane = 0u; lane < 4u; lane++) {
+                auto track = static_cast<uint32_t>(std::min(i + lane, end - 1u));
+                before[lane] = _keyframe_pair(track, time, lane_t[lane]);
+            }
+            auto gather = [&before](const std::vector<float> &v, uint32_t offset) {
+                return float4{v[before[0] + offset], v[before[1] + offset], v[before[2] + offset], v[before[3] + offset]};
+            };
+            auto lerp = [&gather](const std::vector<float> &v, float4 t) {
+                auto a = gather(v, 0u);
+                return a + (gather(v, 1u) - a) * t;
+            };
+            auto t = float4::load(lane_t);
+            auto tx = lerp(_translation_x, t);
+            auto ty = lerp(_translation_y, t);
+            auto tz = lerp(_translation_z, t);
+            auto sx = lerp(_scale_x, t);
+            auto sy = lerp(_scale_y, t);
+            auto sz = lerp(_scale_z, t);
+
+            // slerp, falling back to lerp where the rotations are almost the same; renormalized for the error of
+            // the approximate arc cosine
+            auto ax = gather(_rotation_x, 0u);
+            auto ay = gather(_rotation_y, 0u);
+            auto az = gather(_rotation_z, 0u);
+            auto aw = gather(_rotation_w, 0u);
+            auto bx = gather(_rotation_x, 1u);
+            auto by = gather(_rotation_y, 1u);
+            auto bz = gather(_rotation_z, 1u);
+            auto bw = gather(_rotation_w, 1u);
+            auto d = clamp(dot3(ax, ay, az, bx, by, bz) + aw * bw, float4{0.0f}, float4{1.0f});
+            auto theta = acos_unit(d);
+            auto sin_theta = sin(theta);
+            auto nearly_parallel = sin_theta < float4{1e-3f};
+            auto inverse_sin_theta = float4{1.0f} / max(sin_theta, float4{1e-3f});
+            auto wa = select(nearly_parallel, float4{1.0f} - t, sin((float4{1.0f} - t) * theta) * inverse_sin_theta);
+            auto wb = select(nearly_parallel, t, sin(t * theta) * inverse_sin_theta);
+            auto qx = ax * wa + bx * wb;
+            auto qy = ay * wa + by * wb;
+            auto qz = az * wa + bz * wb;
+            auto qw = aw * wa + bw * wb;
+            auto inverse_length = float4{1.0f} / sqrt(dot3(qx, qy, qz, qx, qy, qz) + qw * qw);
+            qx *= inverse_length;
+            qy *= inverse_length;
+            qz *= inverse_length;
+            qw *= inverse_length;
+
+            // the columns of the rotation matrix scaled per axis, then the translation
+            auto xx = qx * qx;
+            auto yy = qy * qy;
+            auto zz = qz * qz;
+            auto xy = qx * qy;
+            auto xz = qx * qz;
+            auto yz = qy * qz;
+            auto wx = qw * qx;
+            auto wy = qw * qy;
+            auto wz = qw * qz;
+            float4 columns[12]{
+                (1.0f - 2.0f * (yy + zz)) * sx, 2.0f * (xy + wz) * sx, 2.0f * (xz - wy) * sx,
+                2.0f * (xy - wz) * sy, (1.0f - 2.0f * (xx + zz)) * sy, 2.0f * (yz + wx) * sy,
+                2.0f * (xz + wy) * sz, 2.0f * (yz - wx) * sz, (1.0f - 2.0f * (xx + yy)) * sz,
+                tx, ty, tz};
+            alignas(16) float lanes[12][4];
+            for (auto c = 0u; c < 12u; c++) { columns[c].store(lanes[c]); }
+            for (auto lane = 0u; lane < 4u && i + lane < end; lane++) {
+                auto &&m = transforms[i + lane];
+                for (auto c = 0u; c < 4u; c++) {
+                    m[c] = glm::vec4{lanes[c * 3u][lane], lanes[c * 3u + 1u][lane], lanes[c * 3u + 2u][lane], c == 3u ? 1.0f : 0.0f};
+                }
+            }
+        }
+    });
+}
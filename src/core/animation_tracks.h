@@ -0,0 +1,69 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_ANIMATION_TRACKS_H
+#define LEARNOPENGL_ANIMATION_TRACKS_H
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "scene.h"
+
+// The animation tracks of the scene file compiled for playback. Keyframe matrices are decomposed into translation,
+// rotation and scale once and stored as structure-of-arrays, the tracks of all names back to back and addressed by
+// integer ids instead of their names. sample() evaluates every track at a time four at once with SIMD: the
+// translations and scales are interpolated linearly, the rotations spherically, and the results are composed back
+// into matrices. Each track loops over its own span like the camera path and keeps the keyframe pair of its last
+// sample, so time moving forward finds the next pair in O(1).
+class AnimationTracks {
+
+public:
+    struct Keyframe {
+        float time;
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+    };
+
+private:
+    std::unordered_map<std::string, uint32_t> _ids;
+    std::vector<uint32_t> _first_keyframes;  // per track, one more than the tracks
+    std::vector<uint32_t> _cursors;          // per track, the keyframe pair of the last sample relative to the first
+    std::vector<float> _times;               // per keyframe, sorted within each track
+    std::vector<float> _translation_x;
+    std::vector<float> _translation_y;
+    std::vector<float> _translation_z;
+    std::vector<float> _rotation_x;          // unit quaternions, each in the hemisphere of the one before it
+    std::vector<float> _rotation_y;
+    std::vector<float> _rotation_z;
+    std::vector<float> _rotation_w;
+    std::vector<float> _scale_x;
+    std::vector<float> _scale_y;
+    std::vector<float> _scale_z;
+
+    AnimationTracks() = default;
+    [[nodiscard]] uint32_t _keyframe_pair(uint32_t track, float time, float &t) noexcept;
+
+public:
+    static AnimationTracks create(const SceneInfo &info);
+
+    [[nodiscard]] bool empty() const noexcept { return size() == 0u; }
+    [[nodiscard]] size_t size() const noexcept { return _first_keyframes.empty() ? 0u : _first_keyframes.size() - 1u; }
+    [[nodiscard]] size_t keyframe_count() const noexcept { return _times.size(); }
+
+    // the id of the track with the given name in the scene file
+    [[nodiscard]] std::optional<uint32_t> id(const std::string &name) const noexcept;
+
+    [[nodiscard]] static Keyframe decompose(float time, const glm::mat4 &transform) noexcept;
+
+    // the transforms of every track at the given time, indexed by track id
+    void sample(float time, std::vector<glm::mat4> &transforms);
+
+};
+
+#endif //LEARNOPENGL_ANIMATION_TRACKS_H
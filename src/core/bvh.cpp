@@ -0,0 +1,169 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include "thread_pool.h"
+#include "bvh.h"
+
+namespace {
+
+constexpr auto max_depth = 48u;  // beyond this the builder falls back to median splits, keeps traversal stacks small
+
+struct Bounds {
+
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+    void expand(glm::vec3 p) noexcept {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void expand(const Bounds &b) noexcept {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+
+    [[nodiscard]] bool valid() const noexcept { return min.x <= max.x; }
+
+    [[nodiscard]] float area() const noexcept {
+        if (!valid()) { return 0.0f; }
+        auto e = max - min;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+struct Builder {
+
+    const std::vector<BVH::AABB> &bounds;
+    std::vector<glm::vec3> centers;
+    std::vector<uint32_t> &indices;
+    size_t max_leaf_size;
+
+    // appends the subtree over indices [begin, end) to nodes, child indices are relative to the start of nodes
+    void build(uint32_t begin, uint32_t end, uint32_t depth, std::vector<BVH::Node> &nodes) {
+
+        Bounds node_bounds;
+        Bounds center_bounds;
+        for (auto i = begin; i < end; i++) {
+            auto &&b = bounds[indices[i]];
+            node_bounds.expand(Bounds{b.min, b.max});
+            center_bounds.expand(centers[indices[i]]);
+        }
+
+        auto node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back(BVH::Node{node_bounds.min, begin, node_bounds.max, end - begin});
+
+        auto count = end - begin;
+        if (count <= max_leaf_size) { return; }
+
+        auto extent = center_bounds.max - center_bounds.min;
+        auto axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (extent[axis] <= 0.0f) { return; }  // all centers coincide, nothing to split
+
+        auto middle = begin;
+        if (depth < max_depth) {
+            // bin the centers along the widest axis and sweep for the cheapest split
+            std::array<Bounds, BVH::bin_count> bin_bounds{};
+            std::array<uint32_t, BVH::bin_count> bin_counts{};
+            auto bin_of = [&](uint32_t primitive) {
+                auto t = (centers[primitive][axis] - center_bounds.min[axis]) / extent[axis];
+                return std::min(static_cast<uint32_t>(t * BVH::bin_count), BVH::bin_count - 1u);
+            };
+            for (auto i = begin; i < end; i++) {
+                auto bin = bin_of(indices[i]);
+                auto &&b = bounds[indices[i]];
+                bin_bounds[bin].expand(Bounds{b.min, b.max});
+                bin_counts[bin]++;
+            }
+            std::array<float, BVH::bin_count - 1u> right_costs{};
+            Bounds right;
+            auto right_count = 0u;
+            for (auto i = BVH::bin_count - 1u; i > 0u; i--) {
+                right.expand(bin_bounds[i]);
+                right_count += bin_counts[i];
+                right_costs[i - 1u] = right.area() * static_cast<float>(right_count);
+            }
+            Bounds left;
+            auto left_count = 0u;
+            auto best_cost = std::numeric_limits<float>::max();
+            auto best_split = BVH::bin_count;
+            for (auto i = 0u; i < BVH::bin_count - 1u; i++) {
+                left.expand(bin_bounds[i]);
+                left_count += bin_counts[i];
+                auto cost = left.area() * static_cast<float>(left_count) + right_costs[i];
+                if (left_count != 0u && left_count != count && cost < best_cost) {
+                    best_cost = cost;
+                    best_split = i;
+                }
+            }
+            // compared to a leaf, with one traversal step costing about as much as a primitive test
+            auto leaf_cost = node_bounds.area() * static_cast<float>(count);
+            if (best_cost >= leaf_cost - node_bounds.area() && count <= 4u * max_leaf_size) {
+                return;
+            }
+            if (best_split != BVH::bin_count) {
+                middle = static_cast<uint32_t>(std::partition(
+                    indices.begin() + begin, indices.begin() + end,
+                    [&](uint32_t primitive) { return bin_of(primitive) <= best_split; }) - indices.begin());
+            }
+        }
+        if (middle == begin || middle == end) {  // too deep or no usable bin boundary, split at the median
+            middle = begin + count / 2u;
+            std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](uint32_t a, uint32_t b) {
+                return centers[a][axis] < centers[b][axis];
+            });
+        }
+
+        nodes[node_index].count = 0u;
+        if (count < BVH::parallel_build_threshold) {
+            build(begin, middle, depth + 1u, nodes);
+            nodes[node_index].offset = static_cast<uint32_t>(nodes.size());
+            build(middle, end, depth + 1u, nodes);
+            return;
+        }
+
+        // the halves partition disjoint ranges of indices, so they can be built concurrently into separate arrays
+        std::array<std::vector<BVH::Node>, 2> subtrees;
+        ThreadPool::global().parallel_for(2u, [&](size_t i) {
+            i == 0u ? build(begin, middle, depth + 1u, subtrees[0]) : build(middle, end, depth + 1u, subtrees[1]);
+        });
+        auto append = [&nodes](const std::vector<BVH::Node> &subtree) {
+            auto base = static_cast<uint32_t>(nodes.size());
+            for (auto node : subtree) {
+                if (!node.is_leaf()) { node.offset += base; }
+                nodes.emplace_back(node);
+            }
+        };
+        append(subtrees[0]);
+        nodes[node_index].offset = static_cast<uint32_t>(nodes.size());
+        append(subtrees[1]);
+    }
+};
+
+}
+
+BVH BVH::build(const std::vector<AABB> &bounds, size_t max_leaf_size) {
+
+    BVH bvh;
+    if (bounds.empty()) { return bvh; }
+
+    std::vector<glm::vec3> centers;
+    centers.reserve(bounds.size());
+    for (auto &&b : bounds) {
+        centers.emplace_back((b.min + b.max) * 0.5f);
+    }
+    bvh._primitive_indices.resize(bounds.size());
+    for (auto i = 0u; i < bounds.size(); i++) {
+        bvh._primitive_indices[i] = i;
+    }
+    bvh._nodes.reserve(bounds.size() * 2u / std::max<size_t>(max_leaf_size, 1u) + 1u);
+
+    Builder builder{bounds, std::move(centers), bvh._primitive_indices, std::max<size_t>(max_leaf_size, 1u)};
+    builder.build(0u, static_cast<uint32_t>(bounds.size()), 0u, bvh._nodes);
+    return bvh;
+}
@@ -0,0 +1,106 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#ifndef LEARNOPENGL_BVH_H
+#define LEARNOPENGL_BVH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "frustum.h"
+
+// Bounding volume hierarchy over arbitrary primitives given by their bounding boxes, built top-down with the
+// binned surface area heuristic. Nodes are stored depth-first in a flat array: the left child of an interior node
+// directly follows it and the right child is at offset; leaves reference a contiguous range of the
+// reordered primitive indices. Large subtrees are built in parallel on the global thread pool. Besides the point
+// and culling queries below, traversal is left to the users (ray tracing, occlusion culling, ...).
+class BVH {
+
+public:
+    using AABB = impl::AABB;
+
+    struct Node {
+        glm::vec3 min;
+        uint32_t offset;  // interior: index of the right child, leaf: first primitive in primitive_indices()
+        glm::vec3 max;
+        uint32_t count;   // zero for interior nodes
+        [[nodiscard]] bool is_leaf() const noexcept { return count != 0u; }
+    };
+
+    static constexpr auto bin_count = 16u;
+    static constexpr auto parallel_build_threshold = 4096u;  // primitives below which subtrees are built serially
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _primitive_indices;
+
+public:
+    BVH() = default;  // empty
+    static BVH build(const std::vector<AABB> &bounds, size_t max_leaf_size = 4u);
+
+    [[nodiscard]] bool empty() const noexcept { return _nodes.empty(); }
+    [[nodiscard]] const std::vector<Node> &nodes() const noexcept { return _nodes; }
+    [[nodiscard]] const std::vector<uint32_t> &primitive_indices() const noexcept { return _primitive_indices; }
+
+    // calls visit(primitive) for every primitive whose leaf bounds contain the point
+    template<typename Visit>
+    void query(glm::vec3 p, Visit &&visit) const {
+        if (_nodes.empty()) { return; }
+        uint32_t stack[64];
+        auto stack_size = 0u;
+        stack[stack_size++] = 0u;
+        while (stack_size != 0u) {
+            auto index = stack[--stack_size];
+            auto &&node = _nodes[index];
+            if (p.x < node.min.x || p.y < node.min.y || p.z < node.min.z ||
+                p.x > node.max.x || p.y > node.max.y || p.z > node.max.z) {
+                continue;
+            }
+            if (node.is_leaf()) {
+                for (auto i = node.offset; i < node.offset + node.count; i++) {
+                    visit(_primitive_indices[i]);
+                }
+            } else {
+                stack[stack_size++] = node.offset;
+                stack[stack_size++] = index + 1u;
+            }
+        }
+    }
+
+    // calls visit(primitive) for every primitive in leaves that classify(min, max) -> Containment does not reject;
+    // the subtrees of nodes classified as INSIDE are not tested any further
+    template<typename Classify, typename Visit>
+    void cull(Classify &&classify, Visit &&visit) const {
+        if (_nodes.empty()) { return; }
+        struct Entry {
+            uint32_t node;
+            bool inside;
+        };
+        Entry stack[64];
+        auto stack_size = 0u;
+        stack[stack_size++] = {0u, false};
+        while (stack_size != 0u) {
+            auto entry = stack[--stack_size];
+            auto &&node = _nodes[entry.node];
+            auto inside = entry.inside;
+            if (!inside) {
+                auto containment = classify(node.min, node.max);
+                if (containment == Containment::OUTSIDE) { continue; }
+                inside = containment == Containment::INSIDE;
+            }
+            if (node.is_leaf()) {
+                for (auto i = node.offset; i < node.offset + node.count; i++) {
+                    visit(_primitive_indices[i]);
+                }
+            } else {
+                stack[stack_size++] = {node.offset, inside};
+                stack[stack_size++] = {entry.node + 1u, inside};
+            }
+        }
+    }
+
+};
+
+#endif //LEARNOPENGL_BVH_H
@@ -3,37 +3,213 @@
 //
 
 #include <algorithm>
+#include <iostream>
 #include <glm/gtc/matrix_transform.hpp>
+#include "simd.h"
+#include "thread_pool.h"
 #include "camera_animator.h"
-#include "util.h"
 
-CameraAnimator::State CameraAnimator::state(float time) const noexcept {
-    
-    auto start_time = _states.front().time;
-    auto end_time = _states.back().time;
+namespace {
+
+constexpr auto coefficient_stride = CameraAnimator::channel_count * 4u;  // per segment
+
+struct Key {
+    float time;
+    float channels[CameraAnimator::channel_count];
+};
+
+Key make_key(const CameraAnimator::State &state, glm::vec3 fallback_direction) {
+    auto direction = state.lookat - state.eye;
+    auto distance = glm::length(direction);
+    direction = distance > 0.0f ? direction / distance : fallback_direction;
+    auto up = glm::normalize(state.up);
+    return {state.time, {state.eye.x, state.eye.y, state.eye.z, direction.x, direction.y, direction.z, distance, up.x, up.y, up.z}};
+}
+
+bool same_pose(const Key &a, const Key &b) {
+    for (auto c = 0u; c < CameraAnimator::channel_count; c++) {
+        if (std::abs(a.channels[c] - b.channels[c]) > 1e-4f * std::max(1.0f, std::abs(a.channels[c]))) { return false; }
+    }
+    return true;
+}
+
+}
+
+float CameraAnimator::_wrap(float time) const noexcept {
+
+    auto start_time = _times.front();
+    auto end_time = _times.back();
     auto total_time = end_time - start_time;
     auto delta_time = time - start_time;
-    
-    if (delta_time > total_time) {
-        auto count = static_cast<int>(delta_time / total_time);
-        delta_time = std::max(std::min(delta_time - count * total_time, end_time), start_time);
-    }
-    
-    auto period_time = delta_time + start_time;
-    auto iter = std::lower_bound(_states.cbegin(), _states.cend(), period_time, [](const State &state, float time) {
-        return state.time < time;
+
+    if (delta_time > total_time && total_time > 0.0f) {
+        delta_time -= std::floor(delta_time / total_time) * total_time;
+    }
+    return std::min(std::max(start_time + delta_time, start_time), end_time);
+}
+
+size_t CameraAnimator::_segment(float period_time, size_t hint) const noexcept {
+
+    // the segment of the last lookup or the one after it
+    auto count = segment_count();
+    if (hint < count && period_time >= _times[hint]) {
+        if (period_time <= _times[hint + 1u]) { return hint; }
+        if (hint + 1u < count && period_time <= _times[hint + 2u]) { return hint + 1u; }
+    }
+
+    // the number of inner keyframes at or before the time
+    auto iter = std::upper_bound(_times.cbegin() + 1, _times.cend() - 1, period_time);
+    return static_cast<size_t>(iter - (_times.cbegin() + 1));
+}
+
+CameraAnimator::State CameraAnimator::_evaluate(size_t segment, float period_time, float time) const noexcept {
+
+    auto u = (period_time - _times[segment]) * _inverse_durations[segment];
+    auto coefficients = &_coefficients[segment * coefficient_stride];
+    float channels[channel_count];
+    for (auto c = 0u; c < channel_count; c++) {
+        auto k = coefficients + c * 4u;
+        channels[c] = ((k[0] * u + k[1]) * u + k[2]) * u + k[3];
+    }
+
+    glm::vec3 eye{channels[0], channels[1], channels[2]};
+    auto direction = glm::normalize(glm::vec3{channels[3], channels[4], channels[5]});
+    auto up = glm::normalize(glm::vec3{channels[7], channels[8], channels[9]});
+    return {time, eye, eye + direction * channels[6], up};
+}
+
+CameraAnimator::State CameraAnimator::state(float time) const noexcept {
+    auto period_time = _wrap(time);
+    return _evaluate(_segment(period_time, segment_count()), period_time, time);
+}
+
+CameraAnimator::State CameraAnimator::state(float time, Cursor &cursor) const noexcept {
+    auto period_time = _wrap(time);
+    cursor.segment = _segment(period_time, cursor.segment);
+    return _evaluate(cursor.segment, period_time, time);
+}
+
+void CameraAnimator::sample(const float *times, size_t count, Samples &samples) const {
+
+    using namespace simd;
+
+    // padded to whole blocks of four lanes while evaluating
+    auto padded_count = (count + 3u) & ~size_t{3u};
+    for (auto v : {&samples.eye_x, &samples.eye_y, &samples.eye_z, &samples.lookat_x, &samples.lookat_y, &samples.lookat_z,
+                   &samples.up_x, &samples.up_y, &samples.up_z}) {
+        v->resize(padded_count);
+    }
+    samples.time.assign(times, times + count);
+    if (count == 0u) { return; }
+
+    constexpr auto block_size = 1024ul;
+    ThreadPool::global().parallel_for((padded_count + block_size - 1u) / block_size, [&](size_t block) {
+        Cursor cursor{segment_count()};
+        auto end = std::min(padded_count, (block + 1u) * block_size);
+        for (auto i = block * block_size; i < end; i += 4u) {
+
+            // the lanes look up their segments one by one, the cursor makes that O(1) along sorted times
+            size_t segments[4];
+            alignas(16) float u[4];
+            for (auto lane = 0u; lane < 4u; lane++) {
+                auto period_time = _wrap(times[std::min(i + lane, count - 1u)]);
+                cursor.segment = _segment(period_time, cursor.segment);
+                segments[lane] = cursor.segment * coefficient_stride;
+                u[lane] = (period_time - _times[cursor.segment]) * _inverse_durations[cursor.segment];
+            }
+            auto t = float4::load(u);
+            float4 channels[channel_count];
+            for (auto c = 0u; c < channel_count; c++) {
+                auto coefficient = [&](uint32_t k) {
+                    auto offset = c * 4u + k;
+                    return float4{_coefficients[segments[0] + offset], _coefficients[segments[1] + offset],
+                                  _coefficients[segments[2] + offset], _coefficients[segments[3] + offset]};
+                };
+                channels[c] = ((coefficient(0u) * t + coefficient(1u)) * t + coefficient(2u)) * t + coefficient(3u);
+            }
+
+            auto direction_scale = channels[6] / sqrt(max(dot3(channels[3], channels[4], channels[5], channels[3], channels[4], channels[5]), float4{1e-24f}));
+            auto up_scale = float4{1.0f} / sqrt(max(dot3(channels[7], channels[8], channels[9], channels[7], channels[8], channels[9]), float4{1e-24f}));
+            channels[0].store(&samples.eye_x[i]);
+            channels[1].store(&samples.eye_y[i]);
+            channels[2].store(&samples.eye_z[i]);
+            (channels[0] + channels[3] * direction_scale).store(&samples.lookat_x[i]);
+            (channels[1] + channels[4] * direction_scale).store(&samples.lookat_y[i]);
+            (channels[2] + channels[5] * direction_scale).store(&samples.lookat_z[i]);
+            (channels[7] * up_scale).store(&samples.up_x[i]);
+            (channels[8] * up_scale).store(&samples.up_y[i]);
+            (channels[9] * up_scale).store(&samples.up_z[i]);
+        }
     });
-    auto &&after = *iter;
-    auto &&before = iter == _states.cbegin() ? after : *(iter - 1);
-    
-    auto t = static_cast<float>((period_time - before.time) / (after.time - before.time));
-    auto eye = util::lerp(before.eye, after.eye, t);
-    auto lookat = eye + util::slerp(before.lookat - before.eye, after.lookat - after.eye, t);
-    auto up = glm::normalize(util::slerp(before.up, after.up, t));
-    
-    return {time, eye, lookat, up};
+
+    for (auto v : {&samples.eye_x, &samples.eye_y, &samples.eye_z, &samples.lookat_x, &samples.lookat_y, &samples.lookat_z,
+                   &samples.up_x, &samples.up_y, &samples.up_z}) {
+        v->resize(count);
+    }
+}
+
+void CameraAnimator::sample(float start, float end, size_t count, Samples &samples) const {
+    std::vector<float> times(count);
+    for (auto i = 0ul; i < count; i++) {
+        auto t = count > 1u ? static_cast<float>(i) / static_cast<float>(count - 1u) : 0.0f;
+        times[i] = start + (end - start) * t;
+    }
+    sample(times.data(), count, samples);
 }
 
 CameraAnimator CameraAnimator::create(const SceneInfo &info) {
-    return CameraAnimator(info.cameras());
+
+    CameraAnimator animator;
+
+    // keyframes at the same time as the one before are dropped, the directions of degenerate look-at points carry over
+    std::vector<Key> keys;
+    auto direction = glm::vec3{0.0f, 0.0f, -1.0f};
+    for (auto &&camera : info.cameras()) {
+        if (!keys.empty() && camera.time <= keys.back().time) { continue; }
+        keys.emplace_back(make_key(camera, direction));
+        direction = {keys.back().channels[3], keys.back().channels[4], keys.back().channels[5]};
+    }
+    if (keys.empty()) { return animator; }
+
+    // a single keyframe holds still over one segment
+    if (keys.size() == 1u) {
+        keys.emplace_back(keys.front());
+        keys.back().time += 1.0f;
+    }
+
+    // Catmull-Rom tangents for non-uniform times: the mean of the slopes on either side, one-sided at the ends of
+    // open paths and across the seam of closed ones
+    auto key_count = keys.size();
+    auto closed = key_count > 2u && same_pose(keys.front(), keys.back());
+    auto slope = [&keys](size_t i, uint32_t c) {
+        return (keys[i + 1u].channels[c] - keys[i].channels[c]) / (keys[i + 1u].time - keys[i].time);
+    };
+    std::vector<float> tangents(key_count * channel_count);
+    for (auto c = 0u; c < channel_count; c++) {
+        for (auto i = 1u; i + 1u < key_count; i++) {
+            tangents[i * channel_count + c] = 0.5f * (slope(i - 1u, c) + slope(i, c));
+        }
+        auto first = closed ? 0.5f * (slope(0u, c) + slope(key_count - 2u, c)) : slope(0u, c);
+        auto last = closed ? first : slope(key_count - 2u, c);
+        tangents[c] = first;
+        tangents[(key_count - 1u) * channel_count + c] = last;
+    }
+
+    // Hermite segments as cubics in the normalized segment time u
+    for (auto i = 0u; i + 1u < key_count; i++) {
+        auto duration = keys[i + 1u].time - keys[i].time;
+        animator._times.emplace_back(keys[i].time);
+        animator._inverse_durations.emplace_back(1.0f / duration);
+        for (auto c = 0u; c < channel_count; c++) {
+            auto p0 = keys[i].channels[c];
+            auto p1 = keys[i + 1u].channels[c];
+            auto m0 = tangents[i * channel_count + c] * duration;
+            auto m1 = tangents[(i + 1u) * channel_count + c] * duration;
+            animator._coefficients.insert(animator._coefficients.end(), {2.0f * (p0 - p1) + m0 + m1, 3.0f * (p1 - p0) - 2.0f * m0 - m1, m0, p0});
+        }
+    }
+    animator._times.emplace_back(keys.back().time);
+
+    std::cout << "Created camera animator with " << animator.segment_count() << (closed ? " closed" : " open") << " spline segments" << std::endl;
+    return animator;
 }
@@ -9,19 +9,67 @@
 #include "common.h"
 #include "scene.h"
 
+// Camera paths through the keyframes of the scene as cubic Hermite splines with Catmull-Rom tangents scaled to
+// the keyframe times, so sparse keyframes give smooth flights. The eye, the unit view direction with its distance
+// to the look-at point, and the up vector are splined channel by channel; each segment stores the cubic
+// coefficients of every channel, so evaluation is a segment lookup and a few multiply-adds. Paths whose last
+// keyframe repeats the first one are closed and loop without a kink. Time wraps around the span of the keyframes.
 class CameraAnimator {
 
 public:
     using State = impl::CameraInfo;
 
+    static constexpr auto channel_count = 10u;  // eye (3), direction (3), distance, up (3)
+
+    // the segment of the last lookup; time moving forward usually stays in it or steps into the next one, which
+    // makes state() O(1) instead of a binary search over the keyframes
+    struct Cursor {
+        size_t segment{0u};
+    };
+
+    // states at many times at once, as structure-of-arrays
+    struct Samples {
+        std::vector<float> eye_x;
+        std::vector<float> eye_y;
+        std::vector<float> eye_z;
+        std::vector<float> lookat_x;
+        std::vector<float> lookat_y;
+        std::vector<float> lookat_z;
+        std::vector<float> up_x;
+        std::vector<float> up_y;
+        std::vector<float> up_z;
+        std::vector<float> time;
+
+        [[nodiscard]] size_t size() const noexcept { return time.size(); }
+        [[nodiscard]] glm::vec3 eye(size_t i) const noexcept { return {eye_x[i], eye_y[i], eye_z[i]}; }
+        [[nodiscard]] State operator[](size_t i) const noexcept {
+            return {time[i], eye(i), {lookat_x[i], lookat_y[i], lookat_z[i]}, {up_x[i], up_y[i], up_z[i]}};
+        }
+    };
+
 private:
-    std::vector<State> _states;
-    explicit CameraAnimator(std::vector<State> states) : _states{std::move(states)} {}
+    std::vector<float> _times;              // of the keyframes, strictly increasing
+    std::vector<float> _inverse_durations;  // per segment
+    std::vector<float> _coefficients;       // per segment and channel, the cubic from the highest power down
+
+    CameraAnimator() = default;
+    [[nodiscard]] float _wrap(float time) const noexcept;
+    [[nodiscard]] size_t _segment(float period_time, size_t hint) const noexcept;
+    [[nodiscard]] State _evaluate(size_t segment, float period_time, float time) const noexcept;
 
 public:
     static CameraAnimator create(const SceneInfo &info);
-    bool empty() const noexcept { return _states.empty(); }
-    State state(float time) const noexcept;
+    [[nodiscard]] bool empty() const noexcept { return _times.empty(); }
+    [[nodiscard]] size_t segment_count() const noexcept { return _inverse_durations.size(); }
+
+    [[nodiscard]] State state(float time) const noexcept;
+    [[nodiscard]] State state(float time, Cursor &cursor) const noexcept;
+
+    // evaluates count times four at a time with SIMD; sorted times share a cursor, so a whole path costs O(count)
+    void sample(const float *times, size_t count, Samples &samples) const;
+
+    // count evenly spaced times from start to end, both included
+    void sample(float start, float end, size_t count, Samples &samples) const;
 
 };
 
@@ -0,0 +1,51 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_COLOR_FORMAT_H
+#define LEARNOPENGL_COLOR_FORMAT_H
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <glad/glad.h>
+
+// Color formats of offscreen targets. The HDR scene is usually kept in R11G11B10F (4 bytes per pixel, no alpha)
+// or RGBA16F (8 bytes); RGBA32F is for reference output only, RGB32F is not required to be color-renderable.
+enum struct ColorFormat : uint32_t {
+    SRGB8_ALPHA8,
+    R11G11B10F,
+    RGBA16F,
+    RGBA32F
+};
+
+struct ColorFormatInfo {
+    GLenum internal_format;
+    GLenum pixel_format;  // client-side format and type for allocating and reading back the storage
+    GLenum pixel_type;
+    uint32_t pixel_size;  // bytes per pixel in video memory
+    bool hdr;
+    const char *name;
+};
+
+[[nodiscard]] constexpr ColorFormatInfo color_format_info(ColorFormat format) noexcept {
+    switch (format) {
+        case ColorFormat::R11G11B10F:
+            return {GL_R11F_G11F_B10F, GL_RGB, GL_HALF_FLOAT, 4u, true, "r11g11b10f"};
+        case ColorFormat::RGBA16F:
+            return {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8u, true, "rgba16f"};
+        case ColorFormat::RGBA32F:
+            return {GL_RGBA32F, GL_RGBA, GL_FLOAT, 16u, true, "rgba32f"};
+        default:
+            return {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4u, false, "srgb8_alpha8"};
+    }
+}
+
+[[nodiscard]] inline std::optional<ColorFormat> parse_color_format(std::string_view name) noexcept {
+    for (auto format : {ColorFormat::SRGB8_ALPHA8, ColorFormat::R11G11B10F, ColorFormat::RGBA16F, ColorFormat::RGBA32F}) {
+        if (name == color_format_info(format).name) { return format; }
+    }
+    return std::nullopt;
+}
+
+#endif //LEARNOPENGL_COLOR_FORMAT_H
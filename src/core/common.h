@@ -51,6 +51,11 @@ struct MeshInfo {
     std::string animation_name{};
 };
 
+struct AABB {
+    glm::vec3 min{1.e6f};
+    glm::vec3 max{-1.e6f};
+};
+
 }
 
 #endif //LEARNOPENGL_COMMON_H
@@ -0,0 +1,176 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <zlib.h>
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "exr_writer.h"
+
+namespace {
+
+constexpr uint32_t exr_magic = 20000630u;
+constexpr uint32_t exr_version = 2u;  // single-part scanline
+constexpr int32_t exr_pixel_type_half = 1;
+constexpr int32_t exr_pixel_type_float = 2;
+constexpr auto zip_level = 4;  // the default of OpenEXR, most of the ratio at a fraction of the time
+
+template<typename T>
+void put(std::vector<uint8_t> &out, T value) {
+    auto bytes = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void put_string(std::vector<uint8_t> &out, const char *s) {
+    out.insert(out.end(), s, s + std::strlen(s) + 1u);
+}
+
+void put_attribute(std::vector<uint8_t> &out, const char *name, const char *type, uint32_t size) {
+    put_string(out, name);
+    put_string(out, type);
+    put(out, size);
+}
+
+// converts a row of full floats to half floats, four at a time
+void narrow(const float *src, uint16_t *dst, uint32_t count) {
+    auto x = 0u;
+    for (; x + 4u <= count; x += 4u) {
+        simd::store_half(simd::float4::load(src + x), dst + x);
+    }
+    for (; x < count; x++) {
+        dst[x] = simd::to_half(src[x]);
+    }
+}
+
+}
+
+bool ExrWriter::write(const std::string &path, const Image &image) {
+
+    if (image.width == 0u || image.height == 0u) {
+        std::cerr << "Failed to save EXR: " << path << " (empty image)" << std::endl;
+        return false;
+    }
+
+    auto half = image.half || _settings.half;
+    auto pixel_size = half ? sizeof(uint16_t) : sizeof(float);
+    auto input_pixel_size = image.half ? sizeof(uint16_t) : sizeof(float);
+    auto channel_size = image.width * pixel_size;
+    auto line_size = channel_size * 3u;
+    auto lines_per_block = _settings.compression == Compression::ZIP ? 16u : 1u;
+    auto block_count = (image.height + lines_per_block - 1u) / lines_per_block;
+    _blocks.resize(block_count);
+    _predicted.resize(block_count);
+    _packed.resize(block_count);
+
+    // the channels in alphabetical order, as OpenEXR requires
+    const uint8_t *planes[3]{static_cast<const uint8_t *>(image.blue), static_cast<const uint8_t *>(image.green), static_cast<const uint8_t *>(image.red)};
+    ThreadPool::global().parallel_for(block_count, [&](size_t block) {
+
+        auto first_line = block * lines_per_block;
+        auto line_count = std::min(lines_per_block, static_cast<uint32_t>(image.height - first_line));
+        auto &&raw = _blocks[block];
+        raw.resize(line_count * line_size);
+        for (auto line = 0u; line < line_count; line++) {
+            auto row = image.height - 1u - (first_line + line);  // OpenGL stores the rows bottom-up
+            for (auto c = 0u; c < 3u; c++) {
+                auto src = planes[c] + row * image.width * input_pixel_size;
+                auto dst = raw.data() + line * line_size + c * channel_size;
+                if (half && !image.half) {
+                    narrow(reinterpret_cast<const float *>(src), reinterpret_cast<uint16_t *>(dst), image.width);
+                } else {
+                    std::memcpy(dst, src, channel_size);
+                }
+            }
+        }
+
+        auto &&packed = _packed[block];
+        packed.clear();
+        if (_settings.compression != Compression::ZIP) { return; }
+
+        // the even bytes before the odd ones, then each byte as the difference to the one before it
+        auto &&predicted = _predicted[block];
+        predicted.resize(raw.size());
+        auto half_size = (raw.size() + 1u) / 2u;
+        for (auto i = 0ul; i < raw.size(); i++) {
+            predicted[(i & 1u) ? half_size + i / 2u : i / 2u] = raw[i];
+        }
+        for (auto i = predicted.size() - 1u; i > 0u; i--) {
+            predicted[i] = static_cast<uint8_t>(predicted[i] - predicted[i - 1u] + 128u);
+        }
+
+        auto packed_size = compressBound(static_cast<uLong>(predicted.size()));
+        packed.resize(packed_size);
+        if (compress2(packed.data(), &packed_size, predicted.data(), static_cast<uLong>(predicted.size()), zip_level) != Z_OK ||
+            packed_size >= raw.size()) {
+            packed.clear();
+        } else {
+            packed.resize(packed_size);
+        }
+    });
+
+    std::vector<uint8_t> header;
+    put(header, exr_magic);
+    put(header, exr_version);
+    put_attribute(header, "channels", "chlist", 3u * (2u + 16u) + 1u);
+    for (auto name : {"B", "G", "R"}) {
+        put_string(header, name);
+        put(header, half ? exr_pixel_type_half : exr_pixel_type_float);
+        put(header, uint32_t{0u});  // pLinear and reserved
+        put(header, int32_t{1});    // x and y sampling
+        put(header, int32_t{1});
+    }
+    header.emplace_back(0u);
+    put_attribute(header, "compression", "compression", 1u);
+    header.emplace_back(static_cast<uint8_t>(_settings.compression));
+    for (auto window : {"dataWindow", "displayWindow"}) {
+        put_attribute(header, window, "box2i", 16u);
+        put(header, int32_t{0});
+        put(header, int32_t{0});
+        put(header, static_cast<int32_t>(image.width) - 1);
+        put(header, static_cast<int32_t>(image.height) - 1);
+    }
+    put_attribute(header, "lineOrder", "lineOrder", 1u);
+    header.emplace_back(0u);  // increasing y
+    put_attribute(header, "pixelAspectRatio", "float", 4u);
+    put(header, 1.0f);
+    put_attribute(header, "screenWindowCenter", "v2f", 8u);
+    put(header, 0.0f);
+    put(header, 0.0f);
+    put_attribute(header, "screenWindowWidth", "float", 4u);
+    put(header, 1.0f);
+    header.emplace_back(0u);
+
+    // the offset table points at the chunks, each the first line of the block, its size and its data
+    std::vector<uint64_t> offsets(block_count);
+    auto offset = static_cast<uint64_t>(header.size() + block_count * sizeof(uint64_t));
+    for (auto block = 0u; block < block_count; block++) {
+        offsets[block] = offset;
+        auto size = _packed[block].empty() ? _blocks[block].size() : _packed[block].size();
+        offset += sizeof(int32_t) * 2u + size;
+    }
+
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        std::cerr << "Failed to save EXR: " << path << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+    file.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    for (auto block = 0u; block < block_count; block++) {
+        auto &&data = _packed[block].empty() ? _blocks[block] : _packed[block];
+        auto y = static_cast<int32_t>(block * lines_per_block);
+        auto size = static_cast<int32_t>(data.size());
+        file.write(reinterpret_cast<const char *>(&y), sizeof(y));
+        file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    }
+    if (!file) {
+        std::cerr << "Failed to save EXR: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
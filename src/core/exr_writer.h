@@ -0,0 +1,56 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_EXR_WRITER_H
+#define LEARNOPENGL_EXR_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scanline OpenEXR output of RGB images read back from OpenGL, one plane per channel with the rows bottom-up. The
+// rows are flipped while the scanline blocks are assembled, full floats are optionally narrowed to half floats with
+// SIMD on the way, and the blocks are ZIP-compressed in parallel on the thread pool; only the final write to the
+// file is serial. Keeps its scratch buffers between images, so one writer per thread saves a whole sequence without
+// allocating.
+class ExrWriter {
+
+public:
+    enum struct Compression : uint8_t {
+        NONE = 0,
+        ZIP = 3  // zlib over 16 scanlines, with the bytes split into halves and delta-coded
+    };
+
+    struct Settings {
+        Compression compression{Compression::ZIP};
+        bool half{true};  // writes full-float planes as half floats
+    };
+
+    struct Image {
+        uint32_t width{0};
+        uint32_t height{0};
+        bool half{false};  // the planes hold half floats, full floats otherwise
+        const void *red{nullptr};
+        const void *green{nullptr};
+        const void *blue{nullptr};
+    };
+
+private:
+    Settings _settings;
+    std::vector<std::vector<uint8_t>> _blocks;     // per scanline block, the channels of each line one after another
+    std::vector<std::vector<uint8_t>> _predicted;  // the bytes split into halves and delta-coded
+    std::vector<std::vector<uint8_t>> _packed;     // zlib-compressed, empty where that did not pay off
+
+public:
+    explicit ExrWriter(const Settings &settings) noexcept : _settings{settings} {}
+    ExrWriter() noexcept : ExrWriter{Settings{}} {}
+
+    [[nodiscard]] const Settings &settings() const noexcept { return _settings; }
+
+    // returns false and reports why if the file could not be written
+    bool write(const std::string &path, const Image &image);
+
+};
+
+#endif //LEARNOPENGL_EXR_WRITER_H
@@ -1,24 +1,92 @@
 #include <cstdint>
+#include <cstring>
+#include <string>
 #include <vector>
 #include <thread>
+#include <iostream>
+#include <stdexcept>
 #include <glad/glad.h>
 
+#include "color_format.h"
+#include "exr_writer.h"
+
+// HDR color target whose content is saved as OpenEXR. The 16-bit float formats are read back and written as half
+// floats, RGBA32F is read back as full floats and narrowed to half floats by the ExrWriter if its settings ask for
+// it, which keeps the blending of the frame in full precision. save() only starts the readback: the
+// channels go as separate planes into the next pixel pack buffer of a ring, so the GPU does the deinterleaving, and
+// are mapped behind a fence once the GPU is done with them, at a later save() or flush(), so capturing adds almost
+// no stall to the frame. Each slot of the ring then writes its EXR on a thread of its own.
 class Framebuffer {
 
+public:
+    static constexpr auto readback_slot_count = 3u;
+
 private:
+    struct ReadbackSlot {
+        uint32_t buffer{0};
+        GLsync fence{nullptr};  // of the readback in flight, nullptr if none
+        std::string path;
+        std::vector<uint8_t> image_buffer;  // the red, green and blue planes
+        ExrWriter exr_writer;
+        std::thread writer;
+    };
+    
     uint32_t _width{0};
     uint32_t _height{0};
     uint32_t _fbo{0};
     uint32_t _tex{0};
-    mutable std::vector<float> _image_buffer;
-    mutable std::vector<float> _red_buffer;
-    mutable std::vector<float> _blue_buffer;
-    mutable std::vector<float> _green_buffer;
-    mutable std::thread _thread;
+    ColorFormat _format;
+    ReadbackSlot _slots[readback_slot_count];
+    uint32_t _next_slot{0};
+    
+    [[nodiscard]] bool _half() const noexcept { return color_format_info(_format).pixel_type == GL_HALF_FLOAT; }
+    [[nodiscard]] size_t _plane_size() const noexcept { return _width * _height * (_half() ? sizeof(uint16_t) : sizeof(float)); }
+    [[nodiscard]] size_t _image_size() const noexcept { return _plane_size() * 3; }
+    
+    void _write(ReadbackSlot &slot) const {
+        auto planes = slot.image_buffer.data();
+        auto plane_size = _plane_size();
+        slot.exr_writer.write(slot.path, {_width, _height, _half(), planes, planes + plane_size, planes + plane_size * 2});
+    }
+    
+    // maps the finished readback of the slot and hands it to its writer thread; waits for the GPU unless poll is set,
+    // in which case an unfinished readback is left in flight and false returned
+    bool _complete(ReadbackSlot &slot, bool poll) {
+        
+        if (slot.fence == nullptr) {
+            return true;
+        }
+        auto status = glClientWaitSync(slot.fence, poll ? 0u : GL_SYNC_FLUSH_COMMANDS_BIT, poll ? 0u : GL_TIMEOUT_IGNORED);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        
+        if (slot.writer.joinable()) {
+            slot.writer.join();
+        }
+        auto size = _image_size();
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        if (auto pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT)) {
+            std::memcpy(slot.image_buffer.data(), pixels, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            slot.writer = std::thread{[this, &slot] { _write(slot); }};
+        } else {
+            std::cerr << "Failed to map the readback of " << slot.path << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return true;
+    }
 
 public:
-    Framebuffer(uint32_t width, uint32_t height)
-        : _width{width}, _height{height} {
+    Framebuffer(uint32_t width, uint32_t height, ColorFormat format = ColorFormat::RGBA16F, const ExrWriter::Settings &exr_settings = ExrWriter::Settings{})
+        : _width{width}, _height{height}, _format{format} {
+        
+        auto format_info = color_format_info(format);
+        if (!format_info.hdr) {
+            throw std::runtime_error{"Framebuffer requires an HDR color format"};
+        }
         
         auto fbo = 0u;
         glGenFramebuffers(1, &fbo);
@@ -27,7 +95,7 @@ public:
         auto tex = 0u;
         glGenTextures(1, &tex);
         glBindTexture(GL_TEXTURE_2D, tex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, _width, _height, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_2D, 0, format_info.internal_format, _width, _height, 0, format_info.pixel_format, format_info.pixel_type, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
@@ -43,21 +111,34 @@ public:
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         
-        _image_buffer.resize(_width * _height * 3);
-        _red_buffer.resize(_width * _height);
-        _green_buffer.resize(_width * _height);
-        _blue_buffer.resize(_width * _height);
+        for (auto &&slot : _slots) {
+            glGenBuffers(1, &slot.buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, _image_size(), nullptr, GL_STREAM_READ);
+            slot.image_buffer.resize(_image_size());
+            slot.exr_writer = ExrWriter{exr_settings};
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
         
         _fbo = fbo;
         _tex = tex;
     }
     
+    // waits for the writers only, readbacks still in flight need flush() while the context is current
     ~Framebuffer() noexcept {
-        if (_thread.joinable()) {
-            _thread.join();
+        for (auto &&slot : _slots) {
+            if (slot.writer.joinable()) {
+                slot.writer.join();
+            }
         }
     }
     
+    // the writer threads refer to the framebuffer and its slots
+    Framebuffer(const Framebuffer &) = delete;
+    Framebuffer(Framebuffer &&) = delete;
+    Framebuffer &operator=(const Framebuffer &) = delete;
+    Framebuffer &operator=(Framebuffer &&) = delete;
+    
     template<typename F>
     void with(F &&render) {
         glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
@@ -69,57 +150,46 @@ public:
     }
     
     uint32_t texture() const noexcept { return _tex; }
+    ColorFormat format() const noexcept { return _format; }
     
+    // starts reading the content back into the next slot of the ring, to be written to path as OpenEXR
     void save(const std::string &path) {
         
-        if (_thread.joinable()) {
-            _thread.join();
+        // readbacks that finished in the meantime are passed on, the slot to reuse is waited for
+        for (auto i = 1u; i < readback_slot_count; i++) {
+            if (!_complete(_slots[(_next_slot + i) % readback_slot_count], true)) { break; }
         }
+        auto &&slot = _slots[_next_slot];
+        _complete(slot, false);
+        _next_slot = (_next_slot + 1u) % readback_slot_count;
         
-        glBindTexture(GL_TEXTURE_2D, _tex);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, _image_buffer.data());
+        // an earlier poll may have handed the slot to its writer already, which still reads its path and planes
+        if (slot.writer.joinable()) {
+            slot.writer.join();
+        }
         
-        _thread = std::thread{[this, path] {
-            
-            for (auto y = 0; y < _height; y++) {
-                for (auto x = 0; x < _width; x++) {
-                    _red_buffer[(_height - 1 - y) * _width + x] = _image_buffer[(y * _width + x) * 3 + 0];
-                    _green_buffer[(_height - 1 - y) * _width + x] = _image_buffer[(y * _width + x) * 3 + 1];
-                    _blue_buffer[(_height - 1 - y) * _width + x] = _image_buffer[(y * _width + x) * 3 + 2];
-                }
-            }
-            
-            EXRHeader header;
-            InitEXRHeader(&header);
-            
-            EXRImage image;
-            InitEXRImage(&image);
-            
-            float *image_ptrs[]{_blue_buffer.data(), _green_buffer.data(), _red_buffer.data()};
-            image.images = reinterpret_cast<uint8_t **>(image_ptrs);
-            image.width = _width;
-            image.height = _height;
-            
-            EXRChannelInfo channel_infos[3];
-            header.num_channels = 3;
-            header.channels = channel_infos;
-            header.channels[0].name[0] = 'B';
-            header.channels[0].name[1] = '\0';
-            header.channels[1].name[0] = 'G';
-            header.channels[1].name[1] = '\0';
-            header.channels[2].name[0] = 'R';
-            header.channels[2].name[1] = '\0';
-            
-            int32_t pixel_types[3]{TINYEXR_PIXELTYPE_FLOAT, TINYEXR_PIXELTYPE_FLOAT, TINYEXR_PIXELTYPE_FLOAT};
-            header.pixel_types = pixel_types;
-            header.requested_pixel_types = pixel_types;
-            
-            const char *err = nullptr;
-            if (SaveEXRImageToFile(&image, &header, path.c_str(), &err) != TINYEXR_SUCCESS) {
-                std::cerr << "Failed to save EXR: " << err << std::endl;
-                FreeEXRErrorMessage(err);
-            }
-        }};
+        // half-float rows are 2 bytes per pixel and not necessarily 4-byte aligned
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        auto pixel_type = _half() ? GL_HALF_FLOAT : GL_FLOAT;
+        auto plane_size = _plane_size();
+        glReadPixels(0, 0, _width, _height, GL_RED, pixel_type, nullptr);
+        glReadPixels(0, 0, _width, _height, GL_GREEN, pixel_type, reinterpret_cast<void *>(plane_size));
+        glReadPixels(0, 0, _width, _height, GL_BLUE, pixel_type, reinterpret_cast<void *>(plane_size * 2));
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.path = path;
+    }
+    
+    // writes every readback still in flight, oldest first
+    void flush() {
+        for (auto i = 0u; i < readback_slot_count; i++) {
+            _complete(_slots[(_next_slot + i) % readback_slot_count], false);
+        }
     }
     
 };
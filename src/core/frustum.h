@@ -0,0 +1,51 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_FRUSTUM_H
+#define LEARNOPENGL_FRUSTUM_H
+
+#include <array>
+#include <glm/glm.hpp>
+
+enum struct Containment {
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+};
+
+// View frustum as six inward-facing planes (a, b, c, d) with ax + by + cz + d >= 0 inside, extracted from a
+// view-projection matrix so that it matches whatever the matrix is used to render (Gribb and Hartmann).
+class Frustum {
+
+private:
+    std::array<glm::vec4, 6> _planes{};
+
+public:
+    explicit Frustum(const glm::mat4 &view_projection) noexcept {
+        auto row = [&m = view_projection](int i) { return glm::vec4{m[0][i], m[1][i], m[2][i], m[3][i]}; };
+        auto x = row(0);
+        auto y = row(1);
+        auto z = row(2);
+        auto w = row(3);
+        _planes = {w + x, w - x, w + y, w - y, w + z, w - z};
+    }
+
+    [[nodiscard]] const std::array<glm::vec4, 6> &planes() const noexcept { return _planes; }
+
+    // conservative: boxes near the frustum corners may be reported as intersecting although they are outside
+    [[nodiscard]] Containment classify(glm::vec3 min, glm::vec3 max) const noexcept {
+        auto result = Containment::INSIDE;
+        for (auto &&plane : _planes) {
+            // the corners farthest along and against the plane normal
+            auto positive = glm::vec3{plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z};
+            auto negative = glm::vec3{plane.x >= 0.0f ? min.x : max.x, plane.y >= 0.0f ? min.y : max.y, plane.z >= 0.0f ? min.z : max.z};
+            if (glm::dot(glm::vec3{plane}, positive) + plane.w < 0.0f) { return Containment::OUTSIDE; }
+            if (glm::dot(glm::vec3{plane}, negative) + plane.w < 0.0f) { result = Containment::INTERSECTING; }
+        }
+        return result;
+    }
+
+};
+
+#endif //LEARNOPENGL_FRUSTUM_H
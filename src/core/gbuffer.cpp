@@ -0,0 +1,93 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#include <stdexcept>
+#include <utility>
+
+#include "serialize.h"
+#include "gbuffer.h"
+
+GBuffer GBuffer::create(uint32_t width, uint32_t height) {
+    
+    GBuffer gbuffer;
+    glGenFramebuffers(1, &gbuffer._framebuffer);
+    glGenVertexArrays(1, &gbuffer._vertex_array);
+    
+    glGenTextures(3, gbuffer._textures.data());
+    gbuffer._allocate(width, height);
+    
+    return gbuffer;
+}
+
+GBuffer::~GBuffer() {
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteVertexArrays(1, &_vertex_array);
+    glDeleteTextures(3, _textures.data());
+}
+
+void GBuffer::_swap(GBuffer &other) noexcept {
+    std::swap(_width, other._width);
+    std::swap(_height, other._height);
+    std::swap(_framebuffer, other._framebuffer);
+    std::swap(_textures, other._textures);
+    std::swap(_vertex_array, other._vertex_array);
+}
+
+void GBuffer::_allocate(uint32_t width, uint32_t height) {
+    
+    _width = width;
+    _height = height;
+    
+    auto allocate_texture = [width, height](uint32_t texture, GLenum internal_format, GLenum format, GLenum type) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+    };
+    allocate_texture(_textures[0], GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    allocate_texture(_textures[1], GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+    allocate_texture(_textures[2], GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _textures[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _textures[1], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _textures[2], 0);
+    uint32_t draw_buffers[]{GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error{serialize("G-buffer framebuffer not complete, status: ", status)};
+    }
+}
+
+void GBuffer::resize(uint32_t width, uint32_t height) {
+    if (width != _width || height != _height) {
+        _allocate(width, height);
+    }
+}
+
+void GBuffer::resolve(const Shader &shader, uint32_t first_texture_unit) const {
+    
+    const char *names[]{"gBufferAlbedo", "gBufferNormal", "gBufferDepth"};
+    for (auto i = 0u; i < 3u; i++) {
+        glActiveTexture(GL_TEXTURE0 + first_texture_unit + i);
+        glBindTexture(GL_TEXTURE_2D, _textures[i]);
+        shader.setInt(names[i], first_texture_unit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    
+    // every pixel is shaded exactly once, so neither depth testing nor writing is needed
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(_vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,62 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#ifndef LEARNOPENGL_GBUFFER_H
+#define LEARNOPENGL_GBUFFER_H
+
+#include <array>
+#include <cstdint>
+#include <glad/glad.h>
+
+#include "shader.h"
+
+// Compact G-buffer for the deferred path, 12 bytes per pixel: sRGB albedo with the specular weight in alpha,
+// an octahedral normal with the shading roughness in RGB10_A2, and a 32-bit float depth from which the
+// lighting pass reconstructs positions. The lighting pass is a fullscreen triangle over the cluster lists
+// of LightCuller, resolved into whatever framebuffer is bound when resolve() is called.
+class GBuffer {
+
+private:
+    uint32_t _width{0};
+    uint32_t _height{0};
+    uint32_t _framebuffer{0};
+    std::array<uint32_t, 3> _textures{};  // albedo, normal and depth
+    uint32_t _vertex_array{0};  // empty, core profiles need one bound to draw the fullscreen triangle
+    
+    GBuffer() = default;
+    void _allocate(uint32_t width, uint32_t height);
+    void _swap(GBuffer &other) noexcept;
+
+public:
+    static GBuffer create(uint32_t width, uint32_t height);
+    
+    ~GBuffer();
+    GBuffer(GBuffer &&other) noexcept { _swap(other); }  // leaves other empty
+    GBuffer(const GBuffer &) = delete;
+    GBuffer &operator=(GBuffer &&other) noexcept { _swap(other); return *this; }  // other deletes what was here
+    GBuffer &operator=(const GBuffer &) = delete;
+    
+    [[nodiscard]] uint32_t width() const noexcept { return _width; }
+    [[nodiscard]] uint32_t height() const noexcept { return _height; }
+    [[nodiscard]] uint32_t depth_texture() const noexcept { return _textures[2]; }
+    
+    // reallocates the attachments if the size changed
+    void resize(uint32_t width, uint32_t height);
+    
+    template<typename F>
+    void with(F &&render) {
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+        glViewport(0, 0, _width, _height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(static_cast<uint32_t>(GL_COLOR_BUFFER_BIT) | static_cast<uint32_t>(GL_DEPTH_BUFFER_BIT));
+        render();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    
+    // binds the attachments to three texture units starting at first_texture_unit and runs the lighting shader
+    void resolve(const Shader &shader, uint32_t first_texture_unit) const;
+    
+};
+
+#endif //LEARNOPENGL_GBUFFER_H
@@ -0,0 +1,49 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <glad/glad.h>
+
+#include "gpu_timer.h"
+
+GpuTimer GpuTimer::create() {
+    GpuTimer timer;
+    glGenQueries(query_count, timer._queries.data());
+    return timer;
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(query_count, _queries.data());
+}
+
+void GpuTimer::begin() {
+    _running = _pending < query_count;
+    if (_running) {
+        glBeginQuery(GL_TIME_ELAPSED, _queries[_next]);
+    }
+}
+
+void GpuTimer::end() {
+    if (_running) {
+        glEndQuery(GL_TIME_ELAPSED);
+        _next = (_next + 1u) % query_count;
+        _pending++;
+        _running = false;
+    }
+}
+
+std::optional<float> GpuTimer::poll() {
+    if (_pending == 0u) {
+        return std::nullopt;
+    }
+    auto query = _queries[(_next + query_count - _pending) % query_count];
+    auto available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == 0) {
+        return std::nullopt;
+    }
+    uint64_t elapsed = 0u;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    _pending--;
+    return static_cast<float>(static_cast<double>(elapsed) * 1e-6);
+}
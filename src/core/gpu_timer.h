@@ -0,0 +1,45 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_GPU_TIMER_H
+#define LEARNOPENGL_GPU_TIMER_H
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+// GPU time spent between begin() and end(), measured with GL_TIME_ELAPSED queries. The queries form a ring so that
+// results are read back a few frames later without ever stalling the pipeline; if every query is still in flight,
+// the frame is simply not measured.
+class GpuTimer {
+
+public:
+    static constexpr auto query_count = 4u;
+
+private:
+    std::array<uint32_t, query_count> _queries{};
+    uint32_t _next{0};     // query the next begin() uses
+    uint32_t _pending{0};  // ended but not yet read back
+    bool _running{false};
+    
+    GpuTimer() = default;
+
+public:
+    static GpuTimer create();
+    
+    ~GpuTimer();
+    GpuTimer(GpuTimer &&) = default;
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(GpuTimer &&) = default;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+    
+    void begin();
+    void end();
+    
+    // the oldest finished measurement in milliseconds, if any
+    [[nodiscard]] std::optional<float> poll();
+    
+};
+
+#endif //LEARNOPENGL_GPU_TIMER_H
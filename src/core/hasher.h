@@ -0,0 +1,47 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_HASHER_H
+#define LEARNOPENGL_HASHER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// FNV-1a, stable across runs and platforms as long as the hashed values are
+class Hasher {
+
+private:
+    uint64_t _state{14695981039346656037ull};
+
+public:
+    void bytes(const void *data, size_t size) noexcept {
+        auto p = static_cast<const uint8_t *>(data);
+        for (auto i = 0ul; i < size; i++) {
+            _state = (_state ^ p[i]) * 1099511628211ull;
+        }
+    }
+
+    template<typename T>
+    void value(const T &v) noexcept { bytes(&v, sizeof(T)); }
+
+    void string(const std::string &s) noexcept {
+        value(s.size());
+        bytes(s.data(), s.size());
+    }
+
+    // size and modification time stand in for the contents of large files
+    void file_stamp(const std::string &path) {
+        string(path);
+        std::error_code error;
+        auto size = std::filesystem::file_size(path, error);
+        value(error ? uint64_t{0} : static_cast<uint64_t>(size));
+        auto time = std::filesystem::last_write_time(path, error);
+        value(error ? int64_t{0} : static_cast<int64_t>(time.time_since_epoch().count()));
+    }
+
+    [[nodiscard]] uint64_t digest() const noexcept { return _state; }
+};
+
+#endif //LEARNOPENGL_HASHER_H
@@ -0,0 +1,98 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#include <limits>
+#include <iostream>
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "light_animator.h"
+
+namespace {
+
+constexpr auto padding_index = std::numeric_limits<uint32_t>::max();
+
+}
+
+LightAnimator LightAnimator::create(const SceneInfo &info) {
+
+    LightAnimator animator;
+    auto &&lights = info.lights();
+    auto add = [&animator](uint32_t index, glm::vec3 offset, glm::vec3 axis, glm::vec3 origin, float angular_velocity, float radius) {
+        animator._indices.emplace_back(index);
+        animator._offset_x.emplace_back(offset.x);
+        animator._offset_y.emplace_back(offset.y);
+        animator._offset_z.emplace_back(offset.z);
+        animator._axis_x.emplace_back(axis.x);
+        animator._axis_y.emplace_back(axis.y);
+        animator._axis_z.emplace_back(axis.z);
+        animator._origin_x.emplace_back(origin.x);
+        animator._origin_y.emplace_back(origin.y);
+        animator._origin_z.emplace_back(origin.z);
+        animator._angular_velocity.emplace_back(angular_velocity);
+        animator._radius.emplace_back(radius);
+    };
+    for (auto i = 0u; i < lights.size(); i++) {
+        auto &&light = lights[i];
+        if (light.angular_v != 0.0f && glm::dot(light.axis_direction, light.axis_direction) != 0.0f) {
+            add(i, light.position - light.axis_position, glm::normalize(light.axis_direction), light.axis_position, light.angular_v, light.radius);
+        }
+    }
+    animator._light_count = animator._indices.size();
+    while (animator._indices.size() % 4u != 0u) {
+        add(padding_index, glm::vec3{0.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec3{0.0f}, 0.0f, 0.0f);
+    }
+
+    if (!animator.empty()) {
+        std::cout << "Created light animator for " << animator.size() << " lights" << std::endl;
+    }
+    return animator;
+}
+
+void LightAnimator::update(LightBuffer &lights, float time) {
+
+    using namespace simd;
+
+    if (empty() || (_evaluated && time == _time)) {
+        return;
+    }
+    _time = time;
+    _evaluated = true;
+
+    auto positions = lights.position_data();
+    constexpr auto block_size = 256ul;
+    ThreadPool::global().parallel_for((_indices.size() + block_size - 1u) / block_size, [&](size_t block) {
+        auto end = std::min(_indices.size(), (block + 1u) * block_size);
+        float4 t{time};
+        for (auto i = block * block_size; i < end; i += 4u) {
+
+            // Rodrigues' rotation of the offset v about the unit axis k:
+            // v' = v cos(theta) + (k x v) sin(theta) + k (k . v) (1 - cos(theta))
+            auto theta = float4::load(&_angular_velocity[i]) * t;
+            auto s = sin(theta);
+            auto c = cos(theta);
+            auto vx = float4::load(&_offset_x[i]);
+            auto vy = float4::load(&_offset_y[i]);
+            auto vz = float4::load(&_offset_z[i]);
+            auto kx = float4::load(&_axis_x[i]);
+            auto ky = float4::load(&_axis_y[i]);
+            auto kz = float4::load(&_axis_z[i]);
+            auto k_dot_v = dot3(kx, ky, kz, vx, vy, vz) * (1.0f - c);
+            auto x = float4::load(&_origin_x[i]) + vx * c + (ky * vz - kz * vy) * s + kx * k_dot_v;
+            auto y = float4::load(&_origin_y[i]) + vy * c + (kz * vx - kx * vz) * s + ky * k_dot_v;
+            auto z = float4::load(&_origin_z[i]) + vz * c + (kx * vy - ky * vx) * s + kz * k_dot_v;
+
+            // back to one (x, y, z, radius) row per light, stored straight into the upload buffer
+            auto w = float4::load(&_radius[i]);
+            transpose(x, y, z, w);
+            float4 rows[]{x, y, z, w};
+            for (auto lane = 0u; lane < 4u; lane++) {
+                if (auto index = _indices[i + lane]; index != padding_index) {
+                    rows[lane].store(&positions[index].x);
+                    lights.mark_changed(index);
+                }
+            }
+        }
+    });
+}
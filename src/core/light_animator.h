@@ -0,0 +1,48 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#ifndef LEARNOPENGL_LIGHT_ANIMATOR_H
+#define LEARNOPENGL_LIGHT_ANIMATOR_H
+
+#include <vector>
+
+#include "scene.h"
+#include "light_buffer.h"
+
+// Rotating lights (LightInfo::axis_direction, axis_position and angular_v). Only the animated lights are kept, as
+// structure-of-arrays padded to a multiple of four, and update() evaluates all of them with a batched SIMD kernel
+// on the thread pool, writing the positions straight into the LightBuffer and flagging exactly those lights.
+class LightAnimator {
+
+private:
+    std::vector<uint32_t> _indices;  // light index in the LightBuffer, padding lanes hold an invalid index
+    std::vector<float> _offset_x;    // rest position relative to the axis position
+    std::vector<float> _offset_y;
+    std::vector<float> _offset_z;
+    std::vector<float> _axis_x;      // normalized axis direction
+    std::vector<float> _axis_y;
+    std::vector<float> _axis_z;
+    std::vector<float> _origin_x;    // axis position
+    std::vector<float> _origin_y;
+    std::vector<float> _origin_z;
+    std::vector<float> _angular_velocity;
+    std::vector<float> _radius;
+    size_t _light_count{0};
+    float _time{0.0f};
+    bool _evaluated{false};
+
+    LightAnimator() = default;
+
+public:
+    static LightAnimator create(const SceneInfo &info);
+
+    [[nodiscard]] bool empty() const noexcept { return _light_count == 0; }
+    [[nodiscard]] size_t size() const noexcept { return _light_count; }
+
+    // rotates every animated light to its position at the given time, does nothing if the time did not change
+    void update(LightBuffer &lights, float time);
+
+};
+
+#endif //LEARNOPENGL_LIGHT_ANIMATOR_H
@@ -0,0 +1,120 @@
+//
+// Created by Mike Smith on 2019/10/14.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "util.h"
+#include "light_buffer.h"
+
+LightBuffer LightBuffer::create(const SceneInfo &info, float influence_cutoff) {
+
+    LightBuffer buffer;
+    buffer._influence_cutoff = influence_cutoff;
+    buffer._positions.reserve(info.lights().size());
+    buffer._emissions.reserve(info.lights().size());
+    for (auto &&light : info.lights()) {
+        buffer._positions.emplace_back(light.position, light.radius);
+        buffer._emissions.emplace_back(light.emission, buffer._influence_range(light.emission));
+    }
+    buffer._changed.resize(buffer.count(), 1u);
+
+    glGenTextures(2, buffer._textures.data());
+    buffer.upload();
+
+    std::cout << "Created light buffer for " << buffer.count() << " lights" << std::endl;
+    return buffer;
+}
+
+LightBuffer::~LightBuffer() {
+    glDeleteTextures(2, _textures.data());
+}
+
+void LightBuffer::_swap(LightBuffer &other) noexcept {
+    std::swap(_positions, other._positions);
+    std::swap(_emissions, other._emissions);
+    std::swap(_changed, other._changed);
+    std::swap(_changed_lights, other._changed_lights);
+    std::swap(_influence_cutoff, other._influence_cutoff);
+    std::swap(_capacity, other._capacity);
+    std::swap(_textures, other._textures);
+}
+
+void LightBuffer::_reallocate(size_t capacity) {
+    _capacity = std::max<size_t>(util::next_power_of_two(capacity), texture_width);
+    auto rows = static_cast<int32_t>(_capacity / texture_width);
+    for (auto texture : _textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, texture_width, rows, 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+float LightBuffer::_influence_range(glm::vec3 emission) const noexcept {
+    // irradiance falls off as I / d^2, so it drops below the cutoff at d = sqrt(I / cutoff)
+    auto intensity = std::max(std::max(emission.r, emission.g), emission.b);
+    return intensity <= 0.0f ? 0.0f : std::sqrt(intensity / _influence_cutoff);
+}
+
+void LightBuffer::set_position(size_t index, glm::vec3 position) noexcept {
+    _positions[index] = glm::vec4{position, _positions[index].w};
+    _changed[index] = 1u;
+}
+
+void LightBuffer::set_emission(size_t index, glm::vec3 emission) noexcept {
+    _emissions[index] = glm::vec4{emission, _influence_range(emission)};
+    _changed[index] = 1u;
+}
+
+void LightBuffer::upload() {
+
+    _changed_lights.clear();
+    for (auto i = 0u; i < _changed.size(); i++) {
+        if (_changed[i] != 0u) {
+            _changed_lights.emplace_back(i);
+            _changed[i] = 0u;
+        }
+    }
+    if (_changed_lights.empty()) {
+        return;
+    }
+    if (count() > _capacity || _capacity == 0) {
+        _reallocate(count());
+    }
+
+    // only the rows spanned by the changed lights, full rows first, then the partially filled last row
+    auto first_row = static_cast<int32_t>(_changed_lights.front() / texture_width);
+    auto last_row = static_cast<int32_t>((_changed_lights.back() + 1u) / texture_width);
+    auto remainder = static_cast<int32_t>((_changed_lights.back() + 1u) % texture_width);
+    auto upload_attribute = [&](uint32_t texture, const std::vector<glm::vec4> &data) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (last_row > first_row) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, texture_width, last_row - first_row, GL_RGBA, GL_FLOAT, data.data() + first_row * texture_width);
+        }
+        if (remainder != 0) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, last_row, remainder, 1, GL_RGBA, GL_FLOAT, data.data() + last_row * texture_width);
+        }
+    };
+    upload_attribute(_textures[0], _positions);
+    upload_attribute(_textures[1], _emissions);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void LightBuffer::bind(const Shader &shader, uint32_t first_texture_unit) const {
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _textures[0]);
+    shader.setInt("lightPositions", first_texture_unit);
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit + 1);
+    glBindTexture(GL_TEXTURE_2D, _textures[1]);
+    shader.setInt("lightEmissions", first_texture_unit + 1);
+    shader.setInt("lightCount", static_cast<int>(count()));
+    glActiveTexture(GL_TEXTURE0);
+}
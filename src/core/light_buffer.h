@@ -0,0 +1,70 @@
+//
+// Created by Mike Smith on 2019/10/14.
+//
+
+#ifndef LEARNOPENGL_LIGHT_BUFFER_H
+#define LEARNOPENGL_LIGHT_BUFFER_H
+
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// GPU light list with a runtime count. Every light attribute lives in its own RGBA32F texture (structure of
+// arrays), wrapped into rows of texture_width texels and read with texelFetch, so neither the number of lights
+// nor the uniform limits of the driver are baked into the shaders. A texture is used instead of a buffer object
+// because the programs are compiled through the GLSL ES 3.0 front-end of the optimizer. Each light also carries
+// a finite influence range derived from its emission, used to window the falloff and to cull the light. Writes
+// flag the lights they touch; upload() only sends the rows spanning the flagged lights and publishes them through
+// changed_lights() so that the caches built on top (light clusters, shadow maps) can be invalidated precisely.
+class LightBuffer {
+
+public:
+    static constexpr auto texture_width = 1024u;
+
+private:
+    std::vector<glm::vec4> _positions;  // xyz: position, w: radius
+    std::vector<glm::vec4> _emissions;  // rgb: emission, w: influence range
+    std::vector<uint8_t> _changed;      // per-light flags, set by the writers and collected by upload()
+    std::vector<uint32_t> _changed_lights;
+    float _influence_cutoff{0.0f};
+    size_t _capacity{0};
+    std::array<uint32_t, 2> _textures{};  // positions and emissions
+
+    LightBuffer() = default;
+    void _reallocate(size_t capacity);
+    void _swap(LightBuffer &other) noexcept;
+    [[nodiscard]] float _influence_range(glm::vec3 emission) const noexcept;
+
+public:
+    // lights are treated as having no influence where their unshadowed irradiance drops below influence_cutoff
+    static LightBuffer create(const SceneInfo &info, float influence_cutoff = 0.05f);
+
+    ~LightBuffer();
+    LightBuffer(LightBuffer &&other) noexcept { _swap(other); }  // leaves other empty
+    LightBuffer(const LightBuffer &) = delete;
+    LightBuffer &operator=(LightBuffer &&other) noexcept { _swap(other); return *this; }  // other deletes what was here
+    LightBuffer &operator=(const LightBuffer &) = delete;
+
+    [[nodiscard]] size_t count() const noexcept { return _positions.size(); }
+    [[nodiscard]] const std::vector<glm::vec4> &positions() const noexcept { return _positions; }
+    [[nodiscard]] const std::vector<glm::vec4> &emissions() const noexcept { return _emissions; }
+
+    // lights written before the last upload(), valid until the next one
+    [[nodiscard]] const std::vector<uint32_t> &changed_lights() const noexcept { return _changed_lights; }
+
+    void set_position(size_t index, glm::vec3 position) noexcept;
+    void set_emission(size_t index, glm::vec3 emission) noexcept;
+
+    // Direct access for batched writers such as LightAnimator, which must keep w (the radius) and flag every light
+    // they write with mark_changed(). Writers on different threads may flag distinct lights concurrently.
+    [[nodiscard]] glm::vec4 *position_data() noexcept { return _positions.data(); }
+    void mark_changed(size_t index) noexcept { _changed[index] = 1u; }
+
+    void upload();
+    void bind(const Shader &shader, uint32_t first_texture_unit) const;
+
+};
+
+#endif //LEARNOPENGL_LIGHT_BUFFER_H
@@ -0,0 +1,259 @@
+//
+// Created by Mike Smith on 2019/10/15.
+//
+
+#include <cmath>
+#include <limits>
+
+#include <glad/glad.h>
+
+#include "simd.h"
+#include "util.h"
+#include "thread_pool.h"
+#include "light_culler.h"
+
+namespace {
+
+// padding lights are placed far away with zero range so that they never overlap anything
+constexpr auto padding_position = 1e30f;
+
+}
+
+LightCuller LightCuller::create() {
+
+    LightCuller culler;
+    culler._slices.resize(grid_z);
+    culler._ranges.resize(cluster_count);
+
+    uint32_t textures[2];
+    glGenTextures(2, textures);
+    culler._range_texture = textures[0];
+    culler._index_texture = textures[1];
+
+    glBindTexture(GL_TEXTURE_2D, culler._range_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, grid_x * grid_y, grid_z, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return culler;
+}
+
+LightCuller::~LightCuller() {
+    glDeleteTextures(2, &_range_texture);
+}
+
+void LightCuller::_rebuild_grid(float fov_y, float aspect, float near, float far) {
+
+    _fov_y = fov_y;
+    _aspect = aspect;
+    _near = near;
+    _far = far;
+
+    // slice k spans [near * (far / near)^(k / Z), near * (far / near)^((k + 1) / Z)]
+    auto log_ratio = std::log(far / near);
+    _depth_scale = static_cast<float>(grid_z) / log_ratio;
+    _depth_bias = static_cast<float>(grid_z) * std::log(near) / log_ratio;
+    _slice_depths.resize(grid_z + 1);
+    for (auto k = 0u; k <= grid_z; k++) {
+        _slice_depths[k] = near * std::pow(far / near, static_cast<float>(k) / grid_z);
+    }
+
+    auto tan_half_fov = std::tan(0.5f * fov_y);
+    _cluster_min.resize(cluster_count);
+    _cluster_max.resize(cluster_count);
+    for (auto z = 0u; z < grid_z; z++) {
+        for (auto y = 0u; y < grid_y; y++) {
+            for (auto x = 0u; x < grid_x; x++) {
+                glm::vec3 bounds_min{std::numeric_limits<float>::max()};
+                glm::vec3 bounds_max{std::numeric_limits<float>::lowest()};
+                for (auto corner = 0u; corner < 8u; corner++) {
+                    auto depth = _slice_depths[z + (corner & 1u)];
+                    auto ndc_x = -1.0f + 2.0f * static_cast<float>(x + ((corner >> 1u) & 1u)) / grid_x;
+                    auto ndc_y = -1.0f + 2.0f * static_cast<float>(y + ((corner >> 2u) & 1u)) / grid_y;
+                    glm::vec3 p{ndc_x * depth * tan_half_fov * aspect, ndc_y * depth * tan_half_fov, -depth};
+                    bounds_min = glm::min(bounds_min, p);
+                    bounds_max = glm::max(bounds_max, p);
+                }
+                auto index = x + y * grid_x + z * grid_x * grid_y;
+                _cluster_min[index] = bounds_min;
+                _cluster_max[index] = bounds_max;
+            }
+        }
+    }
+}
+
+void LightCuller::_transform_lights(const LightBuffer &lights, const glm::mat4 &view) {
+
+    using namespace simd;
+
+    auto count = lights.count();
+    auto padded_count = (count + 3u) & ~3ul;
+    _view_x.resize(padded_count);
+    _view_y.resize(padded_count);
+    _view_z.resize(padded_count);
+    _view_range.resize(padded_count);
+
+    float4 m00{view[0][0]}, m01{view[1][0]}, m02{view[2][0]}, m03{view[3][0]};
+    float4 m10{view[0][1]}, m11{view[1][1]}, m12{view[2][1]}, m13{view[3][1]};
+    float4 m20{view[0][2]}, m21{view[1][2]}, m22{view[2][2]}, m23{view[3][2]};
+
+    auto &&positions = lights.positions();
+    auto &&emissions = lights.emissions();
+    auto load = [count](const std::vector<glm::vec4> &v, size_t i) {
+        return i < count ? float4::load(&v[i].x) : float4{padding_position, padding_position, padding_position, 0.0f};
+    };
+
+    constexpr auto block_size = 256ul;
+    ThreadPool::global().parallel_for((padded_count + block_size - 1u) / block_size, [&](size_t block) {
+        auto end = std::min(padded_count, (block + 1u) * block_size);
+        for (auto i = block * block_size; i < end; i += 4u) {
+            auto x = load(positions, i);
+            auto y = load(positions, i + 1u);
+            auto z = load(positions, i + 2u);
+            auto w = load(positions, i + 3u);
+            transpose(x, y, z, w);
+            auto er = load(emissions, i);
+            auto eg = load(emissions, i + 1u);
+            auto eb = load(emissions, i + 2u);
+            auto range = load(emissions, i + 3u);
+            transpose(er, eg, eb, range);
+            (m00 * x + m01 * y + m02 * z + m03).store(&_view_x[i]);
+            (m10 * x + m11 * y + m12 * z + m13).store(&_view_y[i]);
+            (m20 * x + m21 * y + m22 * z + m23).store(&_view_z[i]);
+            range.store(&_view_range[i]);
+        }
+    });
+}
+
+void LightCuller::_bin_slice(size_t slice_index) {
+
+    using namespace simd;
+
+    auto &&slice = _slices[slice_index];
+    slice.x.clear();
+    slice.y.clear();
+    slice.z.clear();
+    slice.range.clear();
+    slice.light_indices.clear();
+    slice.counts.assign(grid_x * grid_y, 0u);
+    slice.indices.clear();
+
+    // gather the lights whose spheres overlap the depth range of the slice, view space looks down -z
+    float4 near{-_slice_depths[slice_index]};
+    float4 far{-_slice_depths[slice_index + 1u]};
+    for (auto i = 0ul; i < _view_z.size(); i += 4u) {
+        auto z = float4::load(&_view_z[i]);
+        auto range = float4::load(&_view_range[i]);
+        auto overlap = mask(((z - range) <= near) & ((z + range) >= far) & (range > float4{0.0f}));
+        for (auto lane = 0u; overlap != 0u; lane++, overlap >>= 1u) {
+            if (overlap & 1u) {
+                slice.x.emplace_back(_view_x[i + lane]);
+                slice.y.emplace_back(_view_y[i + lane]);
+                slice.z.emplace_back(_view_z[i + lane]);
+                slice.range.emplace_back(_view_range[i + lane]);
+                slice.light_indices.emplace_back(static_cast<uint32_t>(i + lane));
+            }
+        }
+    }
+    if (slice.light_indices.empty()) {
+        return;
+    }
+    while (slice.x.size() % 4u != 0u) {
+        slice.x.emplace_back(padding_position);
+        slice.y.emplace_back(padding_position);
+        slice.z.emplace_back(padding_position);
+        slice.range.emplace_back(0.0f);
+    }
+
+    // sphere-box tests of the candidates against every cluster of the slice, four lights at a time
+    for (auto tile = 0u; tile < grid_x * grid_y; tile++) {
+        auto cluster = tile + static_cast<uint32_t>(slice_index) * grid_x * grid_y;
+        auto bounds_min = _cluster_min[cluster];
+        auto bounds_max = _cluster_max[cluster];
+        float4 min_x{bounds_min.x}, min_y{bounds_min.y}, min_z{bounds_min.z};
+        float4 max_x{bounds_max.x}, max_y{bounds_max.y}, max_z{bounds_max.z};
+        auto count = 0u;
+        for (auto i = 0ul; i < slice.x.size(); i += 4u) {
+            auto x = float4::load(&slice.x[i]);
+            auto y = float4::load(&slice.y[i]);
+            auto z = float4::load(&slice.z[i]);
+            auto range = float4::load(&slice.range[i]);
+            auto dx = x - clamp(x, min_x, max_x);
+            auto dy = y - clamp(y, min_y, max_y);
+            auto dz = z - clamp(z, min_z, max_z);
+            auto overlap = mask(dot3(dx, dy, dz, dx, dy, dz) <= range * range);
+            for (auto lane = 0u; overlap != 0u; lane++, overlap >>= 1u) {
+                if (overlap & 1u) {
+                    slice.indices.emplace_back(slice.light_indices[i + lane]);
+                    count++;
+                }
+            }
+        }
+        slice.counts[tile] = count;
+    }
+}
+
+void LightCuller::update(const LightBuffer &lights, const glm::mat4 &view, float fov_y, float aspect, float near, float far) {
+
+    // the lists stay valid while neither the camera nor any light changed
+    auto projection_changed = fov_y != _fov_y || aspect != _aspect || near != _near || far != _far;
+    if (!projection_changed && view == _view && lights.changed_lights().empty()) {
+        return;
+    }
+    if (projection_changed) {
+        _rebuild_grid(fov_y, aspect, near, far);
+    }
+    _view = view;
+
+    _transform_lights(lights, view);
+    ThreadPool::global().parallel_for(grid_z, [this](size_t slice) { _bin_slice(slice); });
+
+    // concatenate the per-slice lists, clusters are numbered tile-major within each slice
+    _indices.clear();
+    for (auto z = 0u; z < grid_z; z++) {
+        auto &&slice = _slices[z];
+        auto offset = static_cast<uint32_t>(_indices.size());
+        for (auto tile = 0u; tile < grid_x * grid_y; tile++) {
+            _ranges[tile + z * grid_x * grid_y] = {offset, slice.counts[tile]};
+            offset += slice.counts[tile];
+        }
+        _indices.insert(_indices.end(), slice.indices.cbegin(), slice.indices.cend());
+    }
+
+    glBindTexture(GL_TEXTURE_2D, _range_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, grid_x * grid_y, grid_z, GL_RG_INTEGER, GL_UNSIGNED_INT, _ranges.data());
+
+    // the index list is wrapped into rows like the light textures so that the shaders share the addressing
+    constexpr auto width = LightBuffer::texture_width;
+    glBindTexture(GL_TEXTURE_2D, _index_texture);
+    if (_indices.size() > _index_capacity || _index_capacity == 0) {
+        _index_capacity = std::max<size_t>(util::next_power_of_two(_indices.size()), width);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, static_cast<int32_t>(_index_capacity / width), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    }
+    auto full_rows = static_cast<int32_t>(_indices.size() / width);
+    auto remainder = static_cast<int32_t>(_indices.size() % width);
+    if (full_rows != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, full_rows, GL_RED_INTEGER, GL_UNSIGNED_INT, _indices.data());
+    }
+    if (remainder != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, full_rows, remainder, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, _indices.data() + full_rows * width);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void LightCuller::bind(const Shader &shader, uint32_t first_texture_unit, glm::vec2 viewport_size) const {
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _range_texture);
+    shader.setInt("clusterRanges", first_texture_unit);
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit + 1);
+    glBindTexture(GL_TEXTURE_2D, _index_texture);
+    shader.setInt("clusterLightIndices", first_texture_unit + 1);
+    shader.setVec2("clusterTileSize", viewport_size / glm::vec2{grid_x, grid_y});
+    shader.setVec2("clusterDepthParams", _depth_scale, _depth_bias);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,85 @@
+//
+// Created by Mike Smith on 2019/10/15.
+//
+
+#ifndef LEARNOPENGL_LIGHT_CULLER_H
+#define LEARNOPENGL_LIGHT_CULLER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "light_buffer.h"
+
+// Clustered forward light culling. The view frustum is divided into grid_x * grid_y screen tiles and grid_z
+// exponentially spaced depth slices; every frame the lights are binned into these froxels on the CPU using their
+// influence ranges, and the per-cluster light index lists are uploaded as integer textures so that the fragment
+// shader only iterates the lights of its own cluster.
+class LightCuller {
+
+public:
+    static constexpr auto grid_x = 16u;
+    static constexpr auto grid_y = 9u;
+    static constexpr auto grid_z = 24u;
+    static constexpr auto cluster_count = grid_x * grid_y * grid_z;
+
+private:
+    struct Slice {
+        // view-space lights overlapping the depth range of the slice, SoA and padded to a multiple of 4
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> range;
+        std::vector<uint32_t> light_indices;
+        // output of the slice: counts per cluster and the concatenated index lists
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> indices;
+    };
+
+    // projection the cluster bounds were built for
+    float _fov_y{0.0f};
+    float _aspect{0.0f};
+    float _near{0.0f};
+    float _far{0.0f};
+    float _depth_scale{0.0f};
+    float _depth_bias{0.0f};
+    glm::mat4 _view{0.0f};  // camera the lists were built for
+
+    std::vector<float> _slice_depths;
+    std::vector<glm::vec3> _cluster_min;  // view-space bounds of the clusters
+    std::vector<glm::vec3> _cluster_max;
+
+    std::vector<float> _view_x;  // view-space lights, SoA
+    std::vector<float> _view_y;
+    std::vector<float> _view_z;
+    std::vector<float> _view_range;
+
+    std::vector<Slice> _slices;
+    std::vector<glm::uvec2> _ranges;  // (offset, count) per cluster
+    std::vector<uint32_t> _indices;
+    size_t _index_capacity{0};
+
+    uint32_t _range_texture{0};
+    uint32_t _index_texture{0};
+
+    LightCuller() = default;
+    void _rebuild_grid(float fov_y, float aspect, float near, float far);
+    void _transform_lights(const LightBuffer &lights, const glm::mat4 &view);
+    void _bin_slice(size_t slice_index);
+
+public:
+    static LightCuller create();
+
+    ~LightCuller();
+    LightCuller(LightCuller &&) = default;
+    LightCuller(const LightCuller &) = delete;
+    LightCuller &operator=(LightCuller &&) = default;
+    LightCuller &operator=(const LightCuller &) = delete;
+
+    void update(const LightBuffer &lights, const glm::mat4 &view, float fov_y, float aspect, float near, float far);
+    void bind(const Shader &shader, uint32_t first_texture_unit, glm::vec2 viewport_size) const;
+    [[nodiscard]] size_t index_count() const noexcept { return _indices.size(); }
+
+};
+
+#endif //LEARNOPENGL_LIGHT_CULLER_H
@@ -0,0 +1,38 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#include <glad/glad.h>
+
+#include "lightmap.h"
+
+Lightmap Lightmap::create(const LightmapData &data) {
+    
+    Lightmap lightmap;
+    if (data.irradiance.empty()) {
+        return lightmap;
+    }
+    glGenTextures(1, &lightmap._texture);
+    glBindTexture(GL_TEXTURE_2D, lightmap._texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, data.width, data.height, 0, GL_RGB, GL_FLOAT, data.irradiance.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    return lightmap;
+}
+
+Lightmap::~Lightmap() {
+    glDeleteTextures(1, &_texture);
+}
+
+void Lightmap::bind(const Shader &shader, uint32_t texture_unit) const {
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _texture);
+    shader.setInt("lightmap", texture_unit);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,37 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#ifndef LEARNOPENGL_LIGHTMAP_H
+#define LEARNOPENGL_LIGHTMAP_H
+
+#include <cstdint>
+
+#include "shader.h"
+#include "lightmap_baker.h"
+
+// GPU side of a baked lightmap: the irradiance in an RGB16F texture, filtered bilinearly. The lightmap
+// coordinates are a vertex attribute of Geometry, see Geometry::set_lightmap_coords(). Created from empty data
+// (e.g. when no bake is cached) it holds no texture and reports empty().
+class Lightmap {
+
+private:
+    uint32_t _texture{0};
+    
+    Lightmap() = default;
+
+public:
+    static Lightmap create(const LightmapData &data);
+    
+    ~Lightmap();
+    Lightmap(Lightmap &&) = default;
+    Lightmap(const Lightmap &) = delete;
+    Lightmap &operator=(Lightmap &&) = default;
+    Lightmap &operator=(const Lightmap &) = delete;
+    
+    [[nodiscard]] bool empty() const noexcept { return _texture == 0; }
+    void bind(const Shader &shader, uint32_t texture_unit) const;
+    
+};
+
+#endif //LEARNOPENGL_LIGHTMAP_H
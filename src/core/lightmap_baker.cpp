@@ -0,0 +1,600 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include "bvh.h"
+#include "hasher.h"
+#include "ray_tracer.h"
+#include "serialize.h"
+#include "thread_pool.h"
+#include "lightmap_baker.h"
+
+namespace {
+
+constexpr auto pi = 3.1415926536f;
+constexpr auto baker_version = 2u;  // bump whenever the baked result changes for the same inputs, or the triangle order
+constexpr auto invalid_triangle = std::numeric_limits<uint32_t>::max();
+constexpr char file_magic[4] = {'L', 'M', 'A', 'P'};
+
+// PCG32, seeded per texel so that the result does not depend on the thread schedule
+class Random {
+
+private:
+    uint64_t _state;
+
+public:
+    explicit Random(uint64_t seed) noexcept : _state{seed * 0x9e3779b97f4a7c15ull + 0x14057b7ef767814full} { next(); }
+
+    uint32_t next() noexcept {
+        auto old = _state;
+        _state = old * 6364136223846793005ull + 1442695040888963407ull;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    float uniform() noexcept { return static_cast<float>(next() >> 8u) * (1.0f / 16777216.0f); }
+};
+
+struct Chart {
+    std::vector<uint32_t> triangles;
+    uint32_t axis{0};      // dominant normal axis, the chart is projected onto the other two
+    glm::vec2 min{std::numeric_limits<float>::max()};
+    glm::vec2 max{std::numeric_limits<float>::lowest()};
+    glm::uvec2 origin{};   // of the packed rectangle in texels, padding included
+    glm::uvec2 size{};
+};
+
+struct TexelSample {
+    uint32_t triangle{invalid_triangle};
+    glm::vec2 barycentric{};
+    float distance{std::numeric_limits<float>::lowest()};  // signed, in texels, non-negative inside the triangle
+};
+
+class UnionFind {
+
+private:
+    std::vector<uint32_t> _parents;
+
+public:
+    explicit UnionFind(size_t count) : _parents(count) { std::iota(_parents.begin(), _parents.end(), 0u); }
+
+    uint32_t find(uint32_t x) noexcept {
+        while (_parents[x] != x) {
+            _parents[x] = _parents[_parents[x]];
+            x = _parents[x];
+        }
+        return x;
+    }
+
+    void unite(uint32_t a, uint32_t b) noexcept {
+        a = find(a);
+        b = find(b);
+        if (a != b) { _parents[std::max(a, b)] = std::min(a, b); }
+    }
+};
+
+glm::vec2 project(glm::vec3 p, uint32_t axis) noexcept {
+    return axis == 0u ? glm::vec2{p.y, p.z} : (axis == 1u ? glm::vec2{p.z, p.x} : glm::vec2{p.x, p.y});
+}
+
+float cross2(glm::vec2 a, glm::vec2 b) noexcept {
+    return a.x * b.y - a.y * b.x;
+}
+
+std::vector<Chart> build_charts(const GeometryData &geometry) {
+
+    // weld vertices that only differ by the seams of the normals or texture coordinates
+    struct QuantizedPosition {
+        int32_t x, y, z;
+        bool operator==(const QuantizedPosition &rhs) const noexcept { return x == rhs.x && y == rhs.y && z == rhs.z; }
+    };
+    struct QuantizedPositionHash {
+        size_t operator()(const QuantizedPosition &p) const noexcept {
+            return (static_cast<size_t>(p.x) * 73856093u) ^ (static_cast<size_t>(p.y) * 19349663u) ^ (static_cast<size_t>(p.z) * 83492791u);
+        }
+    };
+    auto extent = geometry.aabb.max - geometry.aabb.min;
+    auto quantum = std::max(std::max(std::max(extent.x, extent.y), extent.z) * 1e-6f, 1e-7f);
+    std::unordered_map<QuantizedPosition, uint32_t, QuantizedPositionHash> welded_ids;
+    std::vector<uint32_t> welded(geometry.positions.size());
+    for (auto i = 0u; i < geometry.positions.size(); i++) {
+        auto q = glm::round((geometry.positions[i] - geometry.aabb.min) / quantum);
+        QuantizedPosition key{static_cast<int32_t>(q.x), static_cast<int32_t>(q.y), static_cast<int32_t>(q.z)};
+        welded[i] = welded_ids.emplace(key, static_cast<uint32_t>(welded_ids.size())).first->second;
+    }
+
+    // classify by the sign and axis of the dominant normal component, then connect through shared edges
+    auto triangle_count = geometry.indices.size();
+    std::vector<uint8_t> classes(triangle_count);
+    for (auto t = 0u; t < triangle_count; t++) {
+        auto tri = geometry.indices[t];
+        auto p0 = geometry.positions[tri.x];
+        auto n = glm::cross(geometry.positions[tri.y] - p0, geometry.positions[tri.z] - p0);
+        auto a = glm::abs(n);
+        auto axis = a.x >= a.y ? (a.x >= a.z ? 0u : 2u) : (a.y >= a.z ? 1u : 2u);
+        classes[t] = static_cast<uint8_t>(axis * 2u + (n[axis] < 0.0f ? 1u : 0u));
+    }
+    UnionFind components{triangle_count};
+    std::unordered_map<uint64_t, uint32_t> edges;
+    edges.reserve(triangle_count * 2u);
+    for (auto t = 0u; t < triangle_count; t++) {
+        auto tri = geometry.indices[t];
+        uint32_t w[3] = {welded[tri.x], welded[tri.y], welded[tri.z]};
+        for (auto e = 0u; e < 3u; e++) {
+            auto a = w[e];
+            auto b = w[(e + 1u) % 3u];
+            if (a == b) { continue; }
+            auto key = (static_cast<uint64_t>(std::min(a, b)) << 32u) | std::max(a, b);
+            auto [iter, inserted] = edges.emplace(key, t);
+            if (!inserted && classes[iter->second] == classes[t]) {
+                components.unite(iter->second, t);
+            }
+        }
+    }
+
+    std::vector<Chart> charts;
+    std::unordered_map<uint32_t, uint32_t> chart_ids;
+    for (auto t = 0u; t < triangle_count; t++) {
+        auto root = components.find(t);
+        auto [iter, inserted] = chart_ids.emplace(root, static_cast<uint32_t>(charts.size()));
+        if (inserted) {
+            charts.emplace_back();
+            charts.back().axis = classes[t] / 2u;
+        }
+        auto &&chart = charts[iter->second];
+        chart.triangles.emplace_back(t);
+        auto tri = geometry.indices[t];
+        for (auto v : {tri.x, tri.y, tri.z}) {
+            auto p = project(geometry.positions[v], chart.axis);
+            chart.min = glm::min(chart.min, p);
+            chart.max = glm::max(chart.max, p);
+        }
+    }
+    return charts;
+}
+
+// shelf packing at a uniform density, shrinking the density until everything fits
+float pack_charts(std::vector<Chart> &charts, const LightmapBaker::Settings &settings) {
+
+    auto total_area = 0.0;
+    for (auto &&chart : charts) {
+        auto e = chart.max - chart.min;
+        total_area += static_cast<double>(e.x) * e.y;
+    }
+    std::vector<uint32_t> order(charts.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&charts](uint32_t a, uint32_t b) {
+        return charts[a].max.y - charts[a].min.y > charts[b].max.y - charts[b].min.y;
+    });
+
+    auto atlas_size = settings.size;
+    auto density = static_cast<float>(std::sqrt(0.6 * atlas_size * atlas_size / std::max(total_area, 1e-12)));
+    density = std::min(density, settings.max_texels_per_unit);
+
+    auto try_pack = [&](float d) {
+        auto x = 0u;
+        auto y = 0u;
+        auto shelf_height = 0u;
+        for (auto index : order) {
+            auto &&chart = charts[index];
+            auto e = (chart.max - chart.min) * d;
+            chart.size = glm::uvec2{static_cast<uint32_t>(std::ceil(e.x)), static_cast<uint32_t>(std::ceil(e.y))} + 1u + 2u * settings.padding;
+            if (chart.size.x > atlas_size) { return false; }
+            if (x + chart.size.x > atlas_size) {
+                y += shelf_height;
+                x = 0u;
+                shelf_height = 0u;
+            }
+            if (y + chart.size.y > atlas_size) { return false; }
+            chart.origin = glm::uvec2{x, y};
+            x += chart.size.x;
+            shelf_height = std::max(shelf_height, chart.size.y);
+        }
+        return true;
+    };
+
+    for (auto attempt = 0u; attempt < 64u; attempt++, density *= 0.9f) {
+        if (try_pack(density)) {
+            return density;
+        }
+    }
+    throw std::runtime_error{serialize("Failed to pack ", charts.size(), " lightmap charts into ", atlas_size, "x", atlas_size, " texels")};
+}
+
+// Scene attributes at surface points, mirroring fetchAlbedo() and the vertex attributes of the shaders.
+class Surfaces {
+
+private:
+    const GeometryData &_geometry;
+    size_t _texture_size;
+
+    template<typename T>
+    [[nodiscard]] T _interpolate(const std::vector<T> &attribute, uint32_t triangle, glm::vec2 b) const noexcept {
+        auto tri = _geometry.indices[triangle];
+        return attribute[tri.x] * (1.0f - b.x - b.y) + attribute[tri.y] * b.x + attribute[tri.z] * b.y;
+    }
+
+    // the texel fetched by the shaders, texture array layer and image block are flat attributes of the last vertex
+    [[nodiscard]] const glm::u8vec4 *_texel(uint32_t triangle, glm::vec2 b) const noexcept {
+        auto tri = _geometry.indices[triangle];
+        auto layer = _geometry.tex_coords[tri.z].z;
+        if (layer < 0.0f) { return nullptr; }
+        auto block = _geometry.tex_properties[tri.z];
+        auto uv = glm::vec2{_interpolate(_geometry.tex_coords, triangle, b)};
+        uv = glm::vec2{std::fmod(std::fmod(uv.x, 1.0f) + 1.0f, 1.0f), std::fmod(std::fmod(uv.y, 1.0f) + 1.0f, 1.0f)};
+        auto p = uv * glm::vec2{block.z, block.w} + glm::vec2{block.x, block.y};
+        auto max_coord = static_cast<float>(_texture_size - 1u);
+        auto x = static_cast<size_t>(std::clamp(p.x, 0.0f, max_coord));
+        auto y = static_cast<size_t>(std::clamp(p.y, 0.0f, max_coord));
+        return &_geometry.textures.image_buffer(static_cast<size_t>(layer))[y * _texture_size + x];
+    }
+
+public:
+    explicit Surfaces(const GeometryData &geometry) noexcept
+        : _geometry{geometry}, _texture_size{geometry.textures.max_size()} {}
+
+    [[nodiscard]] glm::vec3 position(uint32_t triangle, glm::vec2 b) const noexcept { return _interpolate(_geometry.positions, triangle, b); }
+
+    [[nodiscard]] glm::vec3 geometric_normal(uint32_t triangle) const noexcept {
+        auto tri = _geometry.indices[triangle];
+        auto p0 = _geometry.positions[tri.x];
+        auto n = glm::cross(_geometry.positions[tri.y] - p0, _geometry.positions[tri.z] - p0);
+        auto length = glm::length(n);
+        return length > 0.0f ? n / length : glm::vec3{0.0f, 1.0f, 0.0f};
+    }
+
+    [[nodiscard]] glm::vec3 shading_normal(uint32_t triangle, glm::vec2 b) const noexcept {
+        auto n = _interpolate(_geometry.normals, triangle, b);
+        auto length = glm::length(n);
+        return length > 0.0f ? n / length : geometric_normal(triangle);
+    }
+
+    [[nodiscard]] glm::vec2 lightmap_coord(const std::vector<glm::vec2> &coords, uint32_t triangle, glm::vec2 b) const noexcept {
+        return coords[triangle * 3u] * (1.0f - b.x - b.y) + coords[triangle * 3u + 1u] * b.x + coords[triangle * 3u + 2u] * b.y;
+    }
+
+    // the diffuse reflectance Kd * albedo of the shaders, where Kd = 1 - specular
+    [[nodiscard]] glm::vec3 diffuse(uint32_t triangle, glm::vec2 b) const noexcept {
+        auto albedo = _interpolate(_geometry.colors, triangle, b);
+        if (auto texel = _texel(triangle, b)) {
+            albedo = glm::pow(glm::vec3{texel->r, texel->g, texel->b} / 255.0f, glm::vec3{2.2f});
+        }
+        auto specular = _interpolate(_geometry.glosses, triangle, b).x;
+        return albedo * std::clamp(1.0f - specular, 0.0f, 1.0f);
+    }
+
+    // whether the point is kept by the alpha test of the shaders
+    [[nodiscard]] bool opaque(uint32_t triangle, float u, float v) const noexcept {
+        if (triangle < _geometry.opaque_triangle_count) { return true; }
+        auto texel = _texel(triangle, glm::vec2{u, v});
+        return texel == nullptr || texel->a >= TexturePacker::alpha_cutoff;
+    }
+};
+
+void rasterize_chart(const GeometryData &geometry, const Chart &chart, const std::vector<glm::vec2> &coords,
+                     uint32_t atlas_size, std::vector<TexelSample> &samples) {
+    auto size = static_cast<float>(atlas_size);
+    for (auto triangle : chart.triangles) {
+        glm::vec2 t[3] = {coords[triangle * 3u] * size, coords[triangle * 3u + 1u] * size, coords[triangle * 3u + 2u] * size};
+        auto area = cross2(t[1] - t[0], t[2] - t[0]);
+        if (std::abs(area) < 1e-8f) { continue; }
+        float edge_lengths[3] = {glm::length(t[2] - t[1]), glm::length(t[0] - t[2]), glm::length(t[1] - t[0])};
+        // texels within one texel of the triangle are covered too, so that bilinear filtering never reads unlit texels
+        auto lo = glm::max(glm::floor(glm::min(glm::min(t[0], t[1]), t[2]) - 1.0f), glm::vec2{chart.origin});
+        auto hi = glm::min(glm::ceil(glm::max(glm::max(t[0], t[1]), t[2]) + 1.0f), glm::vec2{chart.origin + chart.size});
+        for (auto y = static_cast<uint32_t>(lo.y); y < static_cast<uint32_t>(hi.y); y++) {
+            for (auto x = static_cast<uint32_t>(lo.x); x < static_cast<uint32_t>(hi.x); x++) {
+                auto c = glm::vec2{static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f};
+                glm::vec3 l{cross2(t[2] - t[1], c - t[1]) / area,
+                            cross2(t[0] - t[2], c - t[2]) / area,
+                            cross2(t[1] - t[0], c - t[0]) / area};
+                auto distance = std::numeric_limits<float>::max();
+                for (auto i = 0; i < 3; i++) {
+                    distance = std::min(distance, l[i] * std::abs(area) / std::max(edge_lengths[i], 1e-8f));
+                }
+                auto &&sample = samples[y * atlas_size + x];
+                if (distance < -1.0f || distance <= sample.distance) { continue; }
+                l = glm::max(l, glm::vec3{0.0f});
+                l /= l.x + l.y + l.z;
+                sample.triangle = triangle;
+                sample.barycentric = glm::vec2{l.y, l.z};
+                sample.distance = distance;
+            }
+        }
+    }
+}
+
+// runs f(row) for all rows on the thread pool, reporting progress in steps of 10%
+template<typename F>
+void for_each_row(const char *pass, uint32_t height, F &&f) {
+    auto step = std::max((height + 9u) / 10u, 1u);
+    for (auto first = 0u; first < height; first += step) {
+        auto count = std::min(step, height - first);
+        ThreadPool::global().parallel_for(count, [&](size_t i) { f(static_cast<uint32_t>(first + i)); });
+        std::cout << pass << ": " << (first + count) * 100u / height << "%" << std::endl;
+    }
+}
+
+}
+
+void LightmapData::save(const std::string &path) const {
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{serialize("Failed to write lightmap: ", path)};
+    }
+    auto coord_count = static_cast<uint64_t>(coords.size());
+    file.write(file_magic, sizeof(file_magic));
+    file.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+    file.write(reinterpret_cast<const char *>(&settings_key), sizeof(settings_key));
+    file.write(reinterpret_cast<const char *>(&width), sizeof(width));
+    file.write(reinterpret_cast<const char *>(&height), sizeof(height));
+    file.write(reinterpret_cast<const char *>(&coord_count), sizeof(coord_count));
+    file.write(reinterpret_cast<const char *>(coords.data()), coords.size() * sizeof(glm::vec2));
+    file.write(reinterpret_cast<const char *>(irradiance.data()), irradiance.size() * sizeof(glm::vec3));
+    std::cout << "Saved lightmap to: " << path << std::endl;
+}
+
+std::optional<LightmapData> LightmapData::load(const std::string &path, uint64_t key) {
+
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return std::nullopt;
+    }
+
+    char magic[4]{};
+    uint32_t version = 0u;
+    uint64_t coord_count = 0u;
+    LightmapData data;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&data.key), sizeof(data.key));
+    file.read(reinterpret_cast<char *>(&data.settings_key), sizeof(data.settings_key));
+    file.read(reinterpret_cast<char *>(&data.width), sizeof(data.width));
+    file.read(reinterpret_cast<char *>(&data.height), sizeof(data.height));
+    file.read(reinterpret_cast<char *>(&coord_count), sizeof(coord_count));
+    if (!file || !std::equal(magic, magic + sizeof(magic), file_magic) || version != file_version) {
+        std::cout << "Ignoring unrecognized lightmap: " << path << std::endl;
+        return std::nullopt;
+    }
+    if (data.key != key) {
+        std::cout << "Ignoring stale lightmap: " << path << std::endl;
+        return std::nullopt;
+    }
+    data.coords.resize(coord_count);
+    data.irradiance.resize(static_cast<size_t>(data.width) * data.height);
+    file.read(reinterpret_cast<char *>(data.coords.data()), data.coords.size() * sizeof(glm::vec2));
+    file.read(reinterpret_cast<char *>(data.irradiance.data()), data.irradiance.size() * sizeof(glm::vec3));
+    if (!file) {
+        std::cout << "Ignoring truncated lightmap: " << path << std::endl;
+        return std::nullopt;
+    }
+    std::cout << "Loaded " << data.width << "x" << data.height << " lightmap from: " << path << std::endl;
+    return data;
+}
+
+uint64_t LightmapBaker::cache_key(const std::string &scene_path, const SceneInfo &info) {
+
+    Hasher hasher;
+    hasher.value(baker_version);
+
+    std::ifstream file{scene_path, std::ios::binary};
+    std::string content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    hasher.string(content);
+
+    for (auto &&mesh : info.meshes()) {
+        hasher.file_stamp(info.folder() + mesh.file_name);
+    }
+    for (auto &&material : info.materials()) {
+        if (!material.second.file_name.empty()) {
+            hasher.file_stamp(info.folder() + material.second.file_name);
+        }
+    }
+    return hasher.digest();
+}
+
+uint64_t LightmapBaker::settings_key(const Settings &settings) {
+    Hasher hasher;
+    hasher.value(settings.size);
+    hasher.value(settings.max_texels_per_unit);
+    hasher.value(settings.bounce_samples);
+    hasher.value(settings.padding);
+    hasher.value(settings.influence_cutoff);
+    return hasher.digest();
+}
+
+LightmapData LightmapBaker::bake(const SceneInfo &info, const GeometryData &geometry, const Settings &settings_in) {
+
+    auto settings = settings_in;
+    settings.padding = std::max(settings.padding, 1u);  // the rasterizer may spill one texel out of the charts
+
+    LightmapData data;
+    data.settings_key = settings_key(settings_in);
+    data.width = settings.size;
+    data.height = settings.size;
+    auto texel_count = static_cast<size_t>(data.width) * data.height;
+
+    // unwrap
+    auto charts = build_charts(geometry);
+    auto density = pack_charts(charts, settings);
+    std::cout << "Unwrapped " << geometry.indices.size() << " triangles into " << charts.size()
+              << " lightmap charts at " << density << " texels per unit" << std::endl;
+
+    data.coords.resize(geometry.indices.size() * 3u);
+    for (auto &&chart : charts) {
+        auto offset = glm::vec2{chart.origin + settings.padding};
+        for (auto t : chart.triangles) {
+            auto tri = geometry.indices[t];
+            uint32_t vertices[3] = {tri.x, tri.y, tri.z};
+            for (auto k = 0u; k < 3u; k++) {
+                auto p = project(geometry.positions[vertices[k]], chart.axis);
+                data.coords[t * 3u + k] = (offset + (p - chart.min) * density) / static_cast<float>(settings.size);
+            }
+        }
+    }
+
+    std::vector<TexelSample> samples(texel_count);
+    ThreadPool::global().parallel_for(charts.size(), [&](size_t i) {
+        rasterize_chart(geometry, charts[i], data.coords, settings.size, samples);
+    });
+
+    // lights, with the influence ranges of LightBuffer
+    std::vector<glm::vec3> light_positions;
+    std::vector<glm::vec3> light_emissions;
+    std::vector<float> light_ranges;
+    std::vector<BVH::AABB> light_bounds;
+    for (auto &&light : info.lights()) {
+        auto intensity = std::max(std::max(light.emission.r, light.emission.g), light.emission.b);
+        auto range = intensity <= 0.0f ? 0.0f : std::sqrt(intensity / settings.influence_cutoff);
+        light_positions.emplace_back(light.position);
+        light_emissions.emplace_back(light.emission);
+        light_ranges.emplace_back(range);
+        light_bounds.emplace_back(BVH::AABB{light.position - range, light.position + range});
+    }
+    auto light_bvh = BVH::build(light_bounds);
+
+    Surfaces surfaces{geometry};
+    auto tracer = RayTracer::create(geometry);
+    auto alpha_filter = [&surfaces](uint32_t triangle, float u, float v) { return surfaces.opaque(triangle, u, v); };
+    auto extent = geometry.aabb.max - geometry.aabb.min;
+    auto ray_offset = std::max(glm::length(extent) * 1e-5f, 1e-5f);
+
+    // irradiance from the point lights at P with shading normal N, Ng is the geometric normal on the same side
+    auto direct = [&](glm::vec3 P, glm::vec3 N, glm::vec3 Ng) {
+        glm::vec3 E{0.0f};
+        auto origin = P + Ng * ray_offset;
+        light_bvh.query(P, [&](uint32_t i) {
+            auto L = light_positions[i] - P;
+            auto distance = glm::length(L);
+            if (distance >= light_ranges[i] || distance <= 0.0f) { return; }
+            L /= distance;
+            auto NdotL = glm::dot(N, L);
+            if (NdotL <= 0.0f || glm::dot(Ng, L) <= 0.0f) { return; }
+            auto ratio = distance / light_ranges[i];
+            auto window = std::clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+            auto attenuation = window * window / std::max(distance * distance, 0.0001f);
+            auto to_light = light_positions[i] - origin;
+            auto shadow_distance = glm::length(to_light);
+            if (tracer.occluded(origin, to_light / shadow_distance, shadow_distance * (1.0f - 1e-4f), alpha_filter)) { return; }
+            E += light_emissions[i] * attenuation * NdotL;
+        });
+        return E;
+    };
+
+    // the lit side of a texel is the side its vertex normals point to
+    auto texel_frame = [&](const TexelSample &sample, glm::vec3 &P, glm::vec3 &N, glm::vec3 &Ng) {
+        P = surfaces.position(sample.triangle, sample.barycentric);
+        N = surfaces.shading_normal(sample.triangle, sample.barycentric);
+        Ng = surfaces.geometric_normal(sample.triangle);
+        if (glm::dot(Ng, N) < 0.0f) { Ng = -Ng; }
+    };
+
+    std::vector<glm::vec3> direct_irradiance(texel_count, glm::vec3{0.0f});
+    for_each_row("Baking direct lighting", data.height, [&](uint32_t y) {
+        for (auto x = 0u; x < data.width; x++) {
+            auto index = y * data.width + x;
+            auto &&sample = samples[index];
+            if (sample.triangle == invalid_triangle) { continue; }
+            glm::vec3 P, N, Ng;
+            texel_frame(sample, P, N, Ng);
+            direct_irradiance[index] = direct(P, N, Ng);
+        }
+    });
+
+    // one diffuse bounce, reading the direct irradiance back from the lightmap where the hit is on a lit side
+    data.irradiance = direct_irradiance;
+    if (settings.bounce_samples != 0u) {
+        for_each_row("Baking indirect lighting", data.height, [&](uint32_t y) {
+            for (auto x = 0u; x < data.width; x++) {
+                auto index = y * data.width + x;
+                auto &&sample = samples[index];
+                if (sample.triangle == invalid_triangle) { continue; }
+                glm::vec3 P, N, Ng;
+                texel_frame(sample, P, N, Ng);
+                auto origin = P + Ng * ray_offset;
+                // orthonormal basis around N (Duff et al. 2017)
+                auto sign = std::copysign(1.0f, N.z);
+                auto a = -1.0f / (sign + N.z);
+                auto b = N.x * N.y * a;
+                glm::vec3 T{1.0f + sign * N.x * N.x * a, sign * b, -sign * N.x};
+                glm::vec3 B{b, sign + N.y * N.y * a, -N.y};
+                Random random{index};
+                glm::vec3 radiance_sum{0.0f};
+                for (auto s = 0u; s < settings.bounce_samples; s++) {
+                    auto phi = 2.0f * pi * random.uniform();
+                    auto r2 = random.uniform();
+                    auto r = std::sqrt(r2);
+                    auto dir = T * (r * std::cos(phi)) + B * (r * std::sin(phi)) + N * std::sqrt(std::max(1.0f - r2, 0.0f));
+                    if (glm::dot(dir, Ng) <= 0.0f) { continue; }
+                    RayTracer::Hit hit;
+                    if (!tracer.intersect(origin, dir, std::numeric_limits<float>::max(), hit, alpha_filter)) { continue; }
+                    auto hit_normal = surfaces.shading_normal(hit.triangle, hit.barycentric);
+                    glm::vec3 E_hit;
+                    auto lookup = glm::ivec2{surfaces.lightmap_coord(data.coords, hit.triangle, hit.barycentric) * static_cast<float>(settings.size)};
+                    lookup = glm::clamp(lookup, glm::ivec2{0}, glm::ivec2{static_cast<int32_t>(settings.size) - 1});
+                    auto lookup_index = lookup.y * data.width + lookup.x;
+                    if (glm::dot(hit_normal, dir) < 0.0f && samples[lookup_index].triangle != invalid_triangle) {
+                        E_hit = direct_irradiance[lookup_index];
+                    } else {  // back side of a two-sided surface, not stored in the lightmap
+                        auto hit_position = origin + dir * hit.distance;
+                        auto hit_geometric_normal = surfaces.geometric_normal(hit.triangle);
+                        if (glm::dot(hit_geometric_normal, dir) > 0.0f) { hit_geometric_normal = -hit_geometric_normal; }
+                        if (glm::dot(hit_normal, dir) > 0.0f) { hit_normal = -hit_normal; }
+                        E_hit = direct(hit_position, hit_normal, hit_geometric_normal);
+                    }
+                    radiance_sum += surfaces.diffuse(hit.triangle, hit.barycentric) / pi * E_hit;
+                }
+                // cosine-weighted estimator of the irradiance: PI / N * sum of the incident radiance
+                data.irradiance[index] += radiance_sum * (pi / static_cast<float>(settings.bounce_samples));
+            }
+        });
+    }
+
+    // dilate into the padding so that bilinear filtering at chart borders does not pull in black texels
+    std::vector<uint8_t> covered(texel_count);
+    for (auto i = 0ul; i < texel_count; i++) {
+        covered[i] = samples[i].triangle != invalid_triangle;
+    }
+    for (auto iteration = 0u; iteration < settings.padding; iteration++) {
+        auto previous = covered;
+        auto source = data.irradiance;
+        ThreadPool::global().parallel_for(data.height, [&](size_t y) {
+            for (auto x = 0u; x < data.width; x++) {
+                auto index = y * data.width + x;
+                if (previous[index]) { continue; }
+                glm::vec3 sum{0.0f};
+                auto count = 0u;
+                for (auto dy = -1; dy <= 1; dy++) {
+                    for (auto dx = -1; dx <= 1; dx++) {
+                        auto nx = static_cast<int64_t>(x) + dx;
+                        auto ny = static_cast<int64_t>(y) + dy;
+                        if (nx < 0 || ny < 0 || nx >= data.width || ny >= data.height) { continue; }
+                        auto neighbor = ny * data.width + nx;
+                        if (previous[neighbor]) {
+                            sum += source[neighbor];
+                            count++;
+                        }
+                    }
+                }
+                if (count != 0u) {
+                    data.irradiance[index] = sum / static_cast<float>(count);
+                    covered[index] = 1u;
+                }
+            }
+        });
+    }
+
+    auto covered_count = std::count(covered.cbegin(), covered.cend(), 1u);
+    std::cout << "Baked " << data.width << "x" << data.height << " lightmap, "
+              << covered_count * 100u / texel_count << "% of the texels in use" << std::endl;
+    return data;
+}
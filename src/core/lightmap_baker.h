@@ -0,0 +1,67 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#ifndef LEARNOPENGL_LIGHTMAP_BAKER_H
+#define LEARNOPENGL_LIGHTMAP_BAKER_H
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// Baked diffuse irradiance of the static lights, stored next to the scene. coords holds the normalized lightmap
+// coordinates of every triangle corner in the order of GeometryData::indices, i.e. of the flattened vertex streams
+// of Geometry. The irradiance texels exclude the albedo and the 1 / PI of the Lambertian BRDF.
+struct LightmapData {
+
+    static constexpr uint32_t file_version = 2u;
+
+    uint32_t width{0};
+    uint32_t height{0};
+    uint64_t key{0};           // LightmapBaker::cache_key() of the inputs, set by the caller before saving
+    uint64_t settings_key{0};  // LightmapBaker::settings_key() of the bake, so LuisaBake knows when to bake again
+    std::vector<glm::vec2> coords;
+    std::vector<glm::vec3> irradiance;  // row-major, linear
+
+    void save(const std::string &path) const;
+
+    // the cached lightmap at path if it exists and was baked for key
+    static std::optional<LightmapData> load(const std::string &path, uint64_t key);
+
+};
+
+// Offline lightmap baking on the CPU, without any OpenGL calls so that it also runs on headless build machines.
+// The geometry is unwrapped into planar charts: triangles are grouped by the sign and axis of their dominant normal
+// component, connected through shared (welded) edges, projected onto the other two axes and shelf-packed into the
+// atlas at a uniform texel density. Each texel is then lit by the point lights with the windowed falloff of the
+// shaders and ray-traced shadows, plus one diffuse bounce gathered with cosine-weighted rays. Both passes run on
+// the global thread pool.
+class LightmapBaker {
+
+public:
+    struct Settings {
+        uint32_t size{1024u};                // width and height of the atlas
+        float max_texels_per_unit{32.0f};    // upper bound of the texel density
+        uint32_t bounce_samples{64u};        // gather rays per texel, zero for direct lighting only
+        uint32_t padding{2u};                // texels around each chart, filled by dilation
+        float influence_cutoff{0.05f};       // must match the LightBuffer the lightmap is rendered with
+    };
+
+private:
+    LightmapBaker() = default;
+
+public:
+    // identifies the inputs of a bake: the scene file and the meshes and textures it names; the settings are kept
+    // apart, so a lightmap baked with any of them is picked up at runtime
+    static uint64_t cache_key(const std::string &scene_path, const SceneInfo &info);
+    static uint64_t settings_key(const Settings &settings);
+
+    static LightmapData bake(const SceneInfo &info, const GeometryData &geometry, const Settings &settings);
+    static LightmapData bake(const SceneInfo &info, const GeometryData &geometry) { return bake(info, geometry, Settings{}); }
+
+};
+
+#endif //LEARNOPENGL_LIGHTMAP_BAKER_H
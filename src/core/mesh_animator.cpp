@@ -0,0 +1,54 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <iostream>
+
+#include "serialize.h"
+#include "mesh_animator.h"
+
+MeshAnimator MeshAnimator::create(const SceneInfo &info) {
+
+    MeshAnimator animator{AnimationTracks::create(info)};
+    auto &&meshes = info.meshes();
+    for (auto i = 0u; i < meshes.size(); i++) {
+        auto &&name = meshes[i].animation_name;
+        if (name.empty()) { continue; }
+        auto id = animator._tracks.id(name);
+        if (!id) {
+            throw std::runtime_error{serialize("Reference to undefined animation: ", name)};
+        }
+        animator._meshes.emplace_back(i);
+        animator._track_ids.emplace_back(*id);
+    }
+
+    if (!animator.empty()) {
+        std::cout << "Created mesh animator for " << animator.size() << " meshes with " << animator._tracks.size()
+                  << " tracks of " << animator._tracks.keyframe_count() << " keyframes" << std::endl;
+    }
+    return animator;
+}
+
+bool MeshAnimator::update(Geometry &geometry, float time) {
+
+    _swept_bounds.clear();
+    if (empty() || (_evaluated && time == _time)) {
+        return false;
+    }
+    auto first_update = !_evaluated;
+    _time = time;
+    _evaluated = true;
+
+    _tracks.sample(time, _transforms);
+    for (auto i = 0u; i < _meshes.size(); i++) {
+        auto mesh = _meshes[i];
+        auto &&transform = _transforms[_track_ids[i]];
+        if (!first_update && transform == geometry.mesh_transform(mesh)) { continue; }
+        auto old_bounds = geometry.mesh_bounds(mesh);
+        geometry.set_mesh_transform(mesh, transform);
+        auto new_bounds = geometry.mesh_bounds(mesh);
+        _swept_bounds.emplace_back(Geometry::AABB{glm::min(old_bounds.min, new_bounds.min), glm::max(old_bounds.max, new_bounds.max)});
+    }
+    geometry.upload_transforms();
+    return !_swept_bounds.empty();
+}
@@ -0,0 +1,47 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_MESH_ANIMATOR_H
+#define LEARNOPENGL_MESH_ANIMATOR_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "animation_tracks.h"
+
+// Keyframe animation of the meshes that name an animation track in the scene file. The transform of a keyframe
+// applies on top of where the mesh is placed, so the vertices stay as loaded and the evaluated transform is exactly
+// the model matrix of the mesh in Geometry. The tracks are compiled into AnimationTracks once and sampled together
+// every update(); meshes sharing a track share its evaluation.
+class MeshAnimator {
+
+private:
+    AnimationTracks _tracks;
+    std::vector<uint32_t> _meshes;       // animated, in the order of the meshes
+    std::vector<uint32_t> _track_ids;    // of each animated mesh
+    std::vector<glm::mat4> _transforms;  // per track
+    std::vector<Geometry::AABB> _swept_bounds;
+    float _time{0.0f};
+    bool _evaluated{false};
+
+    explicit MeshAnimator(AnimationTracks tracks) : _tracks{std::move(tracks)} {}
+
+public:
+    static MeshAnimator create(const SceneInfo &info);
+
+    [[nodiscard]] bool empty() const noexcept { return _meshes.empty(); }
+    [[nodiscard]] size_t size() const noexcept { return _meshes.size(); }
+
+    // moves the animated meshes of geometry to where they are at the given time and uploads their transforms,
+    // returns whether any of them moved; does nothing if the time did not change
+    bool update(Geometry &geometry, float time);
+
+    // the bounds of both the old and the new place of every mesh moved by the last update(), e.g. for
+    // ShadowAtlas::invalidate()
+    [[nodiscard]] const std::vector<Geometry::AABB> &swept_bounds() const noexcept { return _swept_bounds; }
+
+};
+
+#endif //LEARNOPENGL_MESH_ANIMATOR_H
@@ -0,0 +1,227 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+
+#include "mesh_simplifier.h"
+
+namespace {
+
+// the symmetric 4x4 matrix of the summed, area-weighted squared distances to a set of planes
+struct Quadric {
+
+    std::array<double, 10> q{};
+    double weight{0.0};
+
+    void add_plane(glm::vec3 n, float d, float w) noexcept {
+        double a = n.x;
+        double b = n.y;
+        double c = n.z;
+        q[0] += w * a * a;
+        q[1] += w * a * b;
+        q[2] += w * a * c;
+        q[3] += w * a * d;
+        q[4] += w * b * b;
+        q[5] += w * b * c;
+        q[6] += w * b * d;
+        q[7] += w * c * c;
+        q[8] += w * c * d;
+        q[9] += w * d * d;
+        weight += w;
+    }
+
+    Quadric &operator+=(const Quadric &rhs) noexcept {
+        for (auto i = 0u; i < q.size(); i++) { q[i] += rhs.q[i]; }
+        weight += rhs.weight;
+        return *this;
+    }
+
+    // the mean squared distance of p to the planes
+    [[nodiscard]] double evaluate(glm::vec3 p) const noexcept {
+        double x = p.x;
+        double y = p.y;
+        double z = p.z;
+        auto sum = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+                   q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+                   q[7] * z * z + 2.0 * q[8] * z + q[9];
+        return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+    }
+
+};
+
+constexpr auto max_fold_cosine = 0.25f;  // between the normals of a triangle before and after a collapse
+
+struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+};
+
+}
+
+std::vector<MeshSimplifier::Level> MeshSimplifier::simplify(const std::vector<glm::vec3> &positions, const glm::uvec3 *indices,
+                                                            size_t triangle_count, size_t level_count, float ratio) {
+
+    // compact the referenced vertices
+    std::vector<uint32_t> vertices;
+    vertices.reserve(triangle_count * 3u);
+    for (auto i = 0ul; i < triangle_count; i++) {
+        vertices.insert(vertices.end(), {indices[i].x, indices[i].y, indices[i].z});
+    }
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    auto local = [&vertices](uint32_t v) {
+        return static_cast<uint32_t>(std::lower_bound(vertices.cbegin(), vertices.cend(), v) - vertices.cbegin());
+    };
+    std::vector<glm::uvec3> triangles(triangle_count);
+    for (auto i = 0ul; i < triangle_count; i++) {
+        triangles[i] = {local(indices[i].x), local(indices[i].y), local(indices[i].z)};
+    }
+    auto vertex_count = vertices.size();
+    std::vector<glm::vec3> points(vertex_count);
+    for (auto i = 0ul; i < vertex_count; i++) {
+        points[i] = positions[vertices[i]];
+    }
+    auto normal = [&points](glm::uvec3 t) { return glm::cross(points[t.y] - points[t.x], points[t.z] - points[t.x]); };
+
+    std::vector<Quadric> quadrics(vertex_count);
+    for (auto &&t : triangles) {
+        auto n = normal(t);
+        auto length = glm::length(n);
+        if (length <= 0.0f) { continue; }
+        n /= length;
+        for (auto v : {t.x, t.y, t.z}) {
+            quadrics[v].add_plane(n, -glm::dot(n, points[t.x]), 0.5f * length);
+        }
+    }
+
+    // vertices on edges not shared by exactly two triangles stay in place
+    std::vector<bool> locked(vertex_count, false);
+    std::vector<uint64_t> edges;
+    edges.reserve(triangle_count * 3u);
+    for (auto &&t : triangles) {
+        for (auto k = 0u; k < 3u; k++) {
+            auto a = t[k];
+            auto b = t[(k + 1u) % 3u];
+            edges.emplace_back(static_cast<uint64_t>(std::min(a, b)) << 32u | std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (auto i = 0ul; i < edges.size();) {
+        auto j = i;
+        while (j < edges.size() && edges[j] == edges[i]) { j++; }
+        if (j - i != 2u) {
+            locked[edges[i] >> 32u] = true;
+            locked[edges[i] & 0xffffffffu] = true;
+        }
+        i = j;
+    }
+
+    std::vector<bool> alive(triangle_count, true);
+    auto alive_count = triangle_count;
+    std::vector<uint32_t> offsets(vertex_count + 1u);
+    std::vector<uint32_t> cursors(vertex_count);
+    std::vector<uint32_t> incident;
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched(vertex_count);
+    auto error = 0.0;
+
+    std::vector<Level> levels;
+    for (auto level = 0ul; level < level_count; level++) {
+
+        auto previous_count = alive_count;
+        auto target_count = static_cast<size_t>(static_cast<float>(previous_count) * ratio);
+        while (alive_count > target_count) {
+
+            // triangles around each vertex
+            std::fill(offsets.begin(), offsets.end(), 0u);
+            for (auto i = 0ul; i < triangle_count; i++) {
+                if (!alive[i]) { continue; }
+                for (auto v : {triangles[i].x, triangles[i].y, triangles[i].z}) { offsets[v + 1u]++; }
+            }
+            std::partial_sum(offsets.cbegin(), offsets.cend(), offsets.begin());
+            std::copy(offsets.cbegin(), offsets.cend() - 1, cursors.begin());
+            incident.resize(offsets.back());
+            for (auto i = 0ul; i < triangle_count; i++) {
+                if (!alive[i]) { continue; }
+                for (auto v : {triangles[i].x, triangles[i].y, triangles[i].z}) { incident[cursors[v]++] = static_cast<uint32_t>(i); }
+            }
+
+            // every edge collapses either way onto its other end, cheapest first
+            collapses.clear();
+            for (auto i = 0ul; i < triangle_count; i++) {
+                if (!alive[i]) { continue; }
+                for (auto k = 0u; k < 3u; k++) {
+                    auto a = triangles[i][k];
+                    auto b = triangles[i][(k + 1u) % 3u];
+                    for (auto [from, to] : {std::make_pair(a, b), std::make_pair(b, a)}) {
+                        if (locked[from]) { continue; }
+                        auto q = quadrics[from];
+                        q += quadrics[to];
+                        collapses.emplace_back(Collapse{q.evaluate(points[to]), from, to});
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse &lhs, const Collapse &rhs) { return lhs.cost < rhs.cost; });
+
+            // apply independent collapses, i.e. without shared triangles, until the target is met
+            std::fill(touched.begin(), touched.end(), false);
+            auto collapsed = false;
+            for (auto &&collapse : collapses) {
+
+                if (alive_count <= target_count) { break; }
+                if (touched[collapse.from] || touched[collapse.to]) { continue; }
+
+                // reject collapses that would flip or sharply fold the remaining triangles around the removed vertex
+                auto valid = true;
+                for (auto i = offsets[collapse.from]; valid && i < offsets[collapse.from + 1u]; i++) {
+                    auto t = triangles[incident[i]];
+                    if (t.x == collapse.to || t.y == collapse.to || t.z == collapse.to) { continue; }
+                    auto before = normal(t);
+                    for (auto k = 0u; k < 3u; k++) {
+                        if (t[k] == collapse.from) { t[k] = collapse.to; }
+                    }
+                    auto after = normal(t);
+                    valid = (glm::dot(before, before) <= 0.0f ||
+                             glm::dot(before, after) > max_fold_cosine * glm::length(before) * glm::length(after)) &&
+                            !(locked[t.x] && locked[t.y] && locked[t.z]);  // slivers along the borders
+                }
+                if (!valid) { continue; }
+
+                for (auto i = offsets[collapse.from]; i < offsets[collapse.from + 1u]; i++) {
+                    auto &&t = triangles[incident[i]];
+                    for (auto k = 0u; k < 3u; k++) {
+                        if (t[k] == collapse.from) { t[k] = collapse.to; }
+                        touched[t[k]] = true;
+                    }
+                    if (t.x == t.y || t.y == t.z || t.z == t.x) {
+                        alive[incident[i]] = false;
+                        alive_count--;
+                    }
+                }
+                touched[collapse.from] = true;
+                quadrics[collapse.to] += quadrics[collapse.from];
+                error = std::max(error, collapse.cost);
+                collapsed = true;
+            }
+            if (!collapsed) { break; }
+        }
+
+        // stop once the collapses barely make progress, e.g. when most vertices are locked
+        if (static_cast<float>(alive_count) > 0.9f * static_cast<float>(previous_count)) { break; }
+
+        Level result{{}, static_cast<float>(std::sqrt(error))};
+        result.indices.reserve(alive_count);
+        for (auto i = 0ul; i < triangle_count; i++) {
+            if (alive[i]) {
+                result.indices.emplace_back(vertices[triangles[i].x], vertices[triangles[i].y], vertices[triangles[i].z]);
+            }
+        }
+        levels.emplace_back(std::move(result));
+    }
+    return levels;
+}
@@ -0,0 +1,34 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_MESH_SIMPLIFIER_H
+#define LEARNOPENGL_MESH_SIMPLIFIER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Quadric error metric simplification (Garland and Heckbert) by half-edge collapses, so that the simplified triangles
+// keep referencing the original, fully attributed vertices and no new ones are made. Vertices on open edges, i.e.
+// mesh borders, attribute seams and the cuts between separately simplified pieces, never move, so that neighboring
+// pieces still meet whatever levels they are drawn at.
+class MeshSimplifier {
+
+public:
+    struct Level {
+        std::vector<glm::uvec3> indices;
+        float error;  // estimated distance from the original surface, in its units
+    };
+
+private:
+    MeshSimplifier() = default;
+
+public:
+    // successively coarser levels of the triangles, each aiming at ratio times the triangles of the previous one;
+    // fewer levels are returned when the collapses stop making progress
+    static std::vector<Level> simplify(const std::vector<glm::vec3> &positions, const glm::uvec3 *indices,
+                                       size_t triangle_count, size_t level_count, float ratio = 0.5f);
+
+};
+
+#endif //LEARNOPENGL_MESH_SIMPLIFIER_H
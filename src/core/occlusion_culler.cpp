@@ -0,0 +1,356 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "occlusion_culler.h"
+
+namespace {
+
+constexpr auto guard_band = 2.0f;    // occluders are clipped to |x|, |y| <= guard_band * w, keeping edge functions precise
+constexpr auto depth_bias = 1e-4f;   // relative, keeps the occluders from hiding their own bounding boxes
+constexpr auto max_clipped_vertices = 3u + 5u;
+
+// Sutherland-Hodgman against dot(plane, v) >= 0 in clip space
+uint32_t clip_polygon(const glm::vec4 *in, uint32_t count, glm::vec4 plane, glm::vec4 *out) noexcept {
+    auto n = 0u;
+    for (auto i = 0u; i < count; i++) {
+        auto a = in[i];
+        auto b = in[(i + 1u) % count];
+        auto da = glm::dot(plane, a);
+        auto db = glm::dot(plane, b);
+        if (da >= 0.0f) { out[n++] = a; }
+        if ((da >= 0.0f) != (db >= 0.0f)) { out[n++] = a + (b - a) * (da / (da - db)); }
+    }
+    return n;
+}
+
+}
+
+OcclusionCuller OcclusionCuller::create(const GeometryData &data, Settings settings) {
+    
+    OcclusionCuller culler{settings};
+    
+    // the largest opaque triangles, walls and floors in practice, occlude the most per rasterized triangle
+    auto area = [&data](size_t t) {
+        auto &&i = data.indices[t];
+        return glm::length(glm::cross(data.positions[i.y] - data.positions[i.x], data.positions[i.z] - data.positions[i.x]));
+    };
+    // the animated meshes are left out, they move away from where the occluders would be
+    std::vector<uint32_t> selected;
+    selected.reserve(data.opaque_triangle_count);
+    for (auto &&range : data.draw_ranges) {
+        if (range.first_triangle < data.opaque_triangle_count && !data.animated(range)) {
+            for (auto t = range.first_triangle; t < range.first_triangle + range.triangle_count; t++) {
+                selected.emplace_back(t);
+            }
+        }
+    }
+    if (selected.size() > settings.max_occluder_triangles) {
+        std::vector<float> areas(data.opaque_triangle_count);
+        ThreadPool::global().parallel_for(areas.size(), [&](size_t t) { areas[t] = area(t); });
+        std::nth_element(selected.begin(), selected.begin() + settings.max_occluder_triangles, selected.end(), [&areas](uint32_t a, uint32_t b) {
+            return areas[a] > areas[b];
+        });
+        selected.resize(settings.max_occluder_triangles);
+    }
+    
+    culler._occluder_x.reserve(selected.size() * 3u);
+    culler._occluder_y.reserve(selected.size() * 3u);
+    culler._occluder_z.reserve(selected.size() * 3u);
+    for (auto t : selected) {
+        auto &&i = data.indices[t];
+        for (auto v : {i.x, i.y, i.z}) {
+            culler._occluder_x.emplace_back(data.positions[v].x);
+            culler._occluder_y.emplace_back(data.positions[v].y);
+            culler._occluder_z.emplace_back(data.positions[v].z);
+        }
+    }
+    std::cout << "Occluders: " << selected.size() << " triangles" << std::endl;
+    
+    return culler;
+}
+
+void OcclusionCuller::_resize(uint32_t width, uint32_t height) {
+    if (width == _width && height == _height) { return; }
+    _width = width;
+    _height = height;
+    _tiles_x = (width + tile_width - 1u) / tile_width;
+    _tiles_y = (height + tile_height - 1u) / tile_height;
+    _bins.resize(_tiles_x * _tiles_y);
+    _depth.resize(width * height);
+    _block_depth.resize(width / block_width * height / block_height);
+}
+
+void OcclusionCuller::_setup_triangles() {
+    
+    using namespace simd;
+    
+    auto &&m = _view_projection;
+    float4 m00{m[0][0]}, m01{m[1][0]}, m02{m[2][0]}, m03{m[3][0]};
+    float4 m10{m[0][1]}, m11{m[1][1]}, m12{m[2][1]}, m13{m[3][1]};
+    float4 m20{m[0][2]}, m21{m[1][2]}, m22{m[2][2]}, m23{m[3][2]};
+    float4 m30{m[0][3]}, m31{m[1][3]}, m32{m[2][3]}, m33{m[3][3]};
+    
+    auto triangle_count = occluder_triangle_count();
+    constexpr auto block_size = 1024u;  // triangles
+    auto block_count = (triangle_count + block_size - 1u) / block_size;
+    std::vector<std::vector<Triangle>> block_triangles(block_count);
+    
+    auto width = static_cast<float>(_width);
+    auto height = static_cast<float>(_height);
+    ThreadPool::global().parallel_for(block_count, [&](size_t block) {
+        
+        auto first = block * block_size;
+        auto count = std::min<size_t>(block_size, triangle_count - first);
+        auto vertex_count = count * 3u;
+        
+        // clip-space positions, four vertices at a time
+        std::vector<glm::vec4> clip(vertex_count + 3u);
+        for (auto v = 0u; v < vertex_count; v += 4u) {
+            auto index = first * 3u + v;
+            alignas(16) float lanes[3][4]{};
+            for (auto lane = 0u; lane < 4u && v + lane < vertex_count; lane++) {
+                lanes[0][lane] = _occluder_x[index + lane];
+                lanes[1][lane] = _occluder_y[index + lane];
+                lanes[2][lane] = _occluder_z[index + lane];
+            }
+            auto x = float4::load(lanes[0]);
+            auto y = float4::load(lanes[1]);
+            auto z = float4::load(lanes[2]);
+            auto cx = m00 * x + m01 * y + m02 * z + m03;
+            auto cy = m10 * x + m11 * y + m12 * z + m13;
+            auto cz = m20 * x + m21 * y + m22 * z + m23;
+            auto cw = m30 * x + m31 * y + m32 * z + m33;
+            transpose(cx, cy, cz, cw);
+            cx.store(&clip[v].x);
+            cy.store(&clip[v + 1u].x);
+            cz.store(&clip[v + 2u].x);
+            cw.store(&clip[v + 3u].x);
+        }
+        
+        const glm::vec4 planes[]{
+            {0.0f, 0.0f, 1.0f, 1.0f},  // near
+            {-1.0f, 0.0f, 0.0f, guard_band}, {1.0f, 0.0f, 0.0f, guard_band},
+            {0.0f, -1.0f, 0.0f, guard_band}, {0.0f, 1.0f, 0.0f, guard_band}};
+        
+        auto &&triangles = block_triangles[block];
+        for (auto t = 0u; t < count; t++) {
+            
+            auto v = &clip[t * 3u];
+            
+            // trivially rejected if all vertices lie outside the same frustum plane
+            auto outside = [v](auto &&inside) { return !inside(v[0]) && !inside(v[1]) && !inside(v[2]); };
+            if (outside([](glm::vec4 p) { return p.x >= -p.w; }) || outside([](glm::vec4 p) { return p.x <= p.w; }) ||
+                outside([](glm::vec4 p) { return p.y >= -p.w; }) || outside([](glm::vec4 p) { return p.y <= p.w; }) ||
+                outside([](glm::vec4 p) { return p.z >= -p.w; }) || outside([](glm::vec4 p) { return p.z <= p.w; })) {
+                continue;
+            }
+            
+            glm::vec4 polygon[2][max_clipped_vertices + 2u];
+            std::copy(v, v + 3, polygon[0]);
+            auto vertex_count = 3u;
+            auto current = 0u;
+            for (auto &&plane : planes) {
+                if (glm::dot(plane, v[0]) >= 0.0f && glm::dot(plane, v[1]) >= 0.0f && glm::dot(plane, v[2]) >= 0.0f) { continue; }
+                vertex_count = clip_polygon(polygon[current], vertex_count, plane, polygon[1u - current]);
+                current = 1u - current;
+                if (vertex_count < 3u) { break; }
+            }
+            if (vertex_count < 3u) { continue; }
+            
+            // to the screen, keeping 1 / w for interpolation
+            glm::vec3 screen[max_clipped_vertices + 2u];
+            for (auto i = 0u; i < vertex_count; i++) {
+                auto p = polygon[current][i];
+                auto inv_w = 1.0f / p.w;
+                screen[i] = {(p.x * inv_w * 0.5f + 0.5f) * width, (p.y * inv_w * 0.5f + 0.5f) * height, inv_w};
+            }
+            
+            for (auto i = 1u; i + 1u < vertex_count; i++) {
+                glm::vec3 s[]{screen[0], screen[i], screen[i + 1u]};
+                auto area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[1].y - s[0].y) * (s[2].x - s[0].x);
+                if (std::abs(area) < 1e-6f) { continue; }
+                if (area < 0.0f) {
+                    std::swap(s[1], s[2]);
+                    area = -area;
+                }
+                Triangle triangle{};
+                // edge i is opposite to vertex i, so that its function is the (unnormalized) barycentric weight of i
+                for (auto e = 0u; e < 3u; e++) {
+                    auto a = s[(e + 1u) % 3u];
+                    auto b = s[(e + 2u) % 3u];
+                    triangle.edge_a[e] = a.y - b.y;
+                    triangle.edge_b[e] = b.x - a.x;
+                    triangle.edge_c[e] = a.x * b.y - a.y * b.x;
+                }
+                auto inv_area = 1.0f / area;
+                for (auto e = 0u; e < 3u; e++) {
+                    triangle.depth_plane += glm::vec3{triangle.edge_a[e], triangle.edge_b[e], triangle.edge_c[e]} * (s[e].z * inv_area);
+                }
+                auto lo = glm::min(glm::min(glm::vec2{s[0]}, glm::vec2{s[1]}), glm::vec2{s[2]});
+                auto hi = glm::max(glm::max(glm::vec2{s[0]}, glm::vec2{s[1]}), glm::vec2{s[2]});
+                // pixels whose centers may be covered
+                triangle.min = glm::max(glm::ivec2{static_cast<int32_t>(std::floor(lo.x - 0.5f)), static_cast<int32_t>(std::floor(lo.y - 0.5f))}, glm::ivec2{0});
+                triangle.max = glm::min(glm::ivec2{static_cast<int32_t>(std::ceil(hi.x - 0.5f)), static_cast<int32_t>(std::ceil(hi.y - 0.5f))},
+                                        glm::ivec2{static_cast<int32_t>(_width) - 1, static_cast<int32_t>(_height) - 1});
+                if (triangle.min.x <= triangle.max.x && triangle.min.y <= triangle.max.y) {
+                    triangles.emplace_back(triangle);
+                }
+            }
+        }
+    });
+    
+    _triangles.clear();
+    for (auto &&triangles : block_triangles) {
+        _triangles.insert(_triangles.end(), triangles.cbegin(), triangles.cend());
+    }
+}
+
+void OcclusionCuller::_rasterize_tile(uint32_t tile) {
+    
+    using namespace simd;
+    
+    auto tile_x = tile % _tiles_x;
+    auto tile_y = tile / _tiles_x;
+    auto tile_min = glm::ivec2{tile_x * tile_width, tile_y * tile_height};
+    auto tile_max = tile_min + glm::ivec2{tile_width - 1u, tile_height - 1u};
+    
+    for (auto y = tile_min.y; y <= tile_max.y; y++) {
+        std::fill_n(_depth.begin() + y * _width + tile_min.x, tile_max.x - tile_min.x + 1, 0.0f);
+    }
+    
+    float4 lane_offsets{0.5f, 1.5f, 2.5f, 3.5f};
+    for (auto index : _bins[tile]) {
+        auto &&t = _triangles[index];
+        auto x_begin = std::max(t.min.x, tile_min.x) & ~3;  // rows are processed four pixels at a time
+        auto x_end = std::min(t.max.x, tile_max.x);
+        auto y_begin = std::max(t.min.y, tile_min.y);
+        auto y_end = std::min(t.max.y, tile_max.y);
+        float4 a0{t.edge_a[0]}, a1{t.edge_a[1]}, a2{t.edge_a[2]};
+        float4 step0{4.0f * t.edge_a[0]}, step1{4.0f * t.edge_a[1]}, step2{4.0f * t.edge_a[2]};
+        float4 depth_x{t.depth_plane.x};
+        float4 depth_step{4.0f * t.depth_plane.x};
+        for (auto y = y_begin; y <= y_end; y++) {
+            auto py = static_cast<float>(y) + 0.5f;
+            auto px = float4{static_cast<float>(x_begin)} + lane_offsets;
+            auto e0 = a0 * px + (t.edge_b[0] * py + t.edge_c[0]);
+            auto e1 = a1 * px + (t.edge_b[1] * py + t.edge_c[1]);
+            auto e2 = a2 * px + (t.edge_b[2] * py + t.edge_c[2]);
+            auto depth = depth_x * px + (t.depth_plane.y * py + t.depth_plane.z);
+            auto row = _depth.data() + y * _width;
+            for (auto x = x_begin; x <= x_end; x += 4) {
+                auto inside = (e0 >= float4{0.0f}) & (e1 >= float4{0.0f}) & (e2 >= float4{0.0f});
+                if (mask(inside) != 0u) {
+                    auto stored = float4::load(row + x);
+                    select(inside, max(stored, depth), stored).store(row + x);
+                }
+                e0 += step0;
+                e1 += step1;
+                e2 += step2;
+                depth += depth_step;
+            }
+        }
+    }
+    
+    // the hierarchical level, the buffer is a whole number of tiles and tiles of blocks
+    auto blocks_per_row = _width / block_width;
+    for (auto by = tile_min.y / block_height; by <= tile_max.y / block_height; by++) {
+        for (auto bx = tile_min.x / block_width; bx <= tile_max.x / block_width; bx++) {
+            auto farthest = float4{std::numeric_limits<float>::max()};
+            for (auto y = by * block_height; y < (by + 1u) * block_height; y++) {
+                for (auto x = bx * block_width; x < (bx + 1u) * block_width; x += 4u) {
+                    farthest = min(farthest, float4::load(_depth.data() + y * _width + x));
+                }
+            }
+            _block_depth[by * blocks_per_row + bx] = std::min(std::min(farthest[0], farthest[1]), std::min(farthest[2], farthest[3]));
+        }
+    }
+}
+
+void OcclusionCuller::render(const glm::mat4 &view_projection, float aspect) {
+    
+    auto height = static_cast<uint32_t>(std::round(static_cast<float>(_settings.width) / std::max(aspect, 1e-3f)));
+    _resize((_settings.width + tile_width - 1u) & ~(tile_width - 1u), std::max((height + tile_height - 1u) & ~(tile_height - 1u), tile_height));
+    _view_projection = view_projection;
+    _setup_triangles();
+    
+    for (auto &&bin : _bins) { bin.clear(); }
+    for (auto i = 0u; i < _triangles.size(); i++) {
+        auto &&t = _triangles[i];
+        for (auto y = t.min.y / tile_height; y <= t.max.y / tile_height; y++) {
+            for (auto x = t.min.x / tile_width; x <= t.max.x / tile_width; x++) {
+                _bins[y * _tiles_x + x].emplace_back(i);
+            }
+        }
+    }
+    ThreadPool::global().parallel_for(_bins.size(), [this](size_t tile) { _rasterize_tile(static_cast<uint32_t>(tile)); });
+}
+
+bool OcclusionCuller::visible(glm::vec3 min, glm::vec3 max) const noexcept {
+    
+    using namespace simd;
+    
+    if (_depth.empty()) { return true; }
+    
+    // the screen rectangle and nearest 1 / w of the eight corners, four at a time
+    auto &&m = _view_projection;
+    float4 xs{min.x, max.x, min.x, max.x};
+    float4 ys{min.y, min.y, max.y, max.y};
+    auto lo_x = float4{std::numeric_limits<float>::max()};
+    auto lo_y = lo_x;
+    auto hi_x = float4{std::numeric_limits<float>::lowest()};
+    auto hi_y = hi_x;
+    auto nearest = float4{0.0f};
+    for (auto z : {min.z, max.z}) {
+        float4 zs{z};
+        auto cx = m[0][0] * xs + m[1][0] * ys + m[2][0] * zs + m[3][0];
+        auto cy = m[0][1] * xs + m[1][1] * ys + m[2][1] * zs + m[3][1];
+        auto cz = m[0][2] * xs + m[1][2] * ys + m[2][2] * zs + m[3][2];
+        auto cw = m[0][3] * xs + m[1][3] * ys + m[2][3] * zs + m[3][3];
+        if (mask(cz < -cw) != 0u) { return true; }  // crosses the near plane
+        auto inv_w = float4{1.0f} / cw;
+        auto sx = (cx * inv_w * 0.5f + 0.5f) * static_cast<float>(_width);
+        auto sy = (cy * inv_w * 0.5f + 0.5f) * static_cast<float>(_height);
+        lo_x = simd::min(lo_x, sx);
+        lo_y = simd::min(lo_y, sy);
+        hi_x = simd::max(hi_x, sx);
+        hi_y = simd::max(hi_y, sy);
+        nearest = simd::max(nearest, inv_w);
+    }
+    auto horizontal_min = [](float4 v) { return std::min(std::min(v[0], v[1]), std::min(v[2], v[3])); };
+    auto horizontal_max = [](float4 v) { return std::max(std::max(v[0], v[1]), std::max(v[2], v[3])); };
+    auto to_pixel = [](float x, uint32_t size) {
+        return static_cast<int32_t>(std::floor(std::clamp(x, -1.0f, static_cast<float>(size))));
+    };
+    auto x_lo = std::max(to_pixel(horizontal_min(lo_x), _width), 0);
+    auto y_lo = std::max(to_pixel(horizontal_min(lo_y), _height), 0);
+    auto x_hi = std::min(to_pixel(horizontal_max(hi_x), _width), static_cast<int32_t>(_width) - 1);
+    auto y_hi = std::min(to_pixel(horizontal_max(hi_y), _height), static_cast<int32_t>(_height) - 1);
+    if (x_lo > x_hi || y_lo > y_hi) { return true; }
+    
+    // occluded wherever the stored depth is closer than the nearest corner
+    auto threshold = horizontal_max(nearest) * (1.0f + depth_bias);
+    auto blocks_per_row = _width / block_width;
+    for (auto by = y_lo / static_cast<int32_t>(block_height); by <= y_hi / static_cast<int32_t>(block_height); by++) {
+        for (auto bx = x_lo / static_cast<int32_t>(block_width); bx <= x_hi / static_cast<int32_t>(block_width); bx++) {
+            if (_block_depth[by * blocks_per_row + bx] > threshold) { continue; }
+            auto row_begin = std::max(by * static_cast<int32_t>(block_height), y_lo);
+            auto row_end = std::min((by + 1) * static_cast<int32_t>(block_height) - 1, y_hi);
+            auto column_begin = std::max(bx * static_cast<int32_t>(block_width), x_lo);
+            auto column_end = std::min((bx + 1) * static_cast<int32_t>(block_width) - 1, x_hi);
+            for (auto y = row_begin; y <= row_end; y++) {
+                for (auto x = column_begin; x <= column_end; x++) {
+                    if (_depth[y * _width + x] <= threshold) { return true; }
+                }
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,79 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_OCCLUSION_CULLER_H
+#define LEARNOPENGL_OCCLUSION_CULLER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// Software occlusion culling entirely on the CPU, so that it runs and can be checked without a GPU. The largest
+// opaque triangles of the scene are selected once as occluders; every frame they are transformed with the
+// four-wide SIMD kernels, clipped against the near plane and a guard band, binned into screen tiles and rasterized
+// tile-parallel on the global thread pool into a low-resolution buffer of 1 / w (larger is closer, zero is empty).
+// The farthest depth of each 8x4 block forms a second, hierarchical level, against which the screen rectangles of
+// bounding boxes are tested first; only blocks that do not occlude a box on their own are tested per pixel.
+class OcclusionCuller {
+
+public:
+    struct Settings {
+        uint32_t width{320u};                     // the height follows the aspect ratio
+        uint32_t max_occluder_triangles{16384u};  // the largest ones by area
+    };
+    
+    static constexpr auto tile_width = 32u;
+    static constexpr auto tile_height = 16u;
+    static constexpr auto block_width = 8u;
+    static constexpr auto block_height = 4u;
+
+private:
+    struct Triangle {
+        float edge_a[3];  // edge functions a * x + b * y + c, non-negative inside
+        float edge_b[3];
+        float edge_c[3];
+        glm::vec3 depth_plane;  // 1 / w = x * px + y * py + z
+        glm::ivec2 min;  // pixel bounds, inclusive
+        glm::ivec2 max;
+    };
+    
+    Settings _settings;
+    uint32_t _width{0};
+    uint32_t _height{0};
+    uint32_t _tiles_x{0};
+    uint32_t _tiles_y{0};
+    glm::mat4 _view_projection{1.0f};
+    std::vector<float> _occluder_x;  // three vertices per triangle
+    std::vector<float> _occluder_y;
+    std::vector<float> _occluder_z;
+    std::vector<Triangle> _triangles;
+    std::vector<std::vector<uint32_t>> _bins;  // triangles overlapping each tile
+    std::vector<float> _depth;
+    std::vector<float> _block_depth;  // the minimum, i.e. farthest, 1 / w of each block
+    
+    explicit OcclusionCuller(Settings settings) noexcept : _settings{settings} {}
+    void _resize(uint32_t width, uint32_t height);
+    void _setup_triangles();
+    void _rasterize_tile(uint32_t tile);
+
+public:
+    static OcclusionCuller create(const GeometryData &data, Settings settings);
+    static OcclusionCuller create(const GeometryData &data) { return create(data, Settings{}); }
+    
+    [[nodiscard]] uint32_t width() const noexcept { return _width; }
+    [[nodiscard]] uint32_t height() const noexcept { return _height; }
+    [[nodiscard]] size_t occluder_triangle_count() const noexcept { return _occluder_x.size() / 3u; }
+    [[nodiscard]] const std::vector<float> &depth() const noexcept { return _depth; }  // row-major, bottom row first
+    
+    // rasterizes the occluders as seen through view_projection
+    void render(const glm::mat4 &view_projection, float aspect);
+    
+    // whether any part of the box may be visible behind the rendered occluders, conservatively: boxes crossing the
+    // near plane or not projecting onto the buffer count as visible
+    [[nodiscard]] bool visible(glm::vec3 min, glm::vec3 max) const noexcept;
+    
+};
+
+#endif //LEARNOPENGL_OCCLUSION_CULLER_H
@@ -0,0 +1,142 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+
+#include "occlusion_queries.h"
+
+OcclusionQueries OcclusionQueries::create(const Geometry &geometry) {
+
+    OcclusionQueries queries;
+    auto count = geometry.draw_ranges().size();
+    queries._queries.resize(count * 2u);
+    queries._latest.resize(count, 0u);
+    queries._occluded.resize(count, false);
+    queries._applied_frames.resize(count, 0u);
+    queries._issued_frames.resize(count * 2u, 0u);
+    queries._pending.resize(count * 2u, false);
+    glGenQueries(static_cast<int32_t>(queries._queries.size()), queries._queries.data());
+
+    // conservative rasterization of the boxes where available, any sample otherwise
+    queries._target = GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_ES3_compatibility ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+
+    // the unit cube as 12 triangles, scaled to the bounds in bounding_box.vs
+    std::vector<glm::vec3> vertices;
+    for (auto axis = 0u; axis < 3u; axis++) {
+        for (auto side = 0u; side < 2u; side++) {
+            glm::vec3 corners[4];
+            for (auto i = 0u; i < 4u; i++) {
+                corners[i][axis] = static_cast<float>(side);
+                corners[i][(axis + 1u) % 3u] = static_cast<float>(i & 1u);
+                corners[i][(axis + 2u) % 3u] = static_cast<float>(i >> 1u);
+            }
+            vertices.insert(vertices.end(), {corners[0], corners[1], corners[3], corners[0], corners[3], corners[2]});
+        }
+    }
+    glGenVertexArrays(1, &queries._box_vertex_array);
+    glGenBuffers(1, &queries._box_vertex_buffer);
+    glBindVertexArray(queries._box_vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, queries._box_vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+    glBindVertexArray(0);
+
+    return queries;
+}
+
+OcclusionQueries::~OcclusionQueries() {
+    glDeleteQueries(static_cast<int32_t>(_queries.size()), _queries.data());
+    glDeleteBuffers(1, &_box_vertex_buffer);
+    glDeleteVertexArrays(1, &_box_vertex_array);
+}
+
+void OcclusionQueries::invalidate() {
+    std::fill(_occluded.begin(), _occluded.end(), false);
+    std::fill(_applied_frames.begin(), _applied_frames.end(), _frame);  // results still in flight are outdated
+    _conditional_ranges.clear();
+}
+
+void OcclusionQueries::poll() {
+    // results arrive in no particular order here, one older than the state of its range is dropped
+    for (auto i = 0u; i < _pending_queries.size();) {
+        auto query = _pending_queries[i];
+        auto available = 0;
+        glGetQueryObjectiv(_queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == 0) {
+            i++;
+            continue;
+        }
+        auto passed = 0u;
+        glGetQueryObjectuiv(_queries[query], GL_QUERY_RESULT, &passed);
+        if (auto range = query / 2u; _issued_frames[query] > _applied_frames[range]) {
+            _occluded[range] = passed == 0u;
+            _applied_frames[range] = _issued_frames[query];
+        }
+        _pending[query] = false;
+        _pending_queries[i] = _pending_queries.back();
+        _pending_queries.pop_back();
+    }
+}
+
+void OcclusionQueries::query(const Shader &box_shader, const Geometry &geometry, const Geometry::DrawList &list, const glm::mat4 &view_projection) {
+
+    _frame++;
+    _conditional_ranges.clear();
+
+    box_shader.use();
+    box_shader.setMat4("viewProjection", view_projection);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    glDisable(GL_CULL_FACE);  // the back faces count when the front ones are clipped
+    glBindVertexArray(_box_vertex_array);
+
+    for (auto index : list.ranges) {
+
+        auto occluded = _occluded[index];
+        auto due = (index + _frame) % revisit_interval == 0u;
+        if (!occluded && !due) { continue; }
+
+        // slightly enlarged, the faces of a box may coincide with the surfaces inside
+        auto bounds = geometry.draw_range_bounds(index);
+        auto margin = (bounds.max - bounds.min) * 1e-3f + 1e-4f;
+        auto min = bounds.min - margin;
+        auto max = bounds.max + margin;
+
+        // boxes crossing the near plane are visible anyway
+        auto crosses_near_plane = false;
+        for (auto corner = 0u; corner < 8u && !crosses_near_plane; corner++) {
+            auto p = view_projection * glm::vec4{corner & 1u ? max.x : min.x, corner & 2u ? max.y : min.y, corner & 4u ? max.z : min.z, 1.0f};
+            crosses_near_plane = p.z < -p.w;
+        }
+        if (crosses_near_plane) {
+            _occluded[index] = false;
+            _applied_frames[index] = _frame;
+            continue;
+        }
+
+        // into the query not issued last; if that one is still in flight too, its result is superseded by this one
+        auto slot = static_cast<uint8_t>(_latest[index] ^ 1u);
+        auto query = index * 2u + slot;
+        box_shader.setVec3("boundsMin", min);
+        box_shader.setVec3("boundsMax", max);
+        glBeginQuery(_target, _queries[query]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(_target);
+        _latest[index] = slot;
+        _issued_frames[query] = _frame;
+        if (!_pending[query]) {
+            _pending[query] = true;
+            _pending_queries.emplace_back(query);
+        }
+        if (occluded) { _conditional_ranges.emplace_back(index); }
+    }
+
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
@@ -0,0 +1,81 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_OCCLUSION_QUERIES_H
+#define LEARNOPENGL_OCCLUSION_QUERIES_H
+
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "shader.h"
+
+// Hardware occlusion culling of the draw ranges in the spirit of CHC++ (Mattausch et al.), for free flight where no
+// visibility sets are baked. Ranges found occluded by their last finished query are left out of the draw list; each
+// frame their bounding boxes are queried against the depth of the visible ranges and they are drawn under
+// conditional rendering of that query, so that ranges coming into view appear in the same frame. Visible ranges are
+// re-queried every few frames, staggered, to notice when they become occluded. Each range has two query objects
+// used in turn, so a fresh query is issued even while the previous one is still in flight, and conditional
+// rendering always uses the query of the current frame. Results are polled without waiting, so the CPU never stalls
+// on the GPU; at worst the draw list learns of them a few frames late.
+class OcclusionQueries {
+
+public:
+    static constexpr auto revisit_interval = 8u;  // frames between the queries of a visible range
+
+private:
+    std::vector<uint32_t> _queries;  // two per draw range
+    std::vector<uint8_t> _latest;    // per draw range, which of its queries was issued last
+    std::vector<bool> _occluded;
+    std::vector<uint32_t> _applied_frames;  // per draw range, the frame of the query its state was last set from
+    std::vector<uint32_t> _issued_frames;   // per query, the frame it was last issued in
+    std::vector<bool> _pending;      // per query
+    std::vector<uint32_t> _pending_queries;
+    std::vector<uint32_t> _conditional_ranges;  // the occluded ranges of the last query()
+    Geometry::DrawList _range_list;
+    uint32_t _box_vertex_array{0};
+    uint32_t _box_vertex_buffer{0};
+    GLenum _target{GL_ANY_SAMPLES_PASSED};
+    uint32_t _frame{0};
+
+    OcclusionQueries() = default;
+
+public:
+    static OcclusionQueries create(const Geometry &geometry);
+
+    ~OcclusionQueries();
+    OcclusionQueries(OcclusionQueries &&) = default;
+    OcclusionQueries(const OcclusionQueries &) = delete;
+    OcclusionQueries &operator=(OcclusionQueries &&) = default;
+    OcclusionQueries &operator=(const OcclusionQueries &) = delete;
+
+    // per draw range, for Geometry::CullSettings::occluded
+    [[nodiscard]] const std::vector<bool> &occluded() const noexcept { return _occluded; }
+
+    // marks every range visible again, e.g. after the camera jumped
+    void invalidate();
+
+    // reads back the finished queries, never waits
+    void poll();
+
+    // queries the boxes of the ranges of list that are occluded or due for a revisit, against the depth buffer as laid
+    // down by the visible ranges; box_shader is bounding_box.vs with an empty fragment shader
+    void query(const Shader &box_shader, const Geometry &geometry, const Geometry::DrawList &list, const glm::mat4 &view_projection);
+
+    // calls render(const Geometry::DrawList &) for each occluded range of the last query() under conditional rendering
+    template<typename Render>
+    void render_conditional(const Geometry &geometry, Render &&render) {
+        for (auto index : _conditional_ranges) {
+            geometry.list_draw_range(index, _range_list);
+            glBeginConditionalRender(_queries[index * 2u + _latest[index]], GL_QUERY_WAIT);  // the GPU waits, the CPU does not
+            render(static_cast<const Geometry::DrawList &>(_range_list));
+            glEndConditionalRender();
+        }
+    }
+
+};
+
+#endif //LEARNOPENGL_OCCLUSION_QUERIES_H
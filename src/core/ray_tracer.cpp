@@ -0,0 +1,36 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#include <iostream>
+
+#include "ray_tracer.h"
+
+RayTracer RayTracer::create(const GeometryData &data) {
+
+    std::vector<BVH::AABB> bounds;
+    bounds.reserve(data.indices.size());
+    for (auto &&triangle : data.indices) {
+        auto p0 = data.positions[triangle.x];
+        auto p1 = data.positions[triangle.y];
+        auto p2 = data.positions[triangle.z];
+        bounds.emplace_back(BVH::AABB{glm::min(glm::min(p0, p1), p2), glm::max(glm::max(p0, p1), p2)});
+    }
+
+    RayTracer tracer{BVH::build(bounds)};
+    auto &&order = tracer._bvh.primitive_indices();
+    tracer._v0.reserve(order.size());
+    tracer._e1.reserve(order.size());
+    tracer._e2.reserve(order.size());
+    tracer._triangles = order;
+    for (auto index : order) {
+        auto triangle = data.indices[index];
+        auto p0 = data.positions[triangle.x];
+        tracer._v0.emplace_back(p0);
+        tracer._e1.emplace_back(data.positions[triangle.y] - p0);
+        tracer._e2.emplace_back(data.positions[triangle.z] - p0);
+    }
+
+    std::cout << "Built ray tracing BVH with " << tracer._bvh.nodes().size() << " nodes over " << order.size() << " triangles" << std::endl;
+    return tracer;
+}
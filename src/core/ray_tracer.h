@@ -0,0 +1,152 @@
+//
+// Created by Mike Smith on 2019/10/17.
+//
+
+#ifndef LEARNOPENGL_RAY_TRACER_H
+#define LEARNOPENGL_RAY_TRACER_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "scene.h"
+
+// CPU ray casting against the triangles of GeometryData for offline tools. The triangles are stored as a vertex
+// and two edges in BVH leaf order, so that a leaf is a contiguous run of Moller-Trumbore tests. Every candidate hit
+// is passed through a filter, filter(triangle, u, v) -> bool, which lets callers reject e.g. alpha-tested texels.
+// All queries are const and may be issued from any number of threads.
+class RayTracer {
+
+public:
+    struct Hit {
+        uint32_t triangle{0};  // index into GeometryData::indices
+        float distance{0.0f};
+        glm::vec2 barycentric{};  // weights of the second and third vertex
+    };
+
+    static constexpr auto accept_all = [](uint32_t, float, float) noexcept { return true; };
+
+private:
+    BVH _bvh;
+    std::vector<glm::vec3> _v0;
+    std::vector<glm::vec3> _e1;
+    std::vector<glm::vec3> _e2;
+    std::vector<uint32_t> _triangles;  // original triangle of each ordered slot
+
+    explicit RayTracer(BVH bvh) noexcept : _bvh{std::move(bvh)} {}
+
+    [[nodiscard]] static bool _intersect_box(const BVH::Node &node, glm::vec3 origin, glm::vec3 inv_dir, float t_max, float &t_near) noexcept {
+        auto t0 = (node.min - origin) * inv_dir;
+        auto t1 = (node.max - origin) * inv_dir;
+        auto lo = glm::min(t0, t1);
+        auto hi = glm::max(t0, t1);
+        t_near = std::max(std::max(lo.x, lo.y), std::max(lo.z, 0.0f));
+        auto t_far = std::min(std::min(hi.x, hi.y), std::min(hi.z, t_max));
+        return t_near <= t_far;
+    }
+
+    [[nodiscard]] bool _intersect_triangle(uint32_t slot, glm::vec3 origin, glm::vec3 dir, float t_max, Hit &hit) const noexcept {
+        constexpr auto epsilon = 1e-9f;
+        auto e1 = _e1[slot];
+        auto e2 = _e2[slot];
+        auto p = glm::cross(dir, e2);
+        auto det = glm::dot(e1, p);
+        if (std::abs(det) < epsilon) { return false; }
+        auto inv_det = 1.0f / det;
+        auto s = origin - _v0[slot];
+        auto u = glm::dot(s, p) * inv_det;
+        if (u < 0.0f || u > 1.0f) { return false; }
+        auto q = glm::cross(s, e1);
+        auto v = glm::dot(dir, q) * inv_det;
+        if (v < 0.0f || u + v > 1.0f) { return false; }
+        auto t = glm::dot(e2, q) * inv_det;
+        if (t <= 0.0f || t >= t_max) { return false; }
+        hit.triangle = _triangles[slot];
+        hit.distance = t;
+        hit.barycentric = glm::vec2{u, v};
+        return true;
+    }
+
+    template<bool any_hit, typename Filter>
+    bool _trace(glm::vec3 origin, glm::vec3 dir, float t_max, Hit &hit, const Filter &filter) const {
+
+        if (_bvh.empty()) { return false; }
+
+        auto &&nodes = _bvh.nodes();
+        auto inv_dir = 1.0f / dir;
+        auto found = false;
+
+        struct Entry {
+            uint32_t node;
+            float t_near;
+        };
+        Entry stack[64];
+        auto stack_size = 0u;
+        float t_root;
+        if (!_intersect_box(nodes[0], origin, inv_dir, t_max, t_root)) { return false; }
+        stack[stack_size++] = {0u, t_root};
+
+        while (stack_size != 0u) {
+            auto entry = stack[--stack_size];
+            if (entry.t_near > t_max) { continue; }  // a closer hit has been found meanwhile
+            auto index = entry.node;
+            auto &&node = nodes[index];
+            if (node.is_leaf()) {
+                for (auto slot = node.offset; slot < node.offset + node.count; slot++) {
+                    Hit candidate;
+                    if (_intersect_triangle(slot, origin, dir, t_max, candidate) &&
+                        filter(candidate.triangle, candidate.barycentric.x, candidate.barycentric.y)) {
+                        hit = candidate;
+                        if constexpr (any_hit) { return true; }
+                        t_max = candidate.distance;
+                        found = true;
+                    }
+                }
+            } else {
+                // visit the nearer child first so that t_max shrinks early and culls the farther one
+                auto left = index + 1u;
+                auto right = node.offset;
+                float t_left, t_right;
+                auto hit_left = _intersect_box(nodes[left], origin, inv_dir, t_max, t_left);
+                auto hit_right = _intersect_box(nodes[right], origin, inv_dir, t_max, t_right);
+                if (hit_left && hit_right) {
+                    if (t_left > t_right) {
+                        std::swap(left, right);
+                        std::swap(t_left, t_right);
+                    }
+                    stack[stack_size++] = {right, t_right};
+                    stack[stack_size++] = {left, t_left};
+                } else if (hit_left) {
+                    stack[stack_size++] = {left, t_left};
+                } else if (hit_right) {
+                    stack[stack_size++] = {right, t_right};
+                }
+            }
+        }
+        return found;
+    }
+
+public:
+    static RayTracer create(const GeometryData &data);
+
+    [[nodiscard]] size_t triangle_count() const noexcept { return _triangles.size(); }
+
+    // closest accepted hit along origin + t * dir for t in (0, t_max)
+    template<typename Filter = decltype(accept_all)>
+    bool intersect(glm::vec3 origin, glm::vec3 dir, float t_max, Hit &hit, const Filter &filter = accept_all) const {
+        return _trace<false>(origin, dir, t_max, hit, filter);
+    }
+
+    // whether any accepted hit exists for t in (0, t_max)
+    template<typename Filter = decltype(accept_all)>
+    [[nodiscard]] bool occluded(glm::vec3 origin, glm::vec3 dir, float t_max, const Filter &filter = accept_all) const {
+        Hit hit;
+        return _trace<true>(origin, dir, t_max, hit, filter);
+    }
+
+};
+
+#endif //LEARNOPENGL_RAY_TRACER_H
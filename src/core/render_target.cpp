@@ -0,0 +1,124 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "serialize.h"
+#include "render_target.h"
+
+RenderTarget RenderTarget::create(uint32_t width, uint32_t height, uint32_t samples, ColorFormat format) {
+    
+    RenderTarget target;
+    target._format = format;
+    glGenFramebuffers(1, &target._framebuffer);
+    glGenFramebuffers(1, &target._resolve_framebuffer);
+    glGenRenderbuffers(1, &target._color_renderbuffer);
+    glGenRenderbuffers(1, &target._depth_renderbuffer);
+    glGenTextures(1, &target._color_texture);
+    glGenTextures(1, &target._depth_texture);
+    glGenVertexArrays(1, &target._vertex_array);
+    target._allocate(width, height, samples);
+    
+    return target;
+}
+
+RenderTarget::~RenderTarget() {
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteFramebuffers(1, &_resolve_framebuffer);
+    glDeleteRenderbuffers(1, &_color_renderbuffer);
+    glDeleteRenderbuffers(1, &_depth_renderbuffer);
+    glDeleteTextures(1, &_color_texture);
+    glDeleteTextures(1, &_depth_texture);
+    glDeleteVertexArrays(1, &_vertex_array);
+}
+
+void RenderTarget::_allocate(uint32_t width, uint32_t height, uint32_t samples) {
+    
+    _width = width;
+    _height = height;
+    _samples = std::max(samples, 1u);
+    
+    auto format = color_format_info(_format);
+    glBindTexture(GL_TEXTURE_2D, _color_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width, height, 0, format.pixel_format, format.pixel_type, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    auto multisampled = _samples > 1u;
+    if (multisampled) {
+        glBindRenderbuffer(GL_RENDERBUFFER, _depth_renderbuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, _samples, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, _color_renderbuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, _samples, format.internal_format, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, _depth_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    if (multisampled) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _color_renderbuffer);
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _color_texture, 0);
+    }
+    if (multisampled) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depth_renderbuffer);
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depth_texture, 0);
+    }
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status == GL_FRAMEBUFFER_COMPLETE && multisampled) {
+        glBindFramebuffer(GL_FRAMEBUFFER, _resolve_framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _color_texture, 0);
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error{serialize("Render target framebuffer not complete, status: ", status)};
+    }
+}
+
+void RenderTarget::resize(uint32_t width, uint32_t height, uint32_t samples) {
+    if (width != _width || height != _height || std::max(samples, 1u) != _samples) {
+        _allocate(width, height, samples);
+    }
+}
+
+void RenderTarget::present(const Shader &shader, uint32_t texture_unit) const {
+    
+    if (_samples > 1u) {
+        int32_t framebuffer = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _resolve_framebuffer);
+        glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+    
+    shader.use();
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _color_texture);
+    shader.setInt("sceneColor", texture_unit);
+    glActiveTexture(GL_TEXTURE0);
+    
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(_vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,70 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_RENDER_TARGET_H
+#define LEARNOPENGL_RENDER_TARGET_H
+
+#include <cstdint>
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "color_format.h"
+
+// Offscreen color and depth target the scene is rendered into, in HDR so that exposure and tonemapping happen when
+// it is presented, and at its own resolution under dynamic resolution scaling. With more than one sample the scene
+// is rendered into multisampled renderbuffers that present() resolves before filtering the color onto the bound
+// framebuffer; single-sampled targets render straight into textures that can be sampled.
+class RenderTarget {
+
+private:
+    uint32_t _width{0};
+    uint32_t _height{0};
+    uint32_t _samples{0};
+    ColorFormat _format{ColorFormat::SRGB8_ALPHA8};
+    uint32_t _framebuffer{0};
+    uint32_t _resolve_framebuffer{0};  // only used when multisampled
+    uint32_t _color_renderbuffer{0};   // only used when multisampled
+    uint32_t _depth_renderbuffer{0};   // only used when multisampled
+    uint32_t _color_texture{0};
+    uint32_t _depth_texture{0};        // only used when single-sampled
+    uint32_t _vertex_array{0};  // empty, for the fullscreen triangle
+    
+    RenderTarget() = default;
+    void _allocate(uint32_t width, uint32_t height, uint32_t samples);
+
+public:
+    static RenderTarget create(uint32_t width, uint32_t height, uint32_t samples = 1u, ColorFormat format = ColorFormat::R11G11B10F);
+    
+    ~RenderTarget();
+    RenderTarget(RenderTarget &&) = default;
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget &operator=(RenderTarget &&) = default;
+    RenderTarget &operator=(const RenderTarget &) = delete;
+    
+    [[nodiscard]] uint32_t width() const noexcept { return _width; }
+    [[nodiscard]] uint32_t height() const noexcept { return _height; }
+    [[nodiscard]] uint32_t samples() const noexcept { return _samples; }
+    [[nodiscard]] ColorFormat format() const noexcept { return _format; }
+    [[nodiscard]] uint32_t color_texture() const noexcept { return _color_texture; }
+    [[nodiscard]] uint32_t depth_texture() const noexcept { return _depth_texture; }  // incomplete when multisampled
+    
+    // reallocates the attachments if anything changed
+    void resize(uint32_t width, uint32_t height, uint32_t samples);
+    
+    template<typename F>
+    void with(F &&render) {
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+        glViewport(0, 0, _width, _height);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(static_cast<uint32_t>(GL_COLOR_BUFFER_BIT) | static_cast<uint32_t>(GL_DEPTH_BUFFER_BIT));
+        render();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    
+    // resolves the samples and draws the color as sceneColor through the shader over the bound framebuffer's viewport
+    void present(const Shader &shader, uint32_t texture_unit) const;
+    
+};
+
+#endif //LEARNOPENGL_RENDER_TARGET_H
@@ -0,0 +1,41 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "resolution_scaler.h"
+
+ResolutionScaler::ResolutionScaler(const Settings &settings) noexcept
+    : _settings{settings}, _scale{settings.max_scale} {}
+
+bool ResolutionScaler::update(float frame_time) noexcept {
+    
+    _average_time = _sample_count == 0u ? frame_time : glm::mix(_average_time, frame_time, 0.25f);
+    if (++_sample_count < _settings.settle_frames) {
+        return false;
+    }
+    
+    auto budget = _settings.target_frame_time * _settings.headroom;
+    auto desired = _scale * std::sqrt(budget / std::max(_average_time, 1e-3f));
+    desired = std::clamp(desired, _settings.min_scale, _settings.max_scale);
+    
+    // Over the target, always step down. Otherwise round towards the current scale, which leaves a dead band
+    // between the aimed-for budget and the target so that the scale does not flip between two steps.
+    auto steps = (desired - _scale) / _settings.scale_step;
+    steps = _average_time > _settings.target_frame_time ? std::min(std::floor(steps), -1.0f) : std::max(std::trunc(steps), 0.0f);
+    auto quantized = std::clamp(_scale + steps * _settings.scale_step, _settings.min_scale, _settings.max_scale);
+    if (quantized == _scale) {
+        return false;
+    }
+    _scale = quantized;
+    _sample_count = 0u;
+    return true;
+}
+
+glm::uvec2 ResolutionScaler::resolution(glm::uvec2 output_size) const noexcept {
+    auto width = static_cast<uint32_t>(std::lround(static_cast<float>(output_size.x) * _scale));
+    auto height = static_cast<uint32_t>(std::lround(static_cast<float>(output_size.y) * _scale));
+    return glm::max(glm::min(glm::uvec2{width, height}, output_size), glm::uvec2{1u});
+}
@@ -0,0 +1,50 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_RESOLUTION_SCALER_H
+#define LEARNOPENGL_RESOLUTION_SCALER_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Picks the render resolution that keeps the GPU frame time within a budget. The GPU time of a frame is assumed to
+// scale with its pixel count, so the controller moves the per-axis scale towards sqrt(budget / time), using an
+// exponential moving average of the measurements. The scale is quantized and only changed after a few fresh
+// measurements, which keeps the render targets from being reallocated every frame and leaves room for the
+// measurements (which lag a few frames behind) to reflect the previous decision.
+class ResolutionScaler {
+
+public:
+    struct Settings {
+        float target_frame_time{1000.0f / 60.0f};  // in milliseconds
+        float headroom{0.9f};                      // fraction of the budget aimed for
+        float min_scale{0.5f};
+        float max_scale{1.0f};
+        float scale_step{1.0f / 16.0f};
+        uint32_t settle_frames{8u};                // measurements between two decisions
+    };
+
+private:
+    Settings _settings;
+    float _scale;
+    float _average_time{0.0f};
+    uint32_t _sample_count{0};
+
+public:
+    explicit ResolutionScaler(const Settings &settings) noexcept;
+    ResolutionScaler() noexcept : ResolutionScaler{Settings{}} {}
+    
+    [[nodiscard]] float scale() const noexcept { return _scale; }
+    [[nodiscard]] float average_frame_time() const noexcept { return _average_time; }
+    [[nodiscard]] const Settings &settings() const noexcept { return _settings; }
+    
+    // feeds a GPU frame time in milliseconds, returns whether the scale changed
+    bool update(float frame_time) noexcept;
+    
+    // render resolution for the given output size, at least one pixel
+    [[nodiscard]] glm::uvec2 resolution(glm::uvec2 output_size) const noexcept;
+    
+};
+
+#endif //LEARNOPENGL_RESOLUTION_SCALER_H
@@ -5,6 +5,8 @@
 #include <functional>
 #include <exception>
 #include <algorithm>
+#include <limits>
+#include <numeric>
 #include <queue>
 #include <iostream>
 #include <memory>
@@ -19,7 +21,10 @@
 #include "serialize.h"
 #include "util.h"
 #include "scene.h"
+#include "occlusion_culler.h"
+#include "mesh_simplifier.h"
 #include "texture_packer.h"
+#include "thread_pool.h"
 
 SceneInfo SceneInfo::load(const std::string &path) {
     
@@ -261,6 +266,13 @@ SceneInfo SceneInfo::load(const std::string &path) {
     return scene;
 }
 
+bool SceneInfo::vertex_animated(const Mesh &mesh) const noexcept {
+    auto iter = _animations.find(mesh.animation_name);
+    return iter != _animations.end() && std::any_of(iter->second.cbegin(), iter->second.cend(), [](const Animation &keyframe) {
+        return !keyframe.file_name.empty();
+    });
+}
+
 void SceneInfo::print() const noexcept {
     
     auto vec2str = [](glm::vec3 v) {
@@ -343,19 +355,170 @@ void SceneInfo::print() const noexcept {
     
 }
 
-Geometry Geometry::create(const SceneInfo &info) {
+namespace {
+
+// Grows meshlets greedily over the triangles of a draw range that share vertices, preferring those facing along
+// the average normal of the meshlet and close to its center, and reorders the triangles of the range to match.
+std::vector<GeometryData::Meshlet> build_meshlets(GeometryData &data, const GeometryData::DrawRange &range) {
     
-    Geometry geometry;
+    constexpr auto lookahead = 16u;        // unused triangles considered when a meshlet has no neighbors left
+    constexpr auto crease_cosine = 0.5f;   // half-full meshlets are closed rather than grown across sharper creases
+    constexpr auto narrowest_cone = 0.1f;  // cosine, wider normal cones are never back-facing as a whole
+    
+    auto count = range.triangle_count;
+    std::vector<glm::uvec3> source{data.indices.cbegin() + range.first_triangle,
+                                   data.indices.cbegin() + range.first_triangle + count};
+    std::vector<glm::vec3> normals(count);
+    std::vector<glm::vec3> centroids(count);
+    for (auto i = 0u; i < count; i++) {
+        auto a = data.positions[source[i].x];
+        auto b = data.positions[source[i].y];
+        auto c = data.positions[source[i].z];
+        auto n = glm::cross(b - a, c - a);  // counter-clockwise front faces
+        auto length = glm::length(n);
+        normals[i] = length > 0.0f ? n / length : glm::vec3{0.0f};
+        centroids[i] = (a + b + c) / 3.0f;
+    }
+    
+    // triangles around each vertex, as sorted (vertex, triangle) pairs
+    std::vector<std::pair<uint32_t, uint32_t>> incidence;
+    incidence.reserve(count * 3u);
+    for (auto i = 0u; i < count; i++) {
+        for (auto v : {source[i].x, source[i].y, source[i].z}) {
+            incidence.emplace_back(v, i);
+        }
+    }
+    std::sort(incidence.begin(), incidence.end());
+    
+    std::vector<bool> used(count, false);
+    std::vector<uint32_t> candidates;
+    std::vector<GeometryData::Meshlet> meshlets;
+    auto emitted = 0u;
+    auto seed = 0u;
+    while (emitted < count) {
+        
+        auto first = emitted;
+        auto normal_sum = glm::vec3{0.0f};
+        auto centroid_sum = glm::vec3{0.0f};
+        auto radius = 0.0f;  // of the centroids, estimated as they are added
+        candidates.clear();
+        
+        auto add = [&](uint32_t i) {
+            used[i] = true;
+            data.indices[range.first_triangle + emitted++] = source[i];
+            normal_sum += normals[i];
+            centroid_sum += centroids[i];
+            radius = std::max(radius, glm::distance(centroids[i], centroid_sum / static_cast<float>(emitted - first)));
+            for (auto v : {source[i].x, source[i].y, source[i].z}) {
+                auto iter = std::lower_bound(incidence.cbegin(), incidence.cend(), std::make_pair(v, 0u));
+                for (; iter != incidence.cend() && iter->first == v; ++iter) {
+                    if (!used[iter->second]) { candidates.emplace_back(iter->second); }
+                }
+            }
+        };
+        
+        while (used[seed]) { seed++; }
+        add(seed);
+        while (emitted - first < GeometryData::max_meshlet_size && emitted < count) {
+            
+            auto size = emitted - first;
+            auto axis = glm::length(normal_sum) > 0.0f ? glm::normalize(normal_sum) : glm::vec3{0.0f};
+            auto center = centroid_sum / static_cast<float>(size);
+            auto score = [&](uint32_t i) {
+                auto d = glm::distance(centroids[i], center);
+                return glm::dot(normals[i], axis) - d / (d + radius + 1e-6f);
+            };
+            
+            auto best = count;
+            auto best_score = std::numeric_limits<float>::lowest();
+            for (auto k = 0u; k < candidates.size();) {
+                auto i = candidates[k];
+                if (used[i]) {
+                    candidates[k] = candidates.back();
+                    candidates.pop_back();
+                    continue;
+                }
+                if (auto s = score(i); s > best_score) {
+                    best = i;
+                    best_score = s;
+                }
+                k++;
+            }
+            if (best == count) {  // disconnected, the next triangles in file order are usually nearby
+                for (auto i = seed, n = 0u; i < count && n < lookahead; i++) {
+                    if (used[i]) { continue; }
+                    if (auto s = score(i); s > best_score) {
+                        best = i;
+                        best_score = s;
+                    }
+                    n++;
+                }
+            }
+            if (size >= GeometryData::max_meshlet_size / 2u && glm::dot(normals[best], axis) < crease_cosine) { break; }
+            add(best);
+        }
+        
+        GeometryData::Meshlet meshlet{range.first_triangle + first, emitted - first, {}, {}, {}};
+        auto axis = glm::vec3{0.0f};
+        for (auto t = meshlet.first_triangle; t < meshlet.first_triangle + meshlet.triangle_count; t++) {
+            for (auto v : {data.indices[t].x, data.indices[t].y, data.indices[t].z}) {
+                meshlet.bounds.min = glm::min(meshlet.bounds.min, data.positions[v]);
+                meshlet.bounds.max = glm::max(meshlet.bounds.max, data.positions[v]);
+            }
+        }
+        auto center = (meshlet.bounds.min + meshlet.bounds.max) * 0.5f;
+        auto sphere_radius = 0.0f;
+        auto min_cosine = 1.0f;
+        if (glm::length(normal_sum) > 0.0f) { axis = glm::normalize(normal_sum); }
+        for (auto t = meshlet.first_triangle; t < meshlet.first_triangle + meshlet.triangle_count; t++) {
+            for (auto v : {data.indices[t].x, data.indices[t].y, data.indices[t].z}) {
+                sphere_radius = std::max(sphere_radius, glm::distance(center, data.positions[v]));
+            }
+        }
+        for (auto i = first; i < emitted; i++) {
+            auto &&t = data.indices[range.first_triangle + i];
+            auto n = glm::cross(data.positions[t.y] - data.positions[t.x], data.positions[t.z] - data.positions[t.x]);
+            if (auto length = glm::length(n); length > 0.0f) {  // degenerate triangles are never rasterized
+                min_cosine = std::min(min_cosine, glm::dot(n / length, axis));
+            }
+        }
+        meshlet.sphere = glm::vec4{center, sphere_radius};
+        meshlet.cone = glm::vec4{axis, min_cosine > narrowest_cone ? std::sqrt(1.0f - min_cosine * min_cosine) : 1.0f};
+        meshlets.emplace_back(meshlet);
+    }
+    return meshlets;
+}
+
+// the bounds of a transformed box, from the extents of the transformed axes (Arvo)
+impl::AABB transform_bounds(const glm::mat4 &m, const impl::AABB &bounds) noexcept {
+    impl::AABB result{glm::vec3{m[3]}, glm::vec3{m[3]}};
+    for (auto i = 0; i < 3; i++) {
+        auto a = glm::vec3{m[i]} * bounds.min[i];
+        auto b = glm::vec3{m[i]} * bounds.max[i];
+        result.min += glm::min(a, b);
+        result.max += glm::max(a, b);
+    }
+    return result;
+}
+
+}
+
+GeometryData GeometryData::load(const SceneInfo &info) {
     
-    std::vector<glm::vec3> positions;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec3> colors;
-    std::vector<glm::vec3> tex_coords;
-    std::vector<glm::vec4> tex_properties;
-    std::vector<glm::vec2> glosses;  // (specular, roughness)
-    std::vector<glm::uvec3> indices;
+    GeometryData data;
     
-    TexturePacker packer;
+    auto &&positions = data.positions;
+    auto &&normals = data.normals;
+    auto &&colors = data.colors;
+    auto &&tex_coords = data.tex_coords;
+    auto &&tex_properties = data.tex_properties;
+    auto &&glosses = data.glosses;
+    auto &&indices = data.indices;
+    std::vector<glm::uvec3> alpha_tested_indices;
+    std::vector<GeometryData::DrawRange> opaque_submeshes;  // triangle ranges within their index lists
+    std::vector<GeometryData::DrawRange> alpha_tested_submeshes;
+    
+    auto &&packer = data.textures;
     
     for (auto &&mesh : info.meshes()) {
         
@@ -367,10 +530,12 @@ Geometry Geometry::create(const SceneInfo &info) {
             throw std::runtime_error{serialize("Failed to load scene from: ", path)};
         }
         
-        geometry._mesh_offsets.emplace_back(positions.size());
-        geometry._mesh_animation_names.emplace_back(mesh.animation_name);
+        data.mesh_offsets.emplace_back(positions.size());
+        data.mesh_animation_names.emplace_back(mesh.animation_name);
+        data.mesh_vertex_frame_offsets.emplace_back(info.vertex_animated(mesh) ? static_cast<int32_t>(data.vertex_frame_size) : -1);
         
-        auto offset = static_cast<uint32_t>(geometry._mesh_offsets.back());
+        auto mesh_index = static_cast<uint32_t>(data.mesh_offsets.size() - 1u);
+        auto offset = static_cast<uint32_t>(data.mesh_offsets.back());
         
         // gather submeshes
         std::vector<aiMesh *> mesh_list;
@@ -455,44 +620,171 @@ Geometry Geometry::create(const SceneInfo &info) {
                 }
                 colors.emplace_back(color);
                 glosses.emplace_back(gloss);
-                geometry._aabb.min = glm::min(geometry._aabb.min, position);
-                geometry._aabb.max = glm::max(geometry._aabb.max, position);
+                data.aabb.min = glm::min(data.aabb.min, position);
+                data.aabb.max = glm::max(data.aabb.max, position);
             }
             
-            // process faces
+            // process faces, submeshes that may discard fragments are kept apart so that they can be drawn last
+            auto alpha_tested = has_texture && block.alpha_tested && ai_mesh->mTextureCoords[0] != nullptr;
+            auto &&face_indices = alpha_tested ? alpha_tested_indices : indices;
+            (alpha_tested ? alpha_tested_submeshes : opaque_submeshes).emplace_back(GeometryData::DrawRange{
+                static_cast<uint32_t>(face_indices.size()), static_cast<uint32_t>(ai_mesh->mNumFaces), 0u, 0u, 0u, 0u, mesh_index, {}});
             for (auto i = 0ul; i < ai_mesh->mNumFaces; i++) {
                 auto &&face = ai_mesh->mFaces[i].mIndices;
-                indices.emplace_back(glm::uvec3{face[0], face[1], face[2]} + offset);
+                face_indices.emplace_back(glm::uvec3{face[0], face[1], face[2]} + offset);
             }
             
             offset += ai_mesh->mNumVertices;
         }
-        geometry._mesh_sizes.emplace_back(positions.size() - geometry._mesh_offsets.back());
+        data.mesh_sizes.emplace_back(positions.size() - data.mesh_offsets.back());
+        if (data.mesh_vertex_frame_offsets.back() != -1) { data.vertex_frame_size += data.mesh_sizes.back(); }
     }
     
-    geometry._texture_count = packer.count();
-    geometry._texture_array = packer.create_opengl_texture_array();
-    
-    auto aabb_min = glm::min(geometry._aabb.min, geometry._aabb.max);
-    auto aabb_max = glm::max(geometry._aabb.min, geometry._aabb.max);
-    geometry._aabb.min = aabb_min;
-    geometry._aabb.max = aabb_max;
+    auto aabb_min = glm::min(data.aabb.min, data.aabb.max);
+    auto aabb_max = glm::max(data.aabb.min, data.aabb.max);
+    data.aabb.min = aabb_min;
+    data.aabb.max = aabb_max;
     
     std::cout << "AABB: "
               << "min = (" << aabb_min.x << ", " << aabb_min.y << ", " << aabb_min.z << "), "
               << "max = (" << aabb_max.x << ", " << aabb_max.y << ", " << aabb_max.z << ")" << std::endl;
     
-    geometry._triangle_count = indices.size();
-    geometry._vertex_count = positions.size();
+    data.opaque_triangle_count = indices.size();
+    indices.insert(indices.end(), alpha_tested_indices.cbegin(), alpha_tested_indices.cend());
+    
+    // split the submeshes into draw ranges and bound them
+    auto add_draw_ranges = [&data](const std::vector<GeometryData::DrawRange> &submeshes, uint32_t base) {
+        for (auto &&submesh : submeshes) {
+            for (auto offset = 0u; offset < submesh.triangle_count; offset += GeometryData::max_draw_range_size) {
+                auto count = std::min(submesh.triangle_count - offset, GeometryData::max_draw_range_size);
+                data.draw_ranges.emplace_back(GeometryData::DrawRange{base + submesh.first_triangle + offset, count, 0u, 0u, 0u, 0u, submesh.mesh, {}});
+            }
+        }
+    };
+    add_draw_ranges(opaque_submeshes, 0u);
+    add_draw_ranges(alpha_tested_submeshes, static_cast<uint32_t>(data.opaque_triangle_count));
+    
+    // cluster each draw range into meshlets independently, the triangles only move within their range
+    std::vector<std::vector<GeometryData::Meshlet>> range_meshlets(data.draw_ranges.size());
+    ThreadPool::global().parallel_for(data.draw_ranges.size(), [&data, &range_meshlets](size_t i) {
+        auto &&range = data.draw_ranges[i];
+        range_meshlets[i] = build_meshlets(data, range);
+        for (auto &&meshlet : range_meshlets[i]) {
+            range.bounds.min = glm::min(range.bounds.min, meshlet.bounds.min);
+            range.bounds.max = glm::max(range.bounds.max, meshlet.bounds.max);
+        }
+    });
+    for (auto i = 0ul; i < data.draw_ranges.size(); i++) {
+        data.draw_ranges[i].first_meshlet = static_cast<uint32_t>(data.meshlets.size());
+        data.draw_ranges[i].meshlet_count = static_cast<uint32_t>(range_meshlets[i].size());
+        data.meshlets.insert(data.meshlets.end(), range_meshlets[i].cbegin(), range_meshlets[i].cend());
+    }
+    
+    // simplify each draw range on its own, its open edges stay in place so that the levels of neighbors still meet
+    std::vector<std::vector<MeshSimplifier::Level>> range_lods(data.draw_ranges.size());
+    ThreadPool::global().parallel_for(data.draw_ranges.size(), [&data, &range_lods](size_t i) {
+        auto &&range = data.draw_ranges[i];
+        range_lods[i] = MeshSimplifier::simplify(data.positions, data.indices.data() + range.first_triangle,
+                                                 range.triangle_count, GeometryData::max_lod_count);
+    });
+    for (auto i = 0ul; i < data.draw_ranges.size(); i++) {
+        auto &&range = data.draw_ranges[i];
+        range.first_lod = static_cast<uint32_t>(data.lods.size());
+        range.lod_count = static_cast<uint32_t>(range_lods[i].size());
+        for (auto &&level : range_lods[i]) {
+            data.lods.emplace_back(GeometryData::Lod{
+                static_cast<uint32_t>(data.lod_indices.size()), static_cast<uint32_t>(level.indices.size()), level.error});
+            data.lod_indices.insert(data.lod_indices.end(), level.indices.cbegin(), level.indices.cend());
+        }
+        if (range.first_triangle < data.opaque_triangle_count) {
+            data.opaque_lod_triangle_count = data.lod_indices.size();
+        }
+    }
     
     std::cout << "Total vertices: " << positions.size() << std::endl;
-    std::cout << "Total triangles: " << geometry._triangle_count << std::endl;
+    std::cout << "Total triangles: " << indices.size() << " (" << data.opaque_triangle_count << " opaque, "
+              << indices.size() - data.opaque_triangle_count << " alpha-tested)" << std::endl;
+    std::cout << "Draw ranges: " << data.draw_ranges.size() << ", meshlets: " << data.meshlets.size()
+              << ", LOD triangles: " << data.lod_indices.size() << std::endl;
+    
+    return data;
+}
+
+Geometry Geometry::create(const SceneInfo &info) {
+    return create(GeometryData::load(info));
+}
+
+Geometry Geometry::create(const GeometryData &data) {
+    
+    Geometry geometry;
+    geometry._mesh_offsets = data.mesh_offsets;
+    geometry._mesh_sizes = data.mesh_sizes;
+    geometry._mesh_animation_names = data.mesh_animation_names;
+    geometry._mesh_vertex_frame_offsets = data.mesh_vertex_frame_offsets;
+    geometry._aabb = data.aabb;
+    geometry._opaque_triangle_count = data.opaque_triangle_count;
+    geometry._triangle_count = data.indices.size();
+    geometry._vertex_count = data.positions.size();
+    geometry._texture_count = data.textures.count();
+    geometry._texture_array = data.textures.create_opengl_texture_array();
+    geometry._draw_ranges = data.draw_ranges;
+    geometry._meshlets = data.meshlets;
+    geometry._lods = data.lods;
+    geometry._lod_triangle_count = data.lod_indices.size();
+    geometry._opaque_lod_triangle_count = data.opaque_lod_triangle_count;
+    
+    // a transform slot for every animated mesh, the static ones share the identity in slot 0
+    auto mesh_count = data.mesh_offsets.size();
+    geometry._mesh_transform_slots.resize(mesh_count, 0u);
+    geometry._mesh_bounds.resize(mesh_count);
+    geometry._transforms.emplace_back(1.0f);
+    for (auto i = 0ul; i < mesh_count; i++) {
+        if (!data.mesh_animation_names[i].empty()) {
+            geometry._mesh_transform_slots[i] = static_cast<uint32_t>(geometry._transforms.size());
+            geometry._transforms.emplace_back(1.0f);
+        }
+    }
+    
+    // only the static draw ranges go into the BVH, the animated ones would leave their nodes when they move
+    std::vector<BVH::AABB> range_bounds;
+    range_bounds.reserve(data.draw_ranges.size());
+    for (auto i = 0u; i < data.draw_ranges.size(); i++) {
+        auto &&range = data.draw_ranges[i];
+        auto &&mesh_bounds = geometry._mesh_bounds[range.mesh];
+        mesh_bounds.min = glm::min(mesh_bounds.min, range.bounds.min);
+        mesh_bounds.max = glm::max(mesh_bounds.max, range.bounds.max);
+        if (data.animated(range)) {
+            geometry._animated_ranges.emplace_back(i);
+        } else {
+            geometry._static_ranges.emplace_back(i);
+            range_bounds.emplace_back(range.bounds);
+        }
+    }
+    geometry._draw_range_bvh = BVH::build(range_bounds);
+    if (!geometry._animated_ranges.empty()) {
+        std::cout << "Animated meshes: " << geometry._transforms.size() - 1u << ", "
+                  << geometry._animated_ranges.size() << " draw ranges" << std::endl;
+    }
+    
+    std::vector<uint32_t> vertex_slots(data.positions.size());
+    std::vector<int32_t> vertex_frame_indices(data.positions.size(), -1);
+    for (auto i = 0ul; i < mesh_count; i++) {
+        std::fill_n(vertex_slots.begin() + data.mesh_offsets[i], data.mesh_sizes[i], geometry._mesh_transform_slots[i]);
+        if (auto offset = data.mesh_vertex_frame_offsets[i]; offset != -1) {
+            std::iota(vertex_frame_indices.begin() + data.mesh_offsets[i], vertex_frame_indices.begin() + data.mesh_offsets[i] + data.mesh_sizes[i], offset);
+        }
+    }
+    
+    // the levels of detail follow the full geometry in the streams
+    auto indices = data.indices;
+    indices.insert(indices.end(), data.lod_indices.cbegin(), data.lod_indices.cend());
     
     // transfer to OpenGL
     glGenVertexArrays(1, &geometry._vertex_array);
+    glGenVertexArrays(1, &geometry._position_vertex_array);
     
-    uint32_t buffers[6];
-    glGenBuffers(6, buffers);
+    uint32_t buffers[8];
+    glGenBuffers(8, buffers);
     
     geometry._position_buffer = buffers[0];
     geometry._normal_buffer = buffers[1];
@@ -500,61 +792,384 @@ Geometry Geometry::create(const SceneInfo &info) {
     geometry._tex_coord_buffer = buffers[3];
     geometry._tex_property_buffer = buffers[4];
     geometry._gloss_buffer = buffers[5];
+    geometry._transform_slot_buffer = buffers[6];
+    geometry._vertex_frame_index_buffer = buffers[7];
     
     glBindVertexArray(geometry._vertex_array);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._position_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(positions, indices).data(), GL_DYNAMIC_COPY);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(data.positions, indices).data(), GL_DYNAMIC_COPY);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._normal_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(normals, indices).data(), GL_DYNAMIC_COPY);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(data.normals, indices).data(), GL_DYNAMIC_COPY);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(colors, indices).data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(data.colors, indices).data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._tex_coord_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(tex_coords, indices).data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec3), _flatten(data.tex_coords, indices).data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(3);
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._tex_property_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec4), _flatten(tex_properties, indices).data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec4), _flatten(data.tex_properties, indices).data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(4);
     glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
     
     glBindBuffer(GL_ARRAY_BUFFER, geometry._gloss_buffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec2), _flatten(glosses, indices).data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(glm::vec2), _flatten(data.glosses, indices).data(), GL_STATIC_DRAW);
     glEnableVertexAttribArray(5);
     glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr);
     
+    glBindBuffer(GL_ARRAY_BUFFER, geometry._transform_slot_buffer);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(uint32_t), _flatten(vertex_slots, indices).data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(7);
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(uint32_t), nullptr);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, geometry._vertex_frame_index_buffer);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * 3ul * sizeof(int32_t), _flatten(vertex_frame_indices, indices).data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(8);
+    glVertexAttribIPointer(8, 1, GL_INT, sizeof(int32_t), nullptr);
+    
+    // the position-only stream shares the position, transform slot and vertex frame index buffers
+    glBindVertexArray(geometry._position_vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry._position_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry._transform_slot_buffer);
+    glEnableVertexAttribArray(7);
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(uint32_t), nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry._vertex_frame_index_buffer);
+    glEnableVertexAttribArray(8);
+    glVertexAttribIPointer(8, 1, GL_INT, sizeof(int32_t), nullptr);
+    
     glBindVertexArray(0);
     
+    // one row of texels is plenty for most scenes
+    auto transform_rows = (geometry._transforms.size() * 3u + transform_texture_width - 1u) / transform_texture_width;
+    glGenTextures(1, &geometry._transform_texture);
+    glBindTexture(GL_TEXTURE_2D, geometry._transform_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, transform_texture_width, static_cast<int32_t>(transform_rows), 0, GL_RGBA, GL_FLOAT, nullptr);
+    geometry.upload_transforms();
+    
+    // at least a row each, so that the samplers of the vertex shaders are complete without vertex animation
+    auto frame_rows = std::max((data.vertex_frame_size + vertex_frame_texture_width - 1u) / vertex_frame_texture_width, size_t{1u});
+    auto track_rows = (geometry._transforms.size() + transform_texture_width - 1u) / transform_texture_width;
+    glGenTextures(2, geometry._vertex_frame_textures);
+    glGenTextures(1, &geometry._vertex_track_texture);
+    for (auto texture : {geometry._vertex_frame_textures[0], geometry._vertex_frame_textures[1], geometry._vertex_track_texture}) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    for (auto texture : geometry._vertex_frame_textures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16I, vertex_frame_texture_width, static_cast<int32_t>(frame_rows), 0, GL_RGBA_INTEGER, GL_SHORT, nullptr);
+    }
+    std::vector<glm::vec4> track_texels(track_rows * transform_texture_width, glm::vec4{0.0f});
+    glBindTexture(GL_TEXTURE_2D, geometry._vertex_track_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, transform_texture_width, static_cast<int32_t>(track_rows), 0, GL_RGBA, GL_FLOAT, track_texels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
     return geometry;
 }
 
 Geometry::~Geometry() {
     glDeleteVertexArrays(1, &_vertex_array);
-    glDeleteBuffers(6, &_position_buffer);
+    glDeleteVertexArrays(1, &_position_vertex_array);
+    glDeleteBuffers(1, &_lightmap_coord_buffer);
+    glDeleteBuffers(8, &_position_buffer);
     glDeleteTextures(1, &_texture_array);
+    glDeleteTextures(1, &_transform_texture);
+    glDeleteTextures(2, _vertex_frame_textures);
+    glDeleteTextures(1, &_vertex_track_texture);
 }
 
-void Geometry::render(const Shader &shader) const {
-    glBindVertexArray(_vertex_array);
+void Geometry::_draw(uint32_t vertex_array, size_t first_triangle, size_t triangle_count) const {
+    if (triangle_count != 0) {
+        glBindVertexArray(vertex_array);
+        glDrawArrays(GL_TRIANGLES, first_triangle * 3, triangle_count * 3);
+        glBindVertexArray(0);
+    }
+}
+
+void Geometry::_draw(uint32_t vertex_array, const DrawList &list, size_t first, size_t count) const {
+    if (count != 0) {
+        glBindVertexArray(vertex_array);
+        glMultiDrawArrays(GL_TRIANGLES, list.firsts.data() + first, list.counts.data() + first, static_cast<int32_t>(count));
+        glBindVertexArray(0);
+    }
+}
+
+void Geometry::_bind_textures(const Shader &shader) const {
     glActiveTexture(GL_TEXTURE0);
     shader.setInt("textures", 0);
     glBindTexture(GL_TEXTURE_2D_ARRAY, _texture_array);
-    glDrawArrays(GL_TRIANGLES, 0, _triangle_count * 3);
-    glBindVertexArray(0);
+    _bind_transforms(shader);
+}
+
+void Geometry::_bind_transforms(const Shader &shader) const {
+    glActiveTexture(GL_TEXTURE0 + transform_texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _transform_texture);
+    shader.setInt("meshTransforms", transform_texture_unit);
+    for (auto i = 0u; i < 2u; i++) {
+        glActiveTexture(GL_TEXTURE0 + vertex_frame_texture_unit + i);
+        glBindTexture(GL_TEXTURE_2D, _vertex_frame_textures[i]);
+        shader.setInt(i == 0u ? "vertexFrames0" : "vertexFrames1", static_cast<int>(vertex_frame_texture_unit + i));
+    }
+    glActiveTexture(GL_TEXTURE0 + vertex_track_texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _vertex_track_texture);
+    shader.setInt("vertexAnimationTracks", vertex_track_texture_unit);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool Geometry::_opaque(size_t stream_triangle) const noexcept {
+    return stream_triangle < _opaque_triangle_count ||
+           (stream_triangle >= _triangle_count && stream_triangle < _triangle_count + _opaque_lod_triangle_count);
+}
+
+void Geometry::cull(const glm::mat4 &view_projection, DrawList &list, const CullSettings &settings) const {
+    
+    list.firsts.clear();
+    list.counts.clear();
+    list.opaque_count = 0;
+    list.triangle_count = 0;
+    list.ranges.clear();
+    list.visible.clear();
+    
+    Frustum frustum{view_projection};
+    
+    // the viewpoint is the point that projects to clip (0, 0, z, 0)
+    auto eye = glm::inverse(view_projection) * glm::vec4{0.0f, 0.0f, 1.0f, 0.0f};
+    auto eye_position = glm::vec3{eye} / eye.w;
+    auto occlusion = settings.occlusion;
+    auto meshlet_visible = [&](const Meshlet &meshlet) {
+        if (settings.back_faces) {  // every triangle faces away if the view direction is within the cone (Shirman and Abi-Ezzi)
+            auto direction = glm::vec3{meshlet.sphere} - eye_position;
+            if (glm::dot(direction, glm::vec3{meshlet.cone}) >= meshlet.cone.w * glm::length(direction) + meshlet.sphere.w) {
+                return false;
+            }
+        }
+        if (frustum.classify(meshlet.bounds.min, meshlet.bounds.max) == Containment::OUTSIDE) { return false; }
+        return occlusion == nullptr || occlusion->visible(meshlet.bounds.min, meshlet.bounds.max);
+    };
+    
+    // animated ranges are drawn whole or at a level of detail, their meshlet bounds, cones and visibility are at rest
+    auto visit = [&](uint32_t index, const AABB &bounds, bool animated) {
+        auto &&range = _draw_ranges[index];
+        auto pvs = animated ? nullptr : settings.potentially_visible;
+        if (pvs != nullptr) {
+            auto first = pvs->cbegin() + range.first_meshlet;
+            if (std::find(first, first + range.meshlet_count, true) == first + range.meshlet_count) { return; }
+        }
+        list.ranges.emplace_back(index);
+        if (settings.occluded != nullptr && (*settings.occluded)[index]) { return; }
+        // the coarsest level whose error, seen from the nearest point of the bounds, stays below the threshold
+        if (settings.lod_scale > 0.0f && range.lod_count != 0u) {
+            auto distance = glm::distance(eye_position, glm::clamp(eye_position, bounds.min, bounds.max));
+            for (auto i = range.lod_count; i != 0u; i--) {
+                auto &&lod = _lods[range.first_lod + i - 1u];
+                if (lod.error * settings.lod_scale <= settings.lod_threshold * distance) {
+                    list.visible.emplace_back(static_cast<uint32_t>(_triangle_count) + lod.first_triangle, lod.triangle_count);
+                    return;
+                }
+            }
+        }
+        if (animated) {
+            list.visible.emplace_back(range.first_triangle, range.triangle_count);
+            return;
+        }
+        for (auto i = range.first_meshlet; i < range.first_meshlet + range.meshlet_count; i++) {
+            auto &&meshlet = _meshlets[i];
+            if ((pvs == nullptr || (*pvs)[i]) && meshlet_visible(meshlet)) {
+                list.visible.emplace_back(meshlet.first_triangle, meshlet.triangle_count);
+            }
+        }
+    };
+    
+    _draw_range_bvh.cull(
+        [&frustum, occlusion](glm::vec3 min, glm::vec3 max) {
+            auto containment = frustum.classify(min, max);
+            if (occlusion == nullptr || containment == Containment::OUTSIDE) { return containment; }
+            // a node may be partially hidden even when inside the frustum, so its children are still tested
+            return occlusion->visible(min, max) ? Containment::INTERSECTING : Containment::OUTSIDE;
+        },
+        [&](uint32_t primitive) {
+            auto index = _static_ranges[primitive];
+            visit(index, _draw_ranges[index].bounds, false);
+        });
+    for (auto index : _animated_ranges) {
+        auto bounds = draw_range_bounds(index);
+        if (frustum.classify(bounds.min, bounds.max) != Containment::OUTSIDE &&
+            (occlusion == nullptr || occlusion->visible(bounds.min, bounds.max))) {
+            visit(index, bounds, true);
+        }
+    }
+    
+    // back to stream order with the opaque pieces first, merging neighbors into single draws
+    std::sort(list.visible.begin(), list.visible.end(), [this](glm::uvec2 lhs, glm::uvec2 rhs) {
+        auto lhs_opaque = _opaque(lhs.x);
+        auto rhs_opaque = _opaque(rhs.x);
+        return lhs_opaque != rhs_opaque ? lhs_opaque : lhs.x < rhs.x;
+    });
+    for (auto piece : list.visible) {
+        auto first = static_cast<int32_t>(piece.x * 3u);
+        auto count = static_cast<int32_t>(piece.y * 3u);
+        auto opaque = _opaque(piece.x);
+        auto mergeable = !list.firsts.empty() && list.firsts.back() + list.counts.back() == first &&
+                         (opaque || list.opaque_count != list.firsts.size());
+        if (mergeable) {
+            list.counts.back() += count;
+        } else {
+            list.firsts.emplace_back(first);
+            list.counts.emplace_back(count);
+            if (opaque) { list.opaque_count++; }
+        }
+        list.triangle_count += piece.y;
+    }
+}
+
+Geometry::AABB Geometry::mesh_bounds(size_t mesh) const noexcept {
+    auto slot = _mesh_transform_slots[mesh];
+    return slot == 0u ? _mesh_bounds[mesh] : transform_bounds(_transforms[slot], _mesh_bounds[mesh]);
+}
+
+Geometry::AABB Geometry::draw_range_bounds(uint32_t index) const noexcept {
+    auto &&range = _draw_ranges[index];
+    auto slot = _mesh_transform_slots[range.mesh];
+    return slot == 0u ? range.bounds : transform_bounds(_transforms[slot], range.bounds);
+}
+
+void Geometry::set_mesh_transform(size_t mesh, const glm::mat4 &transform) {
+    auto slot = _mesh_transform_slots[mesh];
+    if (slot == 0u) {
+        throw std::runtime_error{serialize("Mesh #", mesh, " has no animation and cannot be moved")};
+    }
+    _transforms[slot] = transform;
+    _transforms_dirty = true;
+}
+
+void Geometry::expand_mesh_bounds(size_t mesh, glm::vec3 min_displacement, glm::vec3 max_displacement) {
+    auto &&mesh_bounds = _mesh_bounds[mesh];
+    mesh_bounds = AABB{};
+    for (auto index : _animated_ranges) {
+        auto &&range = _draw_ranges[index];
+        if (range.mesh == mesh) {
+            range.bounds.min += min_displacement;
+            range.bounds.max += max_displacement;
+            mesh_bounds.min = glm::min(mesh_bounds.min, range.bounds.min);
+            mesh_bounds.max = glm::max(mesh_bounds.max, range.bounds.max);
+        }
+    }
+}
+
+void Geometry::upload_transforms() {
+    if (!_transforms_dirty) {
+        return;
+    }
+    _transforms_dirty = false;
+    // the rows of the affine part, i.e. the first three columns of the transpose
+    std::vector<glm::vec4> texels;
+    texels.reserve(_transforms.size() * 3u);
+    for (auto &&m : _transforms) {
+        auto t = glm::transpose(m);
+        texels.insert(texels.end(), {t[0], t[1], t[2]});
+    }
+    auto full_rows = static_cast<int32_t>(texels.size() / transform_texture_width);
+    auto remainder = static_cast<int32_t>(texels.size() % transform_texture_width);
+    glBindTexture(GL_TEXTURE_2D, _transform_texture);
+    if (full_rows != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, transform_texture_width, full_rows, GL_RGBA, GL_FLOAT, texels.data());
+    }
+    if (remainder != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, full_rows, remainder, 1, GL_RGBA, GL_FLOAT, texels.data() + full_rows * transform_texture_width);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Geometry::list_draw_range(uint32_t index, DrawList &list) const {
+    auto &&range = _draw_ranges[index];
+    list.firsts.assign(1u, static_cast<int32_t>(range.first_triangle * 3u));
+    list.counts.assign(1u, static_cast<int32_t>(range.triangle_count * 3u));
+    list.opaque_count = _opaque(range.first_triangle) ? 1u : 0u;
+    list.triangle_count = range.triangle_count;
+    list.ranges.assign(1u, index);
+    list.visible.clear();
+}
+
+void Geometry::render(const Shader &shader) const {
+    _bind_textures(shader);
+    _draw(_vertex_array, 0, _triangle_count);
+}
+
+void Geometry::render(const Shader &shader, const DrawList &list) const {
+    _bind_textures(shader);
+    _draw(_vertex_array, list, 0, list.firsts.size());
+}
+
+void Geometry::render_opaque(const Shader &shader) const {
+    _bind_textures(shader);
+    _draw(_vertex_array, 0, _opaque_triangle_count);
+}
+
+void Geometry::render_alpha_tested(const Shader &shader) const {
+    _bind_textures(shader);
+    _draw(_vertex_array, _opaque_triangle_count, _triangle_count - _opaque_triangle_count);
 }
 
 void Geometry::shadow(const Shader &shader) const {
+    _bind_transforms(shader);
+    _draw(_position_vertex_array, 0, _triangle_count);
+}
+
+void Geometry::set_lightmap_coords(const std::vector<glm::vec2> &coords) {
+    if (coords.size() != _triangle_count * 3ul) {
+        throw std::runtime_error{serialize("Lightmap coordinates do not match the geometry: ", coords.size(), " vs. ", _triangle_count * 3ul)};
+    }
+    if (_lightmap_coord_buffer == 0) {
+        glGenBuffers(1, &_lightmap_coord_buffer);
+    }
     glBindVertexArray(_vertex_array);
-    glDrawArrays(GL_TRIANGLES, 0, _triangle_count * 3);
+    glBindBuffer(GL_ARRAY_BUFFER, _lightmap_coord_buffer);
+    // the levels of detail have no charts of their own, the lightmap is rendered at full detail
+    glBufferData(GL_ARRAY_BUFFER, (_triangle_count + _lod_triangle_count) * 3ul * sizeof(glm::vec2), nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, coords.size() * sizeof(glm::vec2), coords.data());
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr);
     glBindVertexArray(0);
 }
+
+void Geometry::render_depth(const Shader &opaque_shader, const Shader &alpha_tested_shader) const {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    opaque_shader.use();
+    _bind_transforms(opaque_shader);
+    _draw(_position_vertex_array, 0, _opaque_triangle_count);
+    alpha_tested_shader.use();
+    render_alpha_tested(alpha_tested_shader);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Geometry::render_depth(const Shader &opaque_shader, const Shader &alpha_tested_shader, const DrawList &list) const {
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    opaque_shader.use();
+    _bind_transforms(opaque_shader);
+    _draw(_position_vertex_array, list, 0, list.opaque_count);
+    alpha_tested_shader.use();
+    _bind_textures(alpha_tested_shader);
+    _draw(_vertex_array, list, list.opaque_count, list.firsts.size() - list.opaque_count);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
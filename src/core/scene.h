@@ -12,16 +12,11 @@
 #include <glm/glm.hpp>
 #include <core/shader.h>
 
+#include "bvh.h"
 #include "common.h"
+#include "texture_packer.h"
 
-namespace impl {
-
-struct AABB {
-    glm::vec3 min{1.e6f};
-    glm::vec3 max{-1.e6f};
-};
-
-}
+class OcclusionCuller;
 
 class SceneInfo {
 
@@ -54,12 +49,123 @@ public:
     [[nodiscard]] const std::unordered_map<std::string, std::vector<Animation>> &animations() const noexcept { return _animations; }
     [[nodiscard]] bool animated() const noexcept { return _animated; }
     
+    // whether the animation track of the mesh has keyframes that replace its vertices with those of other files
+    [[nodiscard]] bool vertex_animated(const Mesh &mesh) const noexcept;
+    
+};
+
+// CPU side of the scene geometry, loaded without touching OpenGL so that offline tools (e.g. the lightmap baker)
+// can run headless. Vertices are indexed per mesh file; the triangles are ordered with the opaque ones first,
+// followed by the alpha-tested ones, which is also the order of the flattened vertex streams of Geometry.
+// The triangles of each submesh are contiguous and split into draw ranges, the leaves of the culling BVH, whose
+// triangles are in turn reordered into meshlets of neighboring triangles facing similar directions. Each draw range
+// also has a few simplified levels of detail, kept apart in lod_indices so that tools working on the full geometry
+// never see them; they follow the base triangles in the flattened streams, again the opaque ones first.
+// Every mesh is placed by its transform in the scene file; meshes with an animation track are moved from there at
+// runtime by the model matrices of Geometry, so all of the data here describes them at rest.
+struct GeometryData {
+    
+    struct DrawRange {
+        uint32_t first_triangle;
+        uint32_t triangle_count;
+        uint32_t first_meshlet;
+        uint32_t meshlet_count;
+        uint32_t first_lod;
+        uint32_t lod_count;
+        uint32_t mesh;  // index into SceneInfo::meshes()
+        impl::AABB bounds;
+    };
+    
+    struct Meshlet {
+        uint32_t first_triangle;
+        uint32_t triangle_count;
+        impl::AABB bounds;
+        glm::vec4 sphere;  // center and radius
+        glm::vec4 cone;    // axis of the face normals and sine of their spread, 1 if they may face any direction
+    };
+    
+    // a simplified level of a draw range, each coarser than the previous one; error is the estimated distance to
+    // the full surface
+    struct Lod {
+        uint32_t first_triangle;  // into lod_indices
+        uint32_t triangle_count;
+        float error;
+    };
+    
+    static constexpr auto max_draw_range_size = 1024u;  // triangles
+    static constexpr auto max_meshlet_size = 128u;
+    static constexpr auto max_lod_count = 3u;  // besides the full level, each with about half the triangles
+    
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> colors;
+    std::vector<glm::vec3> tex_coords;     // uv and texture array layer, -1 if untextured
+    std::vector<glm::vec4> tex_properties;  // offset and size of the image in its layer
+    std::vector<glm::vec2> glosses;         // (specular, roughness)
+    std::vector<glm::uvec3> indices;
+    size_t opaque_triangle_count{0};
+    std::vector<size_t> mesh_offsets;
+    std::vector<size_t> mesh_sizes;
+    std::vector<std::string> mesh_animation_names;
+    std::vector<int32_t> mesh_vertex_frame_offsets;  // first vertex in the frames of VertexAnimationData, -1 if none
+    size_t vertex_frame_size{0};                     // vertices per frame of all vertex-animated meshes together
+    std::vector<DrawRange> draw_ranges;  // in stream order, none straddles the opaque / alpha-tested boundary
+    std::vector<Meshlet> meshlets;        // in stream order, as are those of each draw range
+    std::vector<glm::uvec3> lod_indices;
+    size_t opaque_lod_triangle_count{0};
+    std::vector<Lod> lods;
+    impl::AABB aabb{};
+    TexturePacker textures;
+    
+    static GeometryData load(const SceneInfo &info);
+    
+    [[nodiscard]] bool animated(const DrawRange &range) const noexcept { return !mesh_animation_names[range.mesh].empty(); }
+    
 };
 
 class Geometry {
 
 public:
     using AABB = impl::AABB;
+    using DrawRange = GeometryData::DrawRange;
+    using Meshlet = GeometryData::Meshlet;
+    using Lod = GeometryData::Lod;
+    
+    struct CullSettings {
+        const OcclusionCuller *occlusion{nullptr};  // drops what is hidden behind the occluders it rendered last
+        bool back_faces{false};                     // drops meshlets facing away from the viewpoint
+        float lod_scale{0.0f};                      // pixels per unit at unit distance, zero keeps the full detail
+        float lod_threshold{1.0f};                  // largest projected error in pixels
+        const std::vector<bool> *potentially_visible{nullptr};  // per meshlet, e.g. decoded from VisibilityData, at rest
+        const std::vector<bool> *occluded{nullptr};  // per draw range, e.g. from OcclusionQueries, left out of the draws
+    };
+    
+    // vertex ranges of the flattened streams for glMultiDrawArrays, filled by cull(); adjacent visible meshlets
+    // are merged, the opaque ones come first
+    struct DrawList {
+        std::vector<int32_t> firsts;
+        std::vector<int32_t> counts;
+        size_t opaque_count{0};
+        size_t triangle_count{0};
+        std::vector<uint32_t> ranges;  // the draw ranges passing the tests, also those left out as occluded
+        std::vector<glm::uvec2> visible;  // scratch, first triangles and triangle counts of the visible pieces
+    };
+    
+    // The model matrices of the animated meshes live in an RGBA32F texture, three texels (the rows of the affine
+    // matrix) per slot, wrapped into rows of transform_texture_width texels and read with texelFetch in the vertex
+    // shaders. Every corner of the flattened streams carries the slot of its mesh as attribute 7; the static meshes
+    // share slot 0, which stays the identity, so moving a mesh costs one matrix upload instead of its vertices.
+    static constexpr auto transform_texture_width = 1024u;
+    static constexpr auto transform_texture_unit = 11u;
+    
+    // Vertex animation: the corners of vertex-animated meshes carry their vertex in the frames as attribute 8, -1
+    // elsewhere. Two RGBA16I frame textures hold the keyframes bracketing the current time of each mesh (quantized
+    // displacements from the rest pose and octahedral normals, see VertexAnimationData), and the vertex shaders blend
+    // them with the weight and scales of the mesh in the RGBA32F track texture, one texel per transform slot. The
+    // textures are only allocated here; VertexAnimationStreamer fills them.
+    static constexpr auto vertex_frame_texture_width = 1024u;
+    static constexpr auto vertex_frame_texture_unit = 12u;  // and the next one for the second frame
+    static constexpr auto vertex_track_texture_unit = 14u;
 
 private:
     std::vector<size_t> _mesh_offsets;
@@ -67,18 +173,44 @@ private:
     std::vector<std::string> _mesh_animation_names;
     AABB _aabb{};
     size_t _triangle_count{0};
+    size_t _opaque_triangle_count{0};  // opaque triangles come first, followed by the alpha-tested ones
     size_t _vertex_count{0};
     size_t _texture_count{0};
+    std::vector<DrawRange> _draw_ranges;
+    std::vector<Meshlet> _meshlets;
+    std::vector<Lod> _lods;
+    size_t _lod_triangle_count{0};
+    size_t _opaque_lod_triangle_count{0};
+    BVH _draw_range_bvh;                          // over the draw ranges of the static meshes only
+    std::vector<uint32_t> _static_ranges;         // the draw range of each primitive of the BVH
+    std::vector<uint32_t> _animated_ranges;       // tested one by one at their current bounds
+    std::vector<uint32_t> _mesh_transform_slots;  // per mesh, 0 for the static ones
+    std::vector<AABB> _mesh_bounds;               // at rest
+    std::vector<glm::mat4> _transforms;           // per slot
+    bool _transforms_dirty{true};
+    std::vector<int32_t> _mesh_vertex_frame_offsets;
     uint32_t _vertex_array{0};
+    uint32_t _position_vertex_array{0};  // position-only stream for depth-only passes
     uint32_t _position_buffer{0};
     uint32_t _normal_buffer{0};
     uint32_t _color_buffer{0};
     uint32_t _tex_coord_buffer{0};
     uint32_t _gloss_buffer{0};
     uint32_t _tex_property_buffer{0};
+    uint32_t _transform_slot_buffer{0};
+    uint32_t _vertex_frame_index_buffer{0};
+    uint32_t _lightmap_coord_buffer{0};
     uint32_t _texture_array{0};
+    uint32_t _transform_texture{0};
+    uint32_t _vertex_frame_textures[2]{};
+    uint32_t _vertex_track_texture{0};
     
     Geometry() = default;
+    void _draw(uint32_t vertex_array, size_t first_triangle, size_t triangle_count) const;
+    void _draw(uint32_t vertex_array, const DrawList &list, size_t first, size_t count) const;
+    void _bind_textures(const Shader &shader) const;
+    void _bind_transforms(const Shader &shader) const;  // and the vertex animation
+    [[nodiscard]] bool _opaque(size_t stream_triangle) const noexcept;
     
     template<typename T>
     static T _flatten(const T &v, const std::vector<glm::uvec3> &indices) noexcept {
@@ -94,6 +226,7 @@ private:
 
 public:
     static Geometry create(const SceneInfo &info);
+    static Geometry create(const GeometryData &data);
     
     ~Geometry();
     Geometry(Geometry &&) = default;
@@ -108,9 +241,56 @@ public:
     [[nodiscard]] uint32_t position_buffer_id() const noexcept { return _position_buffer; }
     [[nodiscard]] uint32_t normal_buffer_id() const noexcept { return _normal_buffer; }
     [[nodiscard]] size_t texture_count() const noexcept { return _texture_count; }
+    [[nodiscard]] size_t triangle_count() const noexcept { return _triangle_count; }
+    [[nodiscard]] size_t opaque_triangle_count() const noexcept { return _opaque_triangle_count; }
+    [[nodiscard]] const std::vector<DrawRange> &draw_ranges() const noexcept { return _draw_ranges; }
+    [[nodiscard]] const std::vector<Meshlet> &meshlets() const noexcept { return _meshlets; }
+    [[nodiscard]] const BVH &draw_range_bvh() const noexcept { return _draw_range_bvh; }
+    [[nodiscard]] const std::vector<uint32_t> &static_draw_ranges() const noexcept { return _static_ranges; }
+    
+    [[nodiscard]] const std::vector<Lod> &lods() const noexcept { return _lods; }
+    
+    [[nodiscard]] bool animated(size_t mesh) const noexcept { return _mesh_transform_slots[mesh] != 0u; }
+    [[nodiscard]] const glm::mat4 &mesh_transform(size_t mesh) const noexcept { return _transforms[_mesh_transform_slots[mesh]]; }
+    [[nodiscard]] AABB mesh_bounds(size_t mesh) const noexcept;            // at the current transform
+    [[nodiscard]] AABB draw_range_bounds(uint32_t index) const noexcept;  // at the current transform
+    
+    // moves an animated mesh, relative to where the scene placed it; sent to OpenGL by upload_transforms()
+    void set_mesh_transform(size_t mesh, const glm::mat4 &transform);
+    void upload_transforms();
+    
+    [[nodiscard]] uint32_t transform_slot(size_t mesh) const noexcept { return _mesh_transform_slots[mesh]; }
+    [[nodiscard]] int32_t vertex_frame_offset(size_t mesh) const noexcept { return _mesh_vertex_frame_offsets[mesh]; }
+    [[nodiscard]] uint32_t vertex_frame_texture(size_t index) const noexcept { return _vertex_frame_textures[index]; }
+    [[nodiscard]] uint32_t vertex_track_texture() const noexcept { return _vertex_track_texture; }
+    
+    // grows the rest bounds of the draw ranges of a vertex-animated mesh by the largest displacements of its frames
+    void expand_mesh_bounds(size_t mesh, glm::vec3 min_displacement, glm::vec3 max_displacement);
+    
+    // collects the meshlets intersecting the frustum of view_projection into list, or the coarsest levels of detail
+    // of their draw ranges whose projected error is small enough
+    void cull(const glm::mat4 &view_projection, DrawList &list, const CullSettings &settings) const;
+    void cull(const glm::mat4 &view_projection, DrawList &list) const { cull(view_projection, list, CullSettings{}); }
+    
+    // replaces the contents of list with a single draw range at full detail
+    void list_draw_range(uint32_t index, DrawList &list) const;
+    
     void render(const Shader &shader) const;
+    void render(const Shader &shader, const DrawList &list) const;
+    void render_opaque(const Shader &shader) const;
+    void render_alpha_tested(const Shader &shader) const;
     void shadow(const Shader &shader) const;
     
+    // adds the lightmap coordinates of every triangle corner, in the order of the flattened streams, as attribute 6
+    void set_lightmap_coords(const std::vector<glm::vec2> &coords);
+    
+    // Lays down depth without touching color: opaque triangles from the position-only stream with opaque_shader,
+    // alpha-tested ones from the full stream with alpha_tested_shader so that it can discard. Used for the depth
+    // pre-pass, after which a pass with glDepthFunc(GL_EQUAL) and depth writes off keeps early-Z and shades each
+    // pixel about once, and for the shadow maps.
+    void render_depth(const Shader &opaque_shader, const Shader &alpha_tested_shader) const;
+    void render_depth(const Shader &opaque_shader, const Shader &alpha_tested_shader, const DrawList &list) const;
+    
 };
 
 #endif //LEARNOPENGL_SCENE_H
@@ -9,76 +9,146 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <regex>
+#include <vector>
+#include <algorithm>
 #include <string_view>
+#include <unordered_map>
 
 #include <glsl/glsl_optimizer.h>
 #include <core/serialize.h>
+#include <core/shader_preprocessor.h>
 
 class Shader {
 public:
     
-    using TemplateList = std::map<std::string, std::string>;
+    using TemplateList = ShaderPreprocessor::TemplateList;
+    using DefineList = ShaderPreprocessor::DefineList;
+    
+    struct Source {
+        std::string vertex;
+        std::string fragment;
+        std::string geometry;
+        std::vector<std::string> dependencies;
+    };
     
     unsigned int ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    Shader(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = {}, const TemplateList &tl = {}) {
-        
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        
-        vertexCode = optimizeShaderSource(readSourceFile(vertexPath, tl), kGlslOptShaderVertex);
-        fragmentCode = optimizeShaderSource(readSourceFile(fragmentPath, tl), kGlslOptShaderFragment);
-        
+    Shader(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = {}, const TemplateList &tl = {}, const DefineList &dl = {})
+        : ID{0}, vertexPath{vertexPath}, fragmentPath{fragmentPath}, geometryPath{geometryPath}, templates{tl}, defines{dl} {
+        if (!rebuild(preprocess())) {
+            std::cerr << "Failed to build shader program: " << vertexPath << ", " << fragmentPath << std::endl;
+        }
+    }
+    
+    ~Shader() noexcept {
+        glDeleteProgram(ID);
+    }
+    
+    Shader(const Shader &) = delete;
+    Shader &operator=(const Shader &) = delete;
+    
+    // read, expand and optimize the sources without touching OpenGL, so that it can run on any thread
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Source preprocess() const {
+        Source source;
+        auto addDependencies = [&source](const std::vector<std::string> &files) {
+            for (auto &&file : files) {
+                if (std::find(source.dependencies.cbegin(), source.dependencies.cend(), file) == source.dependencies.cend()) {
+                    source.dependencies.emplace_back(file);
+                }
+            }
+        };
+        auto vertex = ShaderPreprocessor::process(vertexPath, templates, defines);
+        auto fragment = ShaderPreprocessor::process(fragmentPath, templates, defines);
+        source.vertex = optimizeShaderSource(std::move(vertex.source), kGlslOptShaderVertex, variantKey(vertexPath));
+        source.fragment = optimizeShaderSource(std::move(fragment.source), kGlslOptShaderFragment, variantKey(fragmentPath));
+        addDependencies(vertex.dependencies);
+        addDependencies(fragment.dependencies);
         // if geometry shader path is present, also load a geometry shader
         if (!geometryPath.empty()) {
-            geometryCode = readSourceFile(geometryPath, tl);
+            auto geometry = ShaderPreprocessor::process(geometryPath, templates, defines);
+            source.geometry = std::move(geometry.source);
+            addDependencies(geometry.dependencies);
+        }
+        return source;
+    }
+    
+    // compile and link the sources on the GL thread; on failure the previous program is kept
+    // ------------------------------------------------------------------------
+    bool rebuild(const Source &source) {
+        
+        if (source.vertex.empty() || source.fragment.empty()) {
+            return false;
         }
         
-        const char *vShaderCode = vertexCode.c_str();
-        const char *fShaderCode = fragmentCode.c_str();
+        const char *vShaderCode = source.vertex.c_str();
+        const char *fShaderCode = source.fragment.c_str();
         // 2. compile shaders
         unsigned int vertex, fragment;
+        auto success = true;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        success &= checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        success &= checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
         unsigned int geometry;
-        if (!geometryPath.empty()) {
-            const char *gShaderCode = geometryCode.c_str();
+        if (!source.geometry.empty()) {
+            const char *gShaderCode = source.geometry.c_str();
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            success &= checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (!geometryPath.empty())
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
+        auto program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        if (!source.geometry.empty())
+            glAttachShader(program, geometry);
+        glLinkProgram(program);
+        success &= checkCompileErrors(program, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if (!geometryPath.empty())
+        if (!source.geometry.empty())
             glDeleteShader(geometry);
         
+        if (!success) {
+            glDeleteProgram(program);
+            return false;
+        }
+        glDeleteProgram(ID);
+        ID = program;
+        dependencies = source.dependencies;
+        return true;
     }
+    
+    // files the program is built from, including everything they #include,
+    // used to decide whether a change on disk affects it
+    // ------------------------------------------------------------------------
+    [[nodiscard]] std::vector<std::string> sourceFiles() const {
+        if (!dependencies.empty()) {
+            return dependencies;
+        }
+        std::vector<std::string> files{ShaderPreprocessor::normalize_path(vertexPath), ShaderPreprocessor::normalize_path(fragmentPath)};
+        if (!geometryPath.empty()) {
+            files.emplace_back(ShaderPreprocessor::normalize_path(geometryPath));
+        }
+        return files;
+    }
+    
     // activate the shader
     // ------------------------------------------------------------------------
-    void use() {
+    void use() const {
         glUseProgram(ID);
     }
     // utility uniform functions
@@ -112,7 +182,7 @@ public:
     void setVec4(const std::string &name, const glm::vec4 &value) const {
         glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) {
+    void setVec4(const std::string &name, float x, float y, float z, float w) const {
         glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
     }
     // ------------------------------------------------------------------------
@@ -130,6 +200,13 @@ public:
 
 private:
     
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string geometryPath;
+    TemplateList templates;
+    DefineList defines;
+    std::vector<std::string> dependencies;
+    
     static std::string replaceVersionString(std::string &src, std::string_view replacement) {
         static std::regex version_string_finder{R"(#version\s+\d{3}\s+(core|es)?)", std::regex::optimize | std::regex::ECMAScript};
         std::smatch match_result{};
@@ -144,7 +221,31 @@ private:
         return version_string;
     }
     
-    static std::string optimizeShaderSource(std::string src, glslopt_shader_type shader_type) {
+    // the source path with the templates and defines it is expanded with, one optimizer cache entry each
+    [[nodiscard]] std::string variantKey(const std::string &path) const {
+        auto key = path;
+        for (auto list : {&templates, &defines}) {
+            key.append("\n");
+            for (auto &&item : *list) { key.append(item.first).append("=").append(item.second).append(";"); }
+        }
+        return key;
+    }
+    
+    static std::string optimizeShaderSource(std::string src, glslopt_shader_type shader_type, const std::string &variant) {
+        
+        // the optimizer context is shared and not thread-safe, while sources may be reloaded in the background
+        static std::mutex optimizer_mutex;
+        std::lock_guard lock{optimizer_mutex};
+        
+        // stages whose expanded source did not change (e.g. the vertex stage when only a fragment include
+        // was edited) reuse the previous optimizer output; each stage and variant keeps only its latest entry,
+        // replaced on reload, so the cache does not grow with every edit
+        static std::unordered_map<std::string, std::pair<std::string, std::string>> optimized_sources[2];
+        auto &&cache = optimized_sources[shader_type == kGlslOptShaderVertex ? 0 : 1];
+        if (auto iter = cache.find(variant); iter != cache.end() && iter->second.first == src) {
+            return iter->second.second;
+        }
+        auto expanded = src;
         
         auto version_string = replaceVersionString(src, "#version 300 es");
         
@@ -159,57 +260,13 @@ private:
         }
         src = glslopt_get_output(shader.get());
         replaceVersionString(src, version_string);
+        cache[variant] = {std::move(expanded), src};
         return src;
     }
     
-    static std::string readSourceFile(const std::string &path, const TemplateList &tl) {
-        
-        std::ifstream file{path};
-        
-        if (!file.is_open()) {
-            std::cerr << "Failed to read file: " << path << std::endl;
-            return {};
-        }
-        
-        std::string source;
-        std::string templ;
-        std::string line;
-        while (!file.eof()) {
-            auto c = file.get();
-            if (c == '$') {  // begin of template
-                if (file.get() != '{') {
-                    std::cerr << "Expected '{' in shader template: " << path << std::endl;
-                    return {};
-                }
-                templ.clear();
-                while (!file.eof()) {
-                    templ.push_back(file.get());
-                    if (templ.back() == '}') {
-                        break;
-                    }
-                }
-                if (templ.back() != '}') {
-                    std::cerr << "Expected '}' in shader template: " << path << std::endl;
-                    return {};
-                }
-                templ.pop_back();
-                auto iter = tl.find(templ);
-                if (iter == tl.end()) {
-                    std::cerr << "Unknown template name '" << templ << "': " << path << std::endl;
-                    return {};
-                }
-                source.append(iter->second);
-            } else if (c != EOF) {
-                source.push_back(c);
-            }
-        }
-        
-        return source;
-    }
-    
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    static void checkCompileErrors(GLuint shader, const std::string &type) {
+    static bool checkCompileErrors(GLuint shader, const std::string &type) {
         GLint success;
         GLchar infoLog[1024];
         if (type != "PROGRAM") {
@@ -225,6 +282,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
 #endif
\ No newline at end of file
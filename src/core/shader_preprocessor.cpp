@@ -0,0 +1,211 @@
+//
+// Created by Mike Smith on 2019/10/13.
+//
+
+#include <algorithm>
+#include <fstream>
+
+#include "serialize.h"
+#include "shader_preprocessor.h"
+
+std::mutex ShaderPreprocessor::_cache_mutex;
+std::unordered_map<std::string, std::shared_ptr<const ShaderPreprocessor::ParsedFile>> ShaderPreprocessor::_cache;
+
+namespace {
+
+std::string_view trim(std::string_view s) noexcept {
+    auto first = s.find_first_not_of(" \t");
+    if (first == std::string_view::npos) { return {}; }
+    auto last = s.find_last_not_of(" \t");
+    return s.substr(first, last - first + 1);
+}
+
+// splits "#  name rest" into {"name", "rest"}, or returns an empty name if the line is not a directive
+std::pair<std::string_view, std::string_view> split_directive(std::string_view line) noexcept {
+    line = trim(line);
+    if (line.empty() || line.front() != '#') { return {}; }
+    line = trim(line.substr(1));
+    auto name_end = std::min(line.find_first_of(" \t"), line.size());
+    return {line.substr(0, name_end), trim(line.substr(name_end))};
+}
+
+}
+
+std::string ShaderPreprocessor::normalize_path(const std::string &path) {
+    std::error_code error;
+    auto normalized = std::filesystem::weakly_canonical(path, error);
+    return error ? path : normalized.string();
+}
+
+std::shared_ptr<const ShaderPreprocessor::ParsedFile> ShaderPreprocessor::_parse(const std::string &path, std::filesystem::file_time_type timestamp) {
+
+    std::ifstream file{path};
+    if (!file.is_open()) {
+        throw std::runtime_error{serialize("Failed to read shader file: ", path)};
+    }
+
+    auto parsed = std::make_shared<ParsedFile>();
+    parsed->timestamp = timestamp;
+
+    auto &&segments = parsed->segments;
+    auto append_text = [&](std::string_view text, size_t line_number) {
+        if (!segments.empty() && segments.back().tag == Segment::Tag::TEXT) {
+            segments.back().value.append(text);
+        } else {
+            segments.emplace_back(Segment{Segment::Tag::TEXT, std::string{text}, line_number});
+        }
+    };
+
+    std::string line;
+    auto line_number = 0ul;
+    auto seen_code = false;
+    std::string guard_candidate;  // used to detect a classic #ifndef/#define include guard
+
+    while (std::getline(file, line)) {
+
+        line_number++;
+        if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+
+        auto[directive, argument] = split_directive(line);
+        if (directive == "version") {
+            segments.emplace_back(Segment{Segment::Tag::VERSION, line, line_number});
+            continue;
+        }
+        if (directive == "include") {
+            if (argument.size() < 2 ||
+                !((argument.front() == '"' && argument.back() == '"') || (argument.front() == '<' && argument.back() == '>'))) {
+                throw std::runtime_error{serialize("Malformed #include directive at ", path, ":", line_number)};
+            }
+            segments.emplace_back(Segment{Segment::Tag::INCLUDE, std::string{argument.substr(1, argument.size() - 2)}, line_number});
+            seen_code = true;
+            continue;
+        }
+        if (directive == "pragma" && argument == "once") {
+            parsed->guard = path;
+            append_text("\n", line_number);  // keep line numbers intact
+            continue;
+        }
+
+        // a file whose first two directives are "#ifndef X" and "#define X" is guarded by X
+        if (!seen_code && parsed->guard.empty()) {
+            if (directive == "ifndef" && guard_candidate.empty()) {
+                guard_candidate = argument;
+            } else if (directive == "define" && !guard_candidate.empty() && trim(argument) == guard_candidate) {
+                parsed->guard = guard_candidate;
+            } else if (!trim(line).empty() && trim(line).substr(0, 2) != "//") {
+                seen_code = true;
+            }
+        }
+
+        // split the line into text and ${NAME} template references
+        std::string_view rest{line};
+        while (true) {
+            auto begin = rest.find("${");
+            if (begin == std::string_view::npos) {
+                append_text(rest, line_number);
+                break;
+            }
+            auto end = rest.find('}', begin);
+            if (end == std::string_view::npos) {
+                throw std::runtime_error{serialize("Expected '}' in shader template at ", path, ":", line_number)};
+            }
+            append_text(rest.substr(0, begin), line_number);
+            segments.emplace_back(Segment{Segment::Tag::TEMPLATE, std::string{trim(rest.substr(begin + 2, end - begin - 2))}, line_number});
+            rest = rest.substr(end + 1);
+        }
+        append_text("\n", line_number);
+    }
+    return parsed;
+}
+
+std::shared_ptr<const ShaderPreprocessor::ParsedFile> ShaderPreprocessor::_load(const std::string &path) {
+
+    std::error_code error;
+    auto timestamp = std::filesystem::last_write_time(path, error);
+    if (error) {
+        throw std::runtime_error{serialize("Failed to read shader file: ", path)};
+    }
+
+    std::lock_guard lock{_cache_mutex};
+    if (auto iter = _cache.find(path); iter != _cache.end() && iter->second->timestamp == timestamp) {
+        return iter->second;
+    }
+    auto parsed = _parse(path, timestamp);
+    _cache[path] = parsed;
+    return parsed;
+}
+
+void ShaderPreprocessor::_expand(Context &ctx, const std::string &path) {
+
+    if (std::find(ctx.include_stack.cbegin(), ctx.include_stack.cend(), path) != ctx.include_stack.cend()) {
+        throw std::runtime_error{serialize("Recursive #include of shader file: ", path)};
+    }
+
+    auto file = _load(path);
+    if (!file->guard.empty() && !ctx.expanded_guards.emplace(file->guard).second) {
+        return;
+    }
+
+    auto &&dependencies = ctx.result.dependencies;
+    auto dep_iter = std::find(dependencies.cbegin(), dependencies.cend(), path);
+    auto file_index = static_cast<size_t>(dep_iter - dependencies.cbegin());
+    if (dep_iter == dependencies.cend()) {
+        dependencies.emplace_back(path);
+    }
+
+    auto is_root = ctx.include_stack.empty();
+    ctx.include_stack.emplace_back(path);
+
+    auto &&source = ctx.result.source;
+    if (!is_root) {
+        source.append(serialize("#line 1 ", file_index, "\n"));
+    }
+
+    auto directory = std::filesystem::path{path}.parent_path();
+    for (auto &&segment : file->segments) {
+        switch (segment.tag) {
+            case Segment::Tag::TEXT:
+                source.append(segment.value);
+                break;
+            case Segment::Tag::TEMPLATE: {
+                auto iter = ctx.templates.find(segment.value);
+                if (iter == ctx.templates.end()) {
+                    throw std::runtime_error{serialize("Unknown template name '", segment.value, "' at ", path, ":", segment.line)};
+                }
+                source.append(iter->second);
+                break;
+            }
+            case Segment::Tag::VERSION:
+                if (!is_root) {
+                    throw std::runtime_error{serialize("Unexpected #version in included file ", path, ":", segment.line)};
+                }
+                source.append(segment.value).append("\n");
+                for (auto &&define : ctx.defines) {
+                    source.append(serialize("#define ", define.first, " ", define.second, "\n"));
+                }
+                source.append(serialize("#line ", segment.line + 1, " ", file_index, "\n"));
+                break;
+            case Segment::Tag::INCLUDE: {
+                auto include_path = normalize_path((directory / segment.value).string());
+                if (!std::filesystem::exists(include_path)) {
+                    throw std::runtime_error{serialize("Failed to resolve #include \"", segment.value, "\" at ", path, ":", segment.line)};
+                }
+                _expand(ctx, include_path);
+                source.append(serialize("#line ", segment.line + 1, " ", file_index, "\n"));
+                break;
+            }
+        }
+    }
+    ctx.include_stack.pop_back();
+}
+
+ShaderPreprocessor::Result ShaderPreprocessor::process(const std::string &path, const TemplateList &templates, const DefineList &defines) {
+    Context ctx{templates, defines, {}, {}, {}};
+    _expand(ctx, normalize_path(path));
+    return std::move(ctx.result);
+}
+
+void ShaderPreprocessor::invalidate(const std::string &path) {
+    std::lock_guard lock{_cache_mutex};
+    _cache.erase(normalize_path(path));
+}
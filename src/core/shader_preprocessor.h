@@ -0,0 +1,71 @@
+//
+// Created by Mike Smith on 2019/10/13.
+//
+
+#ifndef LEARNOPENGL_SHADER_PREPROCESSOR_H
+#define LEARNOPENGL_SHADER_PREPROCESSOR_H
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Expands shader sources before they are handed to the optimizer:
+//   - #include "file" is resolved relative to the including file; files guarded by #pragma once or by a
+//     classic #ifndef/#define/#endif guard are expanded only once per program;
+//   - ${NAME} is substituted from the template list, unknown names are errors;
+//   - every entry in the define list is injected as #define right after the #version directive.
+// Parsed files are memoized process-wide and revalidated against their modification time, so sharing an
+// include between many programs costs a single read. Errors are reported by throwing std::runtime_error.
+class ShaderPreprocessor {
+
+public:
+    using TemplateList = std::map<std::string, std::string>;
+    using DefineList = std::map<std::string, std::string>;
+
+    struct Result {
+        std::string source;
+        std::vector<std::string> dependencies;  // normalized paths of every file read, the root file first
+    };
+
+private:
+    struct Segment {
+        enum struct Tag { TEXT, TEMPLATE, INCLUDE, VERSION };
+        Tag tag;
+        std::string value;
+        size_t line;
+    };
+
+    struct ParsedFile {
+        std::filesystem::file_time_type timestamp;
+        std::string guard;
+        std::vector<Segment> segments;
+    };
+
+    struct Context {
+        const TemplateList &templates;
+        const DefineList &defines;
+        Result result;
+        std::unordered_set<std::string> expanded_guards;
+        std::vector<std::string> include_stack;
+    };
+
+    static std::mutex _cache_mutex;
+    static std::unordered_map<std::string, std::shared_ptr<const ParsedFile>> _cache;
+
+    [[nodiscard]] static std::shared_ptr<const ParsedFile> _load(const std::string &path);
+    [[nodiscard]] static std::shared_ptr<const ParsedFile> _parse(const std::string &path, std::filesystem::file_time_type timestamp);
+    static void _expand(Context &ctx, const std::string &path);
+
+public:
+    [[nodiscard]] static std::string normalize_path(const std::string &path);
+    [[nodiscard]] static Result process(const std::string &path, const TemplateList &templates = {}, const DefineList &defines = {});
+    static void invalidate(const std::string &path);
+
+};
+
+#endif //LEARNOPENGL_SHADER_PREPROCESSOR_H
@@ -0,0 +1,187 @@
+//
+// Created by Mike Smith on 2019/10/12.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "serialize.h"
+#include "shader_watcher.h"
+
+ShaderWatcher::ShaderWatcher(std::string directory)
+    : _directory{ShaderPreprocessor::normalize_path(directory)} {
+    _thread = std::thread{[this] { _watch_loop(); }};
+}
+
+ShaderWatcher::~ShaderWatcher() noexcept {
+    _should_stop = true;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void ShaderWatcher::watch(Shader &shader) {
+    std::lock_guard lock{_entry_mutex};
+    _entries.emplace_back(Entry{&shader, shader.sourceFiles()});
+}
+
+size_t ShaderWatcher::update() {
+
+    std::vector<Pending> pending;
+    {
+        std::lock_guard lock{_pending_mutex};
+        pending.swap(_pending);
+    }
+
+    auto count = 0ul;
+    for (auto &&item : pending) {
+        if (item.shader->rebuild(item.source)) {
+            std::cout << "Reloaded shader program #" << item.shader->ID << std::endl;
+            count++;
+        } else {
+            std::cerr << "Failed to compile reloaded shader, keeping the previous program" << std::endl;
+        }
+    }
+    return count;
+}
+
+void ShaderWatcher::_process_changes(const std::vector<std::string> &changed_files) {
+
+    std::vector<Shader *> affected;
+    {
+        std::lock_guard lock{_entry_mutex};
+        for (auto &&entry : _entries) {
+            if (std::any_of(entry.files.cbegin(), entry.files.cend(), [&](const std::string &file) {
+                return std::find(changed_files.cbegin(), changed_files.cend(), file) != changed_files.cend();
+            })) {
+                affected.emplace_back(entry.shader);
+            }
+        }
+    }
+
+    for (auto shader : affected) {
+        try {
+            auto source = shader->preprocess();
+            {
+                // the #include graph may have changed with the edit
+                std::lock_guard lock{_entry_mutex};
+                for (auto &&entry : _entries) {
+                    if (entry.shader == shader) {
+                        entry.files = source.dependencies;
+                    }
+                }
+            }
+            std::lock_guard lock{_pending_mutex};
+            // a newer version of the same program supersedes the one still waiting for the next frame
+            auto iter = std::find_if(_pending.begin(), _pending.end(), [shader](const Pending &p) { return p.shader == shader; });
+            if (iter == _pending.end()) {
+                _pending.emplace_back(Pending{shader, std::move(source)});
+            } else {
+                iter->source = std::move(source);
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to reload shader: " << e.what() << std::endl;
+        }
+    }
+}
+
+#ifdef __linux__
+
+void ShaderWatcher::_watch_loop() {
+
+    auto fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to initialize inotify, shader hot reload disabled" << std::endl;
+        return;
+    }
+    // editors either write in place or save to a temporary file and rename it over the original
+    if (inotify_add_watch(fd, _directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cerr << "Failed to watch shader directory: " << _directory << std::endl;
+        close(fd);
+        return;
+    }
+    std::cout << "Watching shader directory: " << _directory << std::endl;
+
+    alignas(inotify_event) char buffer[4096];
+    std::vector<std::string> changed_files;
+
+    auto drain = [&] {
+        while (true) {
+            auto size = read(fd, buffer, sizeof(buffer));
+            if (size <= 0) { break; }
+            for (auto p = buffer; p < buffer + size;) {
+                auto event = reinterpret_cast<const inotify_event *>(p);
+                if (event->len != 0) {
+                    auto file = ShaderPreprocessor::normalize_path(serialize(_directory, "/", event->name));
+                    if (std::find(changed_files.cbegin(), changed_files.cend(), file) == changed_files.cend()) {
+                        changed_files.emplace_back(std::move(file));
+                    }
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    };
+
+    while (!_should_stop) {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0 || !(pfd.revents & POLLIN)) {
+            continue;
+        }
+        // saving usually produces a burst of events, so wait a little and coalesce them into a single rebuild
+        drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        drain();
+        _process_changes(changed_files);
+        changed_files.clear();
+    }
+    close(fd);
+}
+
+#else
+
+void ShaderWatcher::_watch_loop() {
+
+    // no inotify available, fall back to polling the modification times of the registered files
+    std::unordered_map<std::string, std::filesystem::file_time_type> timestamps;
+    auto last_write_time = [](const std::string &file) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(file, error);
+        return error ? std::filesystem::file_time_type{} : time;
+    };
+
+    while (!_should_stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{250});
+        std::vector<std::string> files;
+        {
+            std::lock_guard lock{_entry_mutex};
+            for (auto &&entry : _entries) {
+                files.insert(files.end(), entry.files.cbegin(), entry.files.cend());
+            }
+        }
+        std::vector<std::string> changed_files;
+        for (auto &&file : files) {
+            auto time = last_write_time(file);
+            auto iter = timestamps.find(file);
+            if (iter == timestamps.end()) {
+                timestamps.emplace(file, time);
+            } else if (iter->second != time) {
+                iter->second = time;
+                changed_files.emplace_back(file);
+            }
+        }
+        if (!changed_files.empty()) {
+            _process_changes(changed_files);
+        }
+    }
+}
+
+#endif
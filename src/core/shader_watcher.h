@@ -0,0 +1,54 @@
+//
+// Created by Mike Smith on 2019/10/12.
+//
+
+#ifndef LEARNOPENGL_SHADER_WATCHER_H
+#define LEARNOPENGL_SHADER_WATCHER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shader.h"
+
+// Watches the shader directory and rebuilds the registered programs whenever one of their source files changes.
+// Reading, expanding and optimizing the sources happens on a background thread; the new programs are compiled
+// and swapped in on the GL thread by update(), which should be called once at the beginning of every frame.
+class ShaderWatcher {
+
+private:
+    struct Entry {
+        Shader *shader;
+        std::vector<std::string> files;
+    };
+
+    struct Pending {
+        Shader *shader;
+        Shader::Source source;
+    };
+
+    std::string _directory;
+    std::vector<Entry> _entries;
+    std::vector<Pending> _pending;
+    std::mutex _entry_mutex;
+    std::mutex _pending_mutex;
+    std::atomic<bool> _should_stop{false};
+    std::thread _thread;
+
+    void _watch_loop();
+    void _process_changes(const std::vector<std::string> &changed_files);
+
+public:
+    explicit ShaderWatcher(std::string directory);
+    ~ShaderWatcher() noexcept;
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+    void watch(Shader &shader);
+    size_t update();
+
+};
+
+#endif //LEARNOPENGL_SHADER_WATCHER_H
@@ -0,0 +1,272 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "util.h"
+#include "serialize.h"
+#include "shadow_atlas.h"
+
+namespace {
+
+constexpr auto invalid_light = std::numeric_limits<uint32_t>::max();
+
+// forward and up directions of the cube faces, must match SHADOW_FACE_FORWARDS and SHADOW_FACE_UPS in shadows.glsl
+const glm::vec3 face_forwards[ShadowAtlas::face_count]{
+    {1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+const glm::vec3 face_ups[ShadowAtlas::face_count]{
+    {0.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}};
+
+}
+
+ShadowAtlas ShadowAtlas::create(uint32_t size, uint32_t tile_size) {
+
+    if (tile_size <= 2u * tile_border || size < tile_size) {
+        throw std::runtime_error{serialize("Invalid shadow atlas size: ", size, ", tile size: ", tile_size)};
+    }
+
+    ShadowAtlas atlas;
+    atlas._size = size;
+    atlas._tile_size = tile_size;
+    atlas._tiles_per_row = size / tile_size;
+    atlas._slots.resize(atlas._tiles_per_row * atlas._tiles_per_row / face_count);
+    for (auto &&slot : atlas._slots) {
+        slot.light = invalid_light;
+    }
+
+    uint32_t textures[2];
+    glGenTextures(2, textures);
+    atlas._depth_texture = textures[0];
+    atlas._light_slot_texture = textures[1];
+
+    glBindTexture(GL_TEXTURE_2D, atlas._depth_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &atlas._framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, atlas._framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atlas._depth_texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error{serialize("Shadow atlas framebuffer not complete, status: ", status)};
+    }
+
+    std::cout << "Created shadow atlas for " << atlas.capacity() << " lights" << std::endl;
+    return atlas;
+}
+
+ShadowAtlas::~ShadowAtlas() {
+    glDeleteFramebuffers(1, &_framebuffer);
+    glDeleteTextures(1, &_depth_texture);
+    glDeleteTextures(1, &_light_slot_texture);
+}
+
+float ShadowAtlas::_face_scale() const noexcept {
+    return static_cast<float>(_tile_size - 2u * tile_border) / static_cast<float>(_tile_size);
+}
+
+void ShadowAtlas::_assign_slots(const LightBuffer &lights) {
+
+    // the assignment only depends on the ranges, so it is kept as long as none of the changed lights got a new one
+    auto count = lights.count();
+    auto &&emissions = lights.emissions();
+    auto ranges_changed = _ranked_ranges.size() != count;
+    for (auto i = 0ul; !ranges_changed && i < lights.changed_lights().size(); i++) {
+        auto light = lights.changed_lights()[i];
+        ranges_changed = _ranked_ranges[light] != emissions[light].w;
+    }
+    if (!ranges_changed) {
+        return;
+    }
+    _ranked_ranges.resize(count);
+    for (auto i = 0ul; i < count; i++) {
+        _ranked_ranges[i] = emissions[i].w;
+    }
+
+    // the lights with the largest ranges get shadows
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    auto shadowed_count = std::min(_slots.size(), static_cast<size_t>(std::count_if(
+        _ranked_ranges.cbegin(), _ranked_ranges.cend(), [](float range) { return range > 0.0f; })));
+    std::partial_sort(order.begin(), order.begin() + shadowed_count, order.end(), [this](uint32_t lhs, uint32_t rhs) {
+        return _ranked_ranges[lhs] > _ranked_ranges[rhs] || (_ranked_ranges[lhs] == _ranked_ranges[rhs] && lhs < rhs);
+    });
+    std::vector<bool> selected(count, false);
+    for (auto i = 0ul; i < shadowed_count; i++) {
+        selected[order[i]] = true;
+    }
+
+    // lights that stay selected keep their tiles, the others are released and handed out to the new lights
+    _light_slots.assign(count, -1);
+    std::vector<size_t> free_slots;
+    for (auto s = 0ul; s < _slots.size(); s++) {
+        auto &&slot = _slots[s];
+        if (slot.light < count && selected[slot.light]) {
+            _light_slots[slot.light] = static_cast<int32_t>(s * face_count);
+            selected[slot.light] = false;
+        } else {
+            slot.light = invalid_light;
+            free_slots.emplace_back(s);
+        }
+    }
+    for (auto i = 0ul; i < shadowed_count; i++) {
+        if (auto light = order[i]; selected[light]) {
+            auto s = free_slots.back();
+            free_slots.pop_back();
+            _slots[s].light = light;
+            _slots[s].dirty = true;
+            _light_slots[light] = static_cast<int32_t>(s * face_count);
+        }
+    }
+    _light_slots_dirty = true;
+}
+
+void ShadowAtlas::_upload_light_slots() {
+
+    constexpr auto width = LightBuffer::texture_width;
+    glBindTexture(GL_TEXTURE_2D, _light_slot_texture);
+    if (_light_slots.size() > _light_slot_capacity || _light_slot_capacity == 0) {
+        _light_slot_capacity = std::max<size_t>(util::next_power_of_two(_light_slots.size()), width);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, width, static_cast<int32_t>(_light_slot_capacity / width), 0, GL_RED_INTEGER, GL_INT, nullptr);
+    }
+    auto full_rows = static_cast<int32_t>(_light_slots.size() / width);
+    auto remainder = static_cast<int32_t>(_light_slots.size() % width);
+    if (full_rows != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, full_rows, GL_RED_INTEGER, GL_INT, _light_slots.data());
+    }
+    if (remainder != 0) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, full_rows, remainder, 1, GL_RED_INTEGER, GL_INT, _light_slots.data() + full_rows * width);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    _light_slots_dirty = false;
+}
+
+void ShadowAtlas::_render_slot(size_t slot_index, const Geometry &geometry, const Shader &opaque_shader, const Shader &alpha_tested_shader) const {
+
+    auto &&slot = _slots[slot_index];
+    auto position = glm::vec3{slot.position};
+    auto range = slot.position.w;
+    auto projection = glm::perspective(2.0f * std::atan(1.0f / _face_scale()), 1.0f, range * near_ratio, range);
+
+    Geometry::DrawList draw_list;
+    for (auto face = 0u; face < face_count; face++) {
+        auto tile = static_cast<uint32_t>(slot_index * face_count + face);
+        auto x = static_cast<int32_t>(tile % _tiles_per_row * _tile_size);
+        auto y = static_cast<int32_t>(tile / _tiles_per_row * _tile_size);
+        glViewport(x, y, _tile_size, _tile_size);
+        glScissor(x, y, _tile_size, _tile_size);
+        glDepthMask(GL_TRUE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        auto view = glm::lookAt(position, position + face_forwards[face], face_ups[face]);
+        for (auto shader : {&opaque_shader, &alpha_tested_shader}) {
+            shader->use();
+            shader->setMat4("projection", projection);
+            shader->setMat4("view", view);
+        }
+        geometry.cull(projection * view, draw_list);
+        geometry.render_depth(opaque_shader, alpha_tested_shader, draw_list);
+    }
+}
+
+void ShadowAtlas::invalidate(const Geometry::AABB &bounds) noexcept {
+    for (auto &&slot : _slots) {
+        auto center = glm::vec3{slot.position};
+        auto d = center - glm::clamp(center, bounds.min, bounds.max);
+        if (slot.light != invalid_light && glm::dot(d, d) <= slot.position.w * slot.position.w) {
+            slot.dirty = true;
+        }
+    }
+}
+
+void ShadowAtlas::invalidate() noexcept {
+    for (auto &&slot : _slots) {
+        slot.dirty = true;
+    }
+}
+
+size_t ShadowAtlas::update(const LightBuffer &lights, const Geometry &geometry, const Shader &opaque_shader, const Shader &alpha_tested_shader) {
+
+    _assign_slots(lights);
+    if (_light_slots_dirty) {
+        _upload_light_slots();
+    }
+
+    // only the lights changed by the last upload can have moved
+    auto &&positions = lights.positions();
+    auto &&emissions = lights.emissions();
+    auto light_position = [&](uint32_t light) { return glm::vec4{glm::vec3{positions[light]}, emissions[light].w}; };
+    for (auto light : lights.changed_lights()) {
+        if (auto tile = _light_slots[light]; tile >= 0) {
+            auto &&slot = _slots[tile / face_count];
+            slot.dirty = slot.dirty || light_position(light) != slot.position;
+        }
+    }
+    std::vector<size_t> dirty_slots;
+    for (auto s = 0ul; s < _slots.size(); s++) {
+        if (auto &&slot = _slots[s]; slot.light != invalid_light && slot.dirty) {
+            slot.position = light_position(slot.light);
+            slot.dirty = false;
+            dirty_slots.emplace_back(s);
+        }
+    }
+    if (dirty_slots.empty()) {
+        return 0;
+    }
+
+    int32_t viewport[4];
+    int32_t framebuffer = 0;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+
+    // walls are often single-sided, so both faces cast shadows and a slope-scaled offset fights acne instead
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 2.0f);
+    for (auto s : dirty_slots) {
+        _render_slot(s, geometry, opaque_shader, alpha_tested_shader);
+    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+    glEnable(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    return dirty_slots.size();
+}
+
+void ShadowAtlas::bind(const Shader &shader, uint32_t first_texture_unit) const {
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _depth_texture);
+    shader.setInt("shadowAtlas", first_texture_unit);
+    glActiveTexture(GL_TEXTURE0 + first_texture_unit + 1);
+    glBindTexture(GL_TEXTURE_2D, _light_slot_texture);
+    shader.setInt("lightShadowSlots", first_texture_unit + 1);
+    shader.setVec4("shadowParams", static_cast<float>(_tiles_per_row), static_cast<float>(_tile_size) / static_cast<float>(_size),
+                   _face_scale(), static_cast<float>(_tile_size));
+    shader.setFloat("shadowNearRatio", near_ratio);
+    glActiveTexture(GL_TEXTURE0);
+}
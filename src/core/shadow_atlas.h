@@ -0,0 +1,76 @@
+//
+// Created by Mike Smith on 2019/10/16.
+//
+
+#ifndef LEARNOPENGL_SHADOW_ATLAS_H
+#define LEARNOPENGL_SHADOW_ATLAS_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "shader.h"
+#include "light_buffer.h"
+
+// Omnidirectional point-light shadows in a single 2D depth atlas. Every shadowed light owns six square tiles, one
+// per cube face, rendered with a slightly widened 90-degree frustum so that filtering never crosses into the
+// neighbouring tile, and sampled with hardware comparison through sampler2DShadow (cube map arrays are not
+// available to the GLSL ES 3.0 front-end). The lights with the largest influence ranges get the tiles. A light's
+// faces are only re-rendered when LightBuffer reports it changed and its position or range differs, or when the
+// geometry inside its range has been invalidated, so static scenes pay for their shadows once.
+class ShadowAtlas {
+
+public:
+    static constexpr auto face_count = 6u;
+    static constexpr auto near_ratio = 1e-3f;  // near plane of the shadow frusta relative to the light range
+    static constexpr auto tile_border = 2u;    // texels kept around each face for filtering
+
+private:
+    struct Slot {
+        uint32_t light{0};
+        glm::vec4 position{};  // xyz: position, w: range the faces were rendered with
+        bool dirty{true};
+    };
+
+    uint32_t _size{0};
+    uint32_t _tile_size{0};
+    uint32_t _tiles_per_row{0};
+    std::vector<Slot> _slots;
+    std::vector<int32_t> _light_slots;  // first tile of each light, -1 if not shadowed
+    std::vector<float> _ranked_ranges;  // ranges the slot assignment was made for
+    size_t _light_slot_capacity{0};
+    bool _light_slots_dirty{true};
+
+    uint32_t _framebuffer{0};
+    uint32_t _depth_texture{0};
+    uint32_t _light_slot_texture{0};
+
+    ShadowAtlas() = default;
+    void _assign_slots(const LightBuffer &lights);
+    void _upload_light_slots();
+    void _render_slot(size_t slot_index, const Geometry &geometry, const Shader &opaque_shader, const Shader &alpha_tested_shader) const;
+    [[nodiscard]] float _face_scale() const noexcept;
+
+public:
+    static ShadowAtlas create(uint32_t size = 4096u, uint32_t tile_size = 256u);
+
+    ~ShadowAtlas();
+    ShadowAtlas(ShadowAtlas &&) = default;
+    ShadowAtlas(const ShadowAtlas &) = delete;
+    ShadowAtlas &operator=(ShadowAtlas &&) = default;
+    ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+
+    [[nodiscard]] size_t capacity() const noexcept { return _slots.size(); }
+
+    // marks the shadows of the lights whose range overlaps the bounds for re-rendering, e.g. after geometry moved
+    void invalidate(const Geometry::AABB &bounds) noexcept;
+    void invalidate() noexcept;
+
+    // Re-renders the dirty shadows with the depth shaders of Geometry::render_depth, returns the number of lights
+    // updated. Must be called once after every LightBuffer::upload() so that no change is missed.
+    size_t update(const LightBuffer &lights, const Geometry &geometry, const Shader &opaque_shader, const Shader &alpha_tested_shader);
+    void bind(const Shader &shader, uint32_t first_texture_unit) const;
+
+};
+
+#endif //LEARNOPENGL_SHADOW_ATLAS_H
@@ -0,0 +1,285 @@
+//
+// Created by Mike Smith on 2019/10/15.
+//
+
+#ifndef LEARNOPENGL_SIMD_H
+#define LEARNOPENGL_SIMD_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(LUISA_SIMD_DISABLE)
+// scalar fallback only
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#define LUISA_SIMD_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LUISA_SIMD_NEON
+#endif
+
+namespace simd {
+
+// Four-wide float vector for the SoA kernels on the CPU side (light binning and animation, software
+// rasterization, ...). Backed by SSE2 or NEON where available and by plain arrays otherwise. Comparisons
+// return lane masks that can be combined with &, |, and consumed by select() or mask().
+struct float4 {
+
+#if defined(LUISA_SIMD_SSE)
+    __m128 v;
+    float4(__m128 v) noexcept : v{v} {}
+#elif defined(LUISA_SIMD_NEON)
+    float32x4_t v;
+    float4(float32x4_t v) noexcept : v{v} {}
+#else
+    float v[4];
+#endif
+
+    float4() noexcept : float4{0.0f} {}
+
+#if defined(LUISA_SIMD_SSE)
+    float4(float s) noexcept : v{_mm_set1_ps(s)} {}
+    float4(float x, float y, float z, float w) noexcept : v{_mm_setr_ps(x, y, z, w)} {}
+    static float4 load(const float *p) noexcept { return _mm_loadu_ps(p); }
+    void store(float *p) const noexcept { _mm_storeu_ps(p, v); }
+#elif defined(LUISA_SIMD_NEON)
+    float4(float s) noexcept : v{vdupq_n_f32(s)} {}
+    float4(float x, float y, float z, float w) noexcept : v{x, y, z, w} {}
+    static float4 load(const float *p) noexcept { return vld1q_f32(p); }
+    void store(float *p) const noexcept { vst1q_f32(p, v); }
+#else
+    float4(float s) noexcept : v{s, s, s, s} {}
+    float4(float x, float y, float z, float w) noexcept : v{x, y, z, w} {}
+    static float4 load(const float *p) noexcept { return {p[0], p[1], p[2], p[3]}; }
+    void store(float *p) const noexcept { std::copy(v, v + 4, p); }
+#endif
+
+    [[nodiscard]] float operator[](int i) const noexcept {
+        alignas(16) float lanes[4];
+        store(lanes);
+        return lanes[i];
+    }
+};
+
+#if defined(LUISA_SIMD_SSE)
+
+inline float4 operator+(float4 a, float4 b) noexcept { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) noexcept { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) noexcept { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) noexcept { return _mm_div_ps(a.v, b.v); }
+inline float4 operator-(float4 a) noexcept { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline float4 min(float4 a, float4 b) noexcept { return _mm_min_ps(a.v, b.v); }
+inline float4 max(float4 a, float4 b) noexcept { return _mm_max_ps(a.v, b.v); }
+inline float4 sqrt(float4 a) noexcept { return _mm_sqrt_ps(a.v); }
+inline float4 operator<(float4 a, float4 b) noexcept { return _mm_cmplt_ps(a.v, b.v); }
+inline float4 operator<=(float4 a, float4 b) noexcept { return _mm_cmple_ps(a.v, b.v); }
+inline float4 operator>(float4 a, float4 b) noexcept { return _mm_cmpgt_ps(a.v, b.v); }
+inline float4 operator>=(float4 a, float4 b) noexcept { return _mm_cmpge_ps(a.v, b.v); }
+inline float4 operator&(float4 a, float4 b) noexcept { return _mm_and_ps(a.v, b.v); }
+inline float4 operator|(float4 a, float4 b) noexcept { return _mm_or_ps(a.v, b.v); }
+inline float4 select(float4 mask, float4 a, float4 b) noexcept { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline uint32_t mask(float4 m) noexcept { return static_cast<uint32_t>(_mm_movemask_ps(m.v)); }
+inline float4 floor(float4 x) noexcept {
+    // truncate and step down where that rounded up, valid for |x| < 2^31
+    auto t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x.v), _mm_set1_ps(1.0f)));
+}
+
+#elif defined(LUISA_SIMD_NEON)
+
+inline float4 operator+(float4 a, float4 b) noexcept { return vaddq_f32(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) noexcept { return vsubq_f32(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) noexcept { return vmulq_f32(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) noexcept { return vdivq_f32(a.v, b.v); }
+inline float4 operator-(float4 a) noexcept { return vnegq_f32(a.v); }
+inline float4 min(float4 a, float4 b) noexcept { return vminq_f32(a.v, b.v); }
+inline float4 max(float4 a, float4 b) noexcept { return vmaxq_f32(a.v, b.v); }
+inline float4 sqrt(float4 a) noexcept { return vsqrtq_f32(a.v); }
+inline float4 operator<(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); }
+inline float4 operator<=(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vcleq_f32(a.v, b.v)); }
+inline float4 operator>(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v)); }
+inline float4 operator>=(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vcgeq_f32(a.v, b.v)); }
+inline float4 operator&(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+inline float4 operator|(float4 a, float4 b) noexcept { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+inline float4 select(float4 mask, float4 a, float4 b) noexcept { return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v); }
+inline uint32_t mask(float4 m) noexcept {
+    auto bits = vshrq_n_u32(vreinterpretq_u32_f32(m.v), 31);
+    return vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1u) | (vgetq_lane_u32(bits, 2) << 2u) | (vgetq_lane_u32(bits, 3) << 3u);
+}
+inline float4 floor(float4 x) noexcept {
+    // truncate and step down where that rounded up, valid for |x| < 2^31
+    auto t = vcvtq_f32_s32(vcvtq_s32_f32(x.v));
+    return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, x.v), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+}
+
+#else
+
+namespace impl {
+
+template<typename F>
+inline float4 map(float4 a, float4 b, F &&f) noexcept {
+    return {f(a.v[0], b.v[0]), f(a.v[1], b.v[1]), f(a.v[2], b.v[2]), f(a.v[3], b.v[3])};
+}
+
+inline float bits_to_float(uint32_t bits) noexcept {
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline uint32_t float_to_bits(float f) noexcept {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(f));
+    return bits;
+}
+
+template<typename F>
+inline float4 compare(float4 a, float4 b, F &&f) noexcept {
+    return map(a, b, [&f](float x, float y) { return bits_to_float(f(x, y) ? 0xffffffffu : 0u); });
+}
+
+template<typename F>
+inline float4 bitwise(float4 a, float4 b, F &&f) noexcept {
+    return map(a, b, [&f](float x, float y) { return bits_to_float(f(float_to_bits(x), float_to_bits(y))); });
+}
+
+}
+
+inline float4 operator+(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return x + y; }); }
+inline float4 operator-(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return x - y; }); }
+inline float4 operator*(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return x * y; }); }
+inline float4 operator/(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return x / y; }); }
+inline float4 operator-(float4 a) noexcept { return float4{0.0f} - a; }
+inline float4 min(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline float4 max(float4 a, float4 b) noexcept { return impl::map(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline float4 sqrt(float4 a) noexcept { return impl::map(a, a, [](float x, float) { return std::sqrt(x); }); }
+inline float4 operator<(float4 a, float4 b) noexcept { return impl::compare(a, b, [](float x, float y) { return x < y; }); }
+inline float4 operator<=(float4 a, float4 b) noexcept { return impl::compare(a, b, [](float x, float y) { return x <= y; }); }
+inline float4 operator>(float4 a, float4 b) noexcept { return impl::compare(a, b, [](float x, float y) { return x > y; }); }
+inline float4 operator>=(float4 a, float4 b) noexcept { return impl::compare(a, b, [](float x, float y) { return x >= y; }); }
+inline float4 operator&(float4 a, float4 b) noexcept { return impl::bitwise(a, b, [](uint32_t x, uint32_t y) { return x & y; }); }
+inline float4 operator|(float4 a, float4 b) noexcept { return impl::bitwise(a, b, [](uint32_t x, uint32_t y) { return x | y; }); }
+inline float4 select(float4 mask, float4 a, float4 b) noexcept {
+    return {impl::float_to_bits(mask.v[0]) ? a.v[0] : b.v[0], impl::float_to_bits(mask.v[1]) ? a.v[1] : b.v[1],
+            impl::float_to_bits(mask.v[2]) ? a.v[2] : b.v[2], impl::float_to_bits(mask.v[3]) ? a.v[3] : b.v[3]};
+}
+inline float4 floor(float4 x) noexcept { return impl::map(x, x, [](float a, float) { return std::floor(a); }); }
+inline uint32_t mask(float4 m) noexcept {
+    return (impl::float_to_bits(m.v[0]) >> 31u) | ((impl::float_to_bits(m.v[1]) >> 31u) << 1u) |
+           ((impl::float_to_bits(m.v[2]) >> 31u) << 2u) | ((impl::float_to_bits(m.v[3]) >> 31u) << 3u);
+}
+
+#endif
+
+inline float4 &operator+=(float4 &a, float4 b) noexcept { return a = a + b; }
+inline float4 &operator-=(float4 &a, float4 b) noexcept { return a = a - b; }
+inline float4 &operator*=(float4 &a, float4 b) noexcept { return a = a * b; }
+inline float4 clamp(float4 x, float4 lo, float4 hi) noexcept { return min(max(x, lo), hi); }
+inline float4 abs(float4 x) noexcept { return max(x, -x); }
+
+// transposes four AoS rows (e.g. four glm::vec4 positions) into x, y, z and w lanes in place
+inline void transpose(float4 &r0, float4 &r1, float4 &r2, float4 &r3) noexcept {
+#if defined(LUISA_SIMD_SSE)
+    _MM_TRANSPOSE4_PS(r0.v, r1.v, r2.v, r3.v);
+#else
+    alignas(16) float m[4][4];
+    r0.store(m[0]);
+    r1.store(m[1]);
+    r2.store(m[2]);
+    r3.store(m[3]);
+    r0 = float4{m[0][0], m[1][0], m[2][0], m[3][0]};
+    r1 = float4{m[0][1], m[1][1], m[2][1], m[3][1]};
+    r2 = float4{m[0][2], m[1][2], m[2][2], m[3][2]};
+    r3 = float4{m[0][3], m[1][3], m[2][3], m[3][3]};
+#endif
+}
+
+// multiply-add helpers for the common 3-component dot products over SoA data
+inline float4 dot3(float4 ax, float4 ay, float4 az, float4 bx, float4 by, float4 bz) noexcept {
+    return ax * bx + ay * by + az * bz;
+}
+
+// sine with range reduction to [-pi/2, pi/2] and an odd polynomial to x^11, absolute error of a few 1e-6 for
+// arguments up to about 50; beyond that the float range reduction dominates
+inline float4 sin(float4 x) noexcept {
+    constexpr auto pi = 3.14159265358979f;
+    constexpr auto two_pi = 6.28318530717959f;
+    x = x - two_pi * floor(x * (1.0f / two_pi) + 0.5f);
+    x = select(x > float4{0.5f * pi}, pi - x, select(x < float4{-0.5f * pi}, -pi - x, x));
+    auto x2 = x * x;
+    auto p = float4{-2.5052108e-8f};
+    p = p * x2 + 2.7557319e-6f;
+    p = p * x2 - 1.9841270e-4f;
+    p = p * x2 + 8.3333333e-3f;
+    p = p * x2 - 1.6666667e-1f;
+    return x + x * x2 * p;
+}
+
+inline float4 cos(float4 x) noexcept {
+    return sin(x + 1.57079632679490f);
+}
+
+// arc cosine on [0, 1] after Abramowitz and Stegun 4.4.45, absolute error below 7e-5
+inline float4 acos_unit(float4 x) noexcept {
+    auto p = float4{-0.0187293f};
+    p = p * x + 0.0742610f;
+    p = p * x - 0.2121144f;
+    p = p * x + 1.5707288f;
+    return sqrt(max(1.0f - x, float4{0.0f})) * p;
+}
+
+// conversion to half floats with rounding to nearest even, overflowing to infinity and keeping NaNs, after
+// Giesen's float_to_half_fast3_rtne
+inline uint16_t to_half(float x) noexcept {
+    uint32_t f;
+    std::memcpy(&f, &x, sizeof(f));
+    auto sign = f & 0x80000000u;
+    f ^= sign;
+    uint32_t h;
+    if (f >= 0x47800000u) {  // infinity or NaN
+        h = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    } else if (f < 0x38800000u) {  // subnormal or zero, rounded by the float addition
+        auto magic = std::abs(x) + 0.5f;
+        std::memcpy(&h, &magic, sizeof(h));
+        h -= 0x3f000000u;
+    } else {
+        h = (f + 0xc8000fffu + ((f >> 13u) & 1u)) >> 13u;
+    }
+    return static_cast<uint16_t>(h | (sign >> 16u));
+}
+
+// the four lanes of x converted by to_half() and stored at p
+inline void store_half(float4 x, uint16_t *p) noexcept {
+#if defined(LUISA_SIMD_SSE)
+    auto sign = _mm_and_ps(x.v, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int32_t>(0x80000000u))));
+    auto absf = _mm_xor_ps(x.v, sign);
+    auto bits = _mm_castps_si128(absf);
+    auto nan_bit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+    auto special = _mm_or_si128(nan_bit, _mm_set1_epi32(0x7c00));
+    auto regular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), bits);
+    auto subnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), bits);
+    auto magic = _mm_set1_epi32(0x3f000000);
+    auto subnormal_h = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(magic))), magic);
+    auto odd = _mm_srai_epi32(_mm_slli_epi32(bits, 18), 31);
+    auto normal_h = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(static_cast<int32_t>(0xc8000fffu))), odd), 13);
+    auto h = _mm_or_si128(_mm_and_si128(subnormal, subnormal_h), _mm_andnot_si128(subnormal, normal_h));
+    h = _mm_or_si128(_mm_and_si128(regular, h), _mm_andnot_si128(regular, special));
+    h = _mm_or_si128(h, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+    // sign-extended from 16 bits so the saturating pack keeps them as they are
+    h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packs_epi32(h, h));
+#elif defined(LUISA_SIMD_NEON) && defined(__aarch64__)
+    vst1_u16(p, vreinterpret_u16_f16(vcvt_f16_f32(x.v)));
+#else
+    alignas(16) float lanes[4];
+    x.store(lanes);
+    for (auto i = 0; i < 4; i++) { p[i] = to_half(lanes[i]); }
+#endif
+}
+
+}
+
+#endif //LEARNOPENGL_SIMD_H
@@ -0,0 +1,133 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <stdexcept>
+
+#include "serialize.h"
+#include "temporal_aa.h"
+
+namespace {
+
+float halton(uint32_t index, uint32_t base) noexcept {
+    auto f = 1.0f;
+    auto r = 0.0f;
+    for (; index != 0u; index /= base) {
+        f /= static_cast<float>(base);
+        r += f * static_cast<float>(index % base);
+    }
+    return r;
+}
+
+}
+
+TemporalAA TemporalAA::create(uint32_t width, uint32_t height) {
+    
+    TemporalAA taa;
+    glGenFramebuffers(2, taa._framebuffers.data());
+    glGenTextures(2, taa._history_textures.data());
+    glGenVertexArrays(1, &taa._vertex_array);
+    taa._allocate(width, height);
+    
+    return taa;
+}
+
+TemporalAA::~TemporalAA() {
+    glDeleteFramebuffers(2, _framebuffers.data());
+    glDeleteTextures(2, _history_textures.data());
+    glDeleteVertexArrays(1, &_vertex_array);
+}
+
+void TemporalAA::_allocate(uint32_t width, uint32_t height) {
+    
+    _width = width;
+    _height = height;
+    _history_valid = false;
+    
+    for (auto i = 0u; i < 2u; i++) {
+        glBindTexture(GL_TEXTURE_2D, _history_textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _history_textures[i], 0);
+        auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error{serialize("TAA history framebuffer not complete, status: ", status)};
+        }
+    }
+}
+
+void TemporalAA::resize(uint32_t width, uint32_t height) {
+    if (width != _width || height != _height) {
+        _allocate(width, height);
+    }
+}
+
+glm::vec2 TemporalAA::jitter() const noexcept {
+    auto index = _frame_index % jitter_count + 1u;  // the sequence starts at zero, skip it
+    return {halton(index, 2u) - 0.5f, halton(index, 3u) - 0.5f};
+}
+
+glm::mat4 TemporalAA::jittered(glm::mat4 projection) const noexcept {
+    // clip w is -z for perspective projections, so the third column offsets x / w and y / w by its negation
+    auto offset = jitter() * 2.0f / glm::vec2{_width, _height};
+    projection[2][0] -= offset.x;
+    projection[2][1] -= offset.y;
+    return projection;
+}
+
+void TemporalAA::_draw() const {
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(_vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void TemporalAA::resolve(const Shader &shader, uint32_t color_texture, uint32_t depth_texture,
+                         const glm::mat4 &view_projection, uint32_t first_texture_unit) {
+    
+    auto previous = _current;
+    _current = 1u - _current;
+    
+    shader.use();
+    uint32_t textures[]{color_texture, depth_texture, _history_textures[previous]};
+    const char *names[]{"sceneColor", "sceneDepth", "historyColor"};
+    for (auto i = 0u; i < 3u; i++) {
+        glActiveTexture(GL_TEXTURE0 + first_texture_unit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        shader.setInt(names[i], first_texture_unit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    shader.setMat4("reprojection", _previous_view_projection * glm::inverse(view_projection));
+    shader.setFloat("historyWeight", _history_valid ? history_weight : 0.0f);
+    
+    int32_t framebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[_current]);
+    glViewport(0, 0, _width, _height);
+    _draw();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    
+    _previous_view_projection = view_projection;
+    _history_valid = true;
+    _frame_index++;
+}
+
+void TemporalAA::present(const Shader &shader, uint32_t texture_unit) const {
+    shader.use();
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_2D, _history_textures[_current]);
+    shader.setInt("sceneColor", texture_unit);
+    glActiveTexture(GL_TEXTURE0);
+    _draw();
+}
@@ -0,0 +1,75 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_TEMPORAL_AA_H
+#define LEARNOPENGL_TEMPORAL_AA_H
+
+#include <array>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+// Temporal anti-aliasing as a single-sampled alternative to MSAA. Every frame is rendered with the projection
+// offset by a sub-pixel jitter from the Halton (2, 3) sequence, then resolve() reprojects the accumulated history
+// into it and blends the two. Since nothing but the camera moves, the per-pixel velocity follows from the depth
+// and the current and previous view-projections, so no velocity target has to be written by the scene passes.
+// The history is ping-ponged between two linear RGBA16F textures at the render resolution.
+class TemporalAA {
+
+public:
+    static constexpr auto jitter_count = 8u;
+    static constexpr auto history_weight = 0.9f;
+
+private:
+    uint32_t _width{0};
+    uint32_t _height{0};
+    std::array<uint32_t, 2> _framebuffers{};
+    std::array<uint32_t, 2> _history_textures{};
+    uint32_t _vertex_array{0};  // empty, for the fullscreen triangle
+    uint32_t _current{0};       // history written by the last resolve
+    uint32_t _frame_index{0};
+    bool _history_valid{false};
+    glm::mat4 _previous_view_projection{1.0f};
+    
+    TemporalAA() = default;
+    void _allocate(uint32_t width, uint32_t height);
+    void _draw() const;
+
+public:
+    static TemporalAA create(uint32_t width, uint32_t height);
+    
+    ~TemporalAA();
+    TemporalAA(TemporalAA &&) = default;
+    TemporalAA(const TemporalAA &) = delete;
+    TemporalAA &operator=(TemporalAA &&) = default;
+    TemporalAA &operator=(const TemporalAA &) = delete;
+    
+    [[nodiscard]] uint32_t width() const noexcept { return _width; }
+    [[nodiscard]] uint32_t height() const noexcept { return _height; }
+    
+    // reallocates and invalidates the history if the size changed
+    void resize(uint32_t width, uint32_t height);
+    
+    // drops the history, e.g. after a camera cut
+    void invalidate() noexcept { _history_valid = false; }
+    
+    // sub-pixel offset of the current frame in pixels, within (-0.5, 0.5)
+    [[nodiscard]] glm::vec2 jitter() const noexcept;
+    
+    // the projection shifted by jitter() for rendering the current frame
+    [[nodiscard]] glm::mat4 jittered(glm::mat4 projection) const noexcept;
+    
+    // blends the frame rendered with jittered() into the history and advances the jitter; view_projection is the
+    // unjittered one of the frame, the textures are bound to three units starting at first_texture_unit
+    void resolve(const Shader &shader, uint32_t color_texture, uint32_t depth_texture,
+                 const glm::mat4 &view_projection, uint32_t first_texture_unit);
+    
+    // draws the latest history as sceneColor through the shader over the bound framebuffer's viewport
+    void present(const Shader &shader, uint32_t texture_unit) const;
+    
+};
+
+#endif //LEARNOPENGL_TEMPORAL_AA_H
@@ -2,6 +2,9 @@
 // Created by Mike Smith on 2019/9/18.
 //
 
+#include <memory>
+#include <cstring>
+#include <algorithm>
 #include <stb_image_write.h>
 #include <glad/glad.h>
 #include "texture_packer.h"
@@ -70,8 +73,12 @@ TexturePacker::ImageBlock TexturePacker::load(const std::string &path) {
         throw std::runtime_error{serialize("Failed to load image: ", path)};
     }
     
+    auto alpha_tested = std::any_of(image_date.get(), image_date.get() + w * h, [](glm::u8vec4 texel) noexcept {
+        return texel.a < alpha_cutoff;
+    });
+    
     auto quad = _fit_image(w, h);
-    ImageBlock block{quad.index, {quad.x, quad.y}, {w, h}};
+    ImageBlock block{quad.index, {quad.x, quad.y}, {w, h}, alpha_tested};
     _fill(block, image_date.get());
     _loaded_images.emplace(path, block);
     
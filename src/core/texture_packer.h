@@ -36,9 +36,14 @@ public:
         uint32_t index;
         glm::uvec2 offset;
         glm::uvec2 size;
-        constexpr ImageBlock() noexcept : index{}, offset{}, size{} {}
-        constexpr ImageBlock(uint32_t index, glm::uvec2 offset, glm::uvec2 size) noexcept : index{index}, offset{offset}, size{size} {}
+        bool alpha_tested;  // has texels below the alpha cutoff of the shaders, i.e. fragments may be discarded
+        constexpr ImageBlock() noexcept : index{}, offset{}, size{}, alpha_tested{false} {}
+        constexpr ImageBlock(uint32_t index, glm::uvec2 offset, glm::uvec2 size, bool alpha_tested = false) noexcept
+            : index{index}, offset{offset}, size{size}, alpha_tested{alpha_tested} {}
     };
+    
+    // texels with alpha below this value are discarded by fetchAlbedo() in surface.glsl (0.01 in [0, 1])
+    static constexpr auto alpha_cutoff = 3u;
 
 private:
     size_t _max_size{};
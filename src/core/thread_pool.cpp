@@ -0,0 +1,48 @@
+//
+// Created by Mike Smith on 2019/10/15.
+//
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t worker_count) {
+    _workers.reserve(worker_count);
+    for (auto i = 0ul; i < worker_count; i++) {
+        _workers.emplace_back([this] {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock{_mutex};
+                    _cv.wait(lock, [this] { return _should_stop || !_tasks.empty(); });
+                    if (_should_stop && _tasks.empty()) { return; }
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept {
+    {
+        std::lock_guard lock{_mutex};
+        _should_stop = true;
+    }
+    _cv.notify_all();
+    for (auto &&worker : _workers) {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::_enqueue(std::function<void()> task) {
+    {
+        std::lock_guard lock{_mutex};
+        _tasks.emplace(std::move(task));
+    }
+    _cv.notify_one();
+}
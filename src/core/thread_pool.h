@@ -0,0 +1,89 @@
+//
+// Created by Mike Smith on 2019/10/15.
+//
+
+#ifndef LEARNOPENGL_THREAD_POOL_H
+#define LEARNOPENGL_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+
+private:
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _should_stop{false};
+
+    void _enqueue(std::function<void()> task);
+
+public:
+    explicit ThreadPool(size_t worker_count = std::max(std::thread::hardware_concurrency(), 1u));
+    ~ThreadPool() noexcept;
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    static ThreadPool &global();
+    [[nodiscard]] size_t size() const noexcept { return _workers.size(); }
+
+    // runs the task on a worker thread
+    template<typename F>
+    auto dispatch(F &&f) {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        _enqueue([task] { (*task)(); });
+        return future;
+    }
+
+    // calls f(i) for every i in [0, count) and blocks until all calls finished; the calling thread takes part
+    // in the work, so nested parallel_for calls from inside a worker cannot dead-lock
+    template<typename F>
+    void parallel_for(size_t count, F &&f) {
+
+        if (count == 0) { return; }
+        if (count == 1 || _workers.empty()) {
+            for (auto i = 0ul; i < count; i++) { f(i); }
+            return;
+        }
+
+        struct State {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> finished{0};
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+        auto state = std::make_shared<State>();
+
+        // helpers that only get scheduled after all the work is done find nothing left and exit without touching f
+        auto run = [state, count, &f] {
+            for (auto i = state->next++; i < count; i = state->next++) {
+                f(i);
+                if (++state->finished == count) {
+                    std::lock_guard lock{state->mutex};
+                    state->cv.notify_one();
+                }
+            }
+        };
+        auto helper_count = std::min(_workers.size(), count - 1);
+        for (auto i = 0ul; i < helper_count; i++) {
+            _enqueue(run);
+        }
+        run();
+        std::unique_lock lock{state->mutex};
+        state->cv.wait(lock, [&state, count] { return state->finished == count; });
+    }
+
+};
+
+#endif //LEARNOPENGL_THREAD_POOL_H
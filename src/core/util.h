@@ -6,6 +6,10 @@
 #define LEARNOPENGL_UTIL_H
 
 #include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
 
 namespace util {
 
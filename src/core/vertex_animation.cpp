@@ -0,0 +1,416 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <queue>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "hasher.h"
+#include "serialize.h"
+#include "thread_pool.h"
+#include "vertex_animation.h"
+
+namespace {
+
+constexpr auto importer_version = 1u;  // bump whenever the imported frames change for the same inputs
+constexpr char file_magic[4] = {'L', 'V', 'A', 'T'};
+constexpr auto header_offset_position = sizeof(file_magic) + sizeof(uint32_t) + sizeof(uint64_t);
+
+// the vertices of a mesh file in the order GeometryData::load() reads them, placed by transform
+void load_vertices(const std::string &path, const glm::mat4 &transform, std::vector<glm::vec3> &positions, std::vector<glm::vec3> &normals) {
+
+    Assimp::Importer importer;
+    auto ai_scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_FixInfacingNormals | aiProcess_GenSmoothNormals);
+    if (ai_scene == nullptr || (ai_scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || ai_scene->mRootNode == nullptr) {
+        throw std::runtime_error{serialize("Failed to load keyframe from: ", path)};
+    }
+
+    positions.clear();
+    normals.clear();
+    auto normal_matrix = glm::transpose(glm::inverse(glm::mat3{transform}));
+    std::queue<aiNode *> node_queue;
+    node_queue.push(ai_scene->mRootNode);
+    while (!node_queue.empty()) {
+        auto node = node_queue.front();
+        node_queue.pop();
+        for (auto i = 0ul; i < node->mNumMeshes; i++) {
+            auto ai_mesh = ai_scene->mMeshes[node->mMeshes[i]];
+            for (auto v = 0ul; v < ai_mesh->mNumVertices; v++) {
+                auto p = ai_mesh->mVertices[v];
+                auto n = ai_mesh->mNormals[v];
+                positions.emplace_back(transform * glm::vec4{p.x, p.y, p.z, 1.0f});
+                normals.emplace_back(normal_matrix * glm::vec3{n.x, n.y, n.z});
+            }
+        }
+        for (auto i = 0ul; i < node->mNumChildren; i++) {
+            node_queue.push(node->mChildren[i]);
+        }
+    }
+}
+
+int16_t encode_octahedral(glm::vec3 n) noexcept {
+    n /= std::max(std::abs(n.x) + std::abs(n.y) + std::abs(n.z), 1e-20f);
+    auto e = glm::vec2{n};
+    if (n.z < 0.0f) {
+        e = (1.0f - glm::abs(glm::vec2{e.y, e.x})) * glm::vec2{e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f};
+    }
+    auto q = glm::clamp(glm::round((e * 0.5f + 0.5f) * 255.0f), 0.0f, 255.0f);
+    return static_cast<int16_t>(static_cast<uint16_t>((static_cast<uint32_t>(q.x) << 8u) | static_cast<uint32_t>(q.y)));
+}
+
+template<typename T>
+void write_vector(std::ofstream &file, const std::vector<T> &v) {
+    auto count = static_cast<uint64_t>(v.size());
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+template<typename T>
+void read_vector(std::ifstream &file, std::vector<T> &v) {
+    uint64_t count = 0u;
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (file) {
+        v.resize(count);
+        file.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+    }
+}
+
+}
+
+void VertexAnimationData::read_frame(const std::string &path, const Track &track, size_t frame, std::vector<int16_t> &texels) {
+    std::ifstream file{path, std::ios::binary};
+    texels.resize(frame_size(track));
+    file.seekg(static_cast<std::streamoff>(track.offset + frame * frame_size(track) * sizeof(int16_t)));
+    file.read(reinterpret_cast<char *>(texels.data()), texels.size() * sizeof(int16_t));
+    if (!file) {
+        throw std::runtime_error{serialize("Failed to read vertex animation frame ", frame, " of mesh #", track.mesh, " from: ", path)};
+    }
+}
+
+uint64_t VertexAnimationData::cache_key(const std::string &scene_path, const SceneInfo &info) {
+
+    Hasher hasher;
+    hasher.value(importer_version);
+
+    std::ifstream file{scene_path, std::ios::binary};
+    std::string content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    hasher.string(content);
+
+    for (auto &&mesh : info.meshes()) {
+        hasher.file_stamp(info.folder() + mesh.file_name);
+        if (!info.vertex_animated(mesh)) { continue; }
+        for (auto &&keyframe : info.animations().at(mesh.animation_name)) {
+            if (!keyframe.file_name.empty()) { hasher.file_stamp(info.folder() + keyframe.file_name); }
+        }
+    }
+    return hasher.digest();
+}
+
+VertexAnimationData VertexAnimationData::import(const SceneInfo &info, const GeometryData &geometry, const std::string &path, uint64_t key) {
+
+    VertexAnimationData data;
+    data.key = key;
+    data.path = path;
+
+    // written even without any vertex-animated mesh, so the cache is found up to date next time
+    auto &&meshes = info.meshes();
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{serialize("Failed to write vertex animation: ", path)};
+    }
+    uint64_t header_offset = 0u;
+    file.write(file_magic, sizeof(file_magic));
+    file.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+    file.write(reinterpret_cast<const char *>(&header_offset), sizeof(header_offset));
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<int16_t> texels;
+    for (auto i = 0u; i < meshes.size(); i++) {
+
+        auto first_vertex = geometry.mesh_vertex_frame_offsets[i];
+        if (first_vertex == -1) { continue; }
+
+        auto &&mesh = meshes[i];
+        auto vertex_count = static_cast<uint32_t>(geometry.mesh_sizes[i]);
+        auto rest_positions = geometry.positions.data() + geometry.mesh_offsets[i];
+        auto rest_normals = geometry.normals.data() + geometry.mesh_offsets[i];
+        Track track{i, static_cast<uint32_t>(first_vertex), vertex_count, {}, {}, glm::vec3{0.0f}, glm::vec3{0.0f}, static_cast<uint64_t>(file.tellp())};
+        for (auto &&keyframe : info.animations().at(mesh.animation_name)) {
+            if (keyframe.file_name.empty()) {
+                positions.assign(rest_positions, rest_positions + vertex_count);
+                normals.assign(rest_normals, rest_normals + vertex_count);
+            } else {
+                load_vertices(info.folder() + keyframe.file_name, mesh.transform, positions, normals);
+                if (positions.size() != vertex_count) {
+                    throw std::runtime_error{serialize("Keyframe ", keyframe.file_name, " has ", positions.size(), " vertices, but ",
+                                                       mesh.file_name, " has ", vertex_count)};
+                }
+            }
+            auto largest = 0.0f;
+            for (auto v = 0u; v < vertex_count; v++) {
+                auto d = glm::abs(positions[v] - rest_positions[v]);
+                largest = std::max(largest, std::max(std::max(d.x, d.y), d.z));
+            }
+            auto scale = largest > 0.0f ? largest / 32767.0f : 1.0f;
+            texels.resize(frame_size(track));
+            for (auto v = 0u; v < vertex_count; v++) {
+                auto q = glm::clamp(glm::round((positions[v] - rest_positions[v]) / scale), -32767.0f, 32767.0f);
+                texels[v * 4u] = static_cast<int16_t>(q.x);
+                texels[v * 4u + 1u] = static_cast<int16_t>(q.y);
+                texels[v * 4u + 2u] = static_cast<int16_t>(q.z);
+                texels[v * 4u + 3u] = encode_octahedral(normals[v]);
+                track.min_displacement = glm::min(track.min_displacement, q * scale);
+                track.max_displacement = glm::max(track.max_displacement, q * scale);
+            }
+            file.write(reinterpret_cast<const char *>(texels.data()), texels.size() * sizeof(int16_t));
+            track.times.emplace_back(keyframe.time);
+            track.scales.emplace_back(scale);
+        }
+        std::cout << "Imported " << track.times.size() << " vertex animation frames of " << mesh.file_name
+                  << " (" << vertex_count << " vertices)" << std::endl;
+        data.tracks.emplace_back(std::move(track));
+    }
+
+    header_offset = static_cast<uint64_t>(file.tellp());
+    auto track_count = static_cast<uint64_t>(data.tracks.size());
+    file.write(reinterpret_cast<const char *>(&track_count), sizeof(track_count));
+    for (auto &&track : data.tracks) {
+        file.write(reinterpret_cast<const char *>(&track.mesh), sizeof(track.mesh));
+        file.write(reinterpret_cast<const char *>(&track.first_vertex), sizeof(track.first_vertex));
+        file.write(reinterpret_cast<const char *>(&track.vertex_count), sizeof(track.vertex_count));
+        write_vector(file, track.times);
+        write_vector(file, track.scales);
+        file.write(reinterpret_cast<const char *>(&track.min_displacement), sizeof(track.min_displacement));
+        file.write(reinterpret_cast<const char *>(&track.max_displacement), sizeof(track.max_displacement));
+        file.write(reinterpret_cast<const char *>(&track.offset), sizeof(track.offset));
+    }
+    file.seekp(header_offset_position);
+    file.write(reinterpret_cast<const char *>(&header_offset), sizeof(header_offset));
+    if (!file) {
+        throw std::runtime_error{serialize("Failed to write vertex animation: ", path)};
+    }
+    std::cout << "Saved vertex animation to: " << path << std::endl;
+    return data;
+}
+
+std::optional<VertexAnimationData> VertexAnimationData::load(const std::string &path, uint64_t key) {
+
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return std::nullopt;
+    }
+
+    char magic[4]{};
+    uint32_t version = 0u;
+    uint64_t header_offset = 0u;
+    VertexAnimationData data;
+    data.path = path;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&data.key), sizeof(data.key));
+    file.read(reinterpret_cast<char *>(&header_offset), sizeof(header_offset));
+    if (!file || !std::equal(magic, magic + sizeof(magic), file_magic) || version != file_version) {
+        std::cout << "Ignoring unrecognized vertex animation: " << path << std::endl;
+        return std::nullopt;
+    }
+    if (data.key != key) {
+        std::cout << "Ignoring stale vertex animation: " << path << std::endl;
+        return std::nullopt;
+    }
+
+    uint64_t track_count = 0u;
+    file.seekg(static_cast<std::streamoff>(header_offset));
+    file.read(reinterpret_cast<char *>(&track_count), sizeof(track_count));
+    for (auto i = 0ul; file && i < track_count; i++) {
+        Track track{};
+        file.read(reinterpret_cast<char *>(&track.mesh), sizeof(track.mesh));
+        file.read(reinterpret_cast<char *>(&track.first_vertex), sizeof(track.first_vertex));
+        file.read(reinterpret_cast<char *>(&track.vertex_count), sizeof(track.vertex_count));
+        read_vector(file, track.times);
+        read_vector(file, track.scales);
+        file.read(reinterpret_cast<char *>(&track.min_displacement), sizeof(track.min_displacement));
+        file.read(reinterpret_cast<char *>(&track.max_displacement), sizeof(track.max_displacement));
+        file.read(reinterpret_cast<char *>(&track.offset), sizeof(track.offset));
+        data.tracks.emplace_back(std::move(track));
+    }
+    if (!file || header_offset == 0u || std::any_of(data.tracks.cbegin(), data.tracks.cend(), [](const Track &track) {
+        return track.times.empty() || track.times.size() != track.scales.size();
+    })) {
+        std::cout << "Ignoring truncated vertex animation: " << path << std::endl;
+        return std::nullopt;
+    }
+    std::cout << "Loaded vertex animation of " << data.tracks.size() << " meshes from: " << path << std::endl;
+    return data;
+}
+
+VertexAnimationStreamer VertexAnimationStreamer::create(VertexAnimationData data, Geometry &geometry) {
+
+    VertexAnimationStreamer streamer;
+    streamer._data = std::move(data);
+    streamer._tracks.resize(streamer._data.tracks.size());
+    if (streamer.empty()) {
+        return streamer;
+    }
+
+    for (auto &&track : streamer._data.tracks) {
+        if (geometry.vertex_frame_offset(track.mesh) != static_cast<int32_t>(track.first_vertex)) {
+            throw std::runtime_error{serialize("Vertex animation of mesh #", track.mesh, " does not match the geometry")};
+        }
+        geometry.expand_mesh_bounds(track.mesh, track.min_displacement, track.max_displacement);
+        // an update() uploads at most both frames of each track
+        streamer._staging_region_size += VertexAnimationData::frame_size(track) * sizeof(int16_t) * 2u;
+    }
+
+    auto size = static_cast<int64_t>(streamer._staging_region_size * frames_in_flight);
+    glGenBuffers(1, &streamer._staging_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer._staging_buffer);
+    if (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage) {
+        auto flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        streamer._staging_data = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    } else {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    std::cout << "Created vertex animation streamer for " << streamer.size() << " meshes, "
+              << (streamer._staging_data == nullptr ? "copied" : "persistently mapped") << " staging of "
+              << size << " bytes" << std::endl;
+    return streamer;
+}
+
+VertexAnimationStreamer::~VertexAnimationStreamer() {
+    for (auto fence : _fences) {
+        if (fence != nullptr) { glDeleteSync(fence); }
+    }
+    glDeleteBuffers(1, &_staging_buffer);  // also unmaps
+}
+
+void VertexAnimationStreamer::_upload(const Geometry &geometry, size_t track_index, int32_t frame, uint32_t texture_index) {
+
+    auto &&track = _tracks[track_index];
+    auto &&data_track = _data.tracks[track_index];
+    if (track.prefetched_frame == frame) {
+        _texels = track.prefetch.get();
+        track.prefetched_frame = -1;
+    } else {
+        _data.read_frame(track_index, static_cast<size_t>(frame), _texels);
+    }
+
+    auto offset = _staging_region * _staging_region_size + _staging_offset;
+    auto bytes = _texels.size() * sizeof(int16_t);
+    _staging_offset += bytes;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _staging_buffer);
+    if (_staging_data != nullptr) {
+        std::copy_n(reinterpret_cast<const uint8_t *>(_texels.data()), bytes, _staging_data + offset);
+    } else {
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, static_cast<int64_t>(offset), static_cast<int64_t>(bytes), _texels.data());
+    }
+
+    // the vertices of the mesh span a partial row, full rows and another partial row of the texture
+    constexpr auto width = Geometry::vertex_frame_texture_width;
+    auto first = data_track.first_vertex;
+    auto end = first + data_track.vertex_count;
+    glBindTexture(GL_TEXTURE_2D, geometry.vertex_frame_texture(texture_index));
+    auto upload = [&](uint32_t begin, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+        auto source = reinterpret_cast<const void *>(offset + (begin - first) * 4ul * sizeof(int16_t));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, static_cast<int32_t>(x), static_cast<int32_t>(y), static_cast<int32_t>(w), static_cast<int32_t>(h), GL_RGBA_INTEGER, GL_SHORT, source);
+    };
+    auto head = std::min(end - first, width - first % width);
+    upload(first, first % width, first / width, head, 1u);
+    if (auto rows = (end - first - head) / width; rows != 0u) {
+        upload(first + head, 0u, (first + head) / width, width, rows);
+    }
+    if (auto tail_begin = first + head + (end - first - head) / width * width; tail_begin < end) {
+        upload(tail_begin, 0u, tail_begin / width, end - tail_begin, 1u);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    track.frames[texture_index] = frame;
+}
+
+bool VertexAnimationStreamer::update(const Geometry &geometry, float time) {
+
+    _swept_bounds.clear();
+    if (empty() || (_evaluated && time == _time)) {
+        return false;
+    }
+    _time = time;
+    _evaluated = true;
+
+    // the region was last read by the uploads of the update frames_in_flight ago, which only stalls when the GPU
+    // falls that far behind
+    _staging_region = (_staging_region + 1u) % frames_in_flight;
+    _staging_offset = 0u;
+    if (auto &&fence = _fences[_staging_region]; fence != nullptr) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<uint64_t>::max());
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    for (auto i = 0u; i < _tracks.size(); i++) {
+
+        auto &&track = _tracks[i];
+        auto &&times = _data.tracks[i].times;
+        auto frame_count = static_cast<int32_t>(times.size());
+        auto start_time = times.front();
+        auto total_time = times.back() - start_time;
+        auto delta_time = time - start_time;
+        if (delta_time > total_time && total_time > 0.0f) {
+            delta_time -= std::floor(delta_time / total_time) * total_time;
+        }
+        auto period_time = std::clamp(delta_time, 0.0f, total_time) + start_time;
+        auto after = static_cast<int32_t>(std::lower_bound(times.cbegin(), times.cend(), period_time) - times.cbegin());
+        after = std::min(after, frame_count - 1);
+        auto before = std::max(after - 1, 0);
+        auto t = times[after] > times[before] ? (period_time - times[before]) / (times[after] - times[before]) : 0.0f;
+
+        // upload whichever of the bracketing frames is missing over the one no longer needed
+        auto held = [&track](int32_t frame) { return track.frames[0] == frame ? 0 : (track.frames[1] == frame ? 1 : -1); };
+        if (held(before) == -1 && held(after) == -1) {
+            _upload(geometry, i, before, 0u);
+            if (after != before) { _upload(geometry, i, after, 1u); }
+        } else if (held(before) == -1) {
+            _upload(geometry, i, before, 1u - static_cast<uint32_t>(held(after)));
+        } else if (held(after) == -1) {
+            _upload(geometry, i, after, 1u - static_cast<uint32_t>(held(before)));
+        }
+        auto weight = held(after) == 1 ? t : 1.0f - t;  // of the second texture
+        if (after == before) { weight = held(after) == 1 ? 1.0f : 0.0f; }
+
+        auto &&data_track = _data.tracks[i];
+        auto scale = [&](uint32_t index) { return track.frames[index] == -1 ? 0.0f : data_track.scales[track.frames[index]]; };
+        glm::vec4 texel{weight, scale(0u), scale(1u), 0.0f};
+        auto slot = geometry.transform_slot(data_track.mesh);
+        glBindTexture(GL_TEXTURE_2D, geometry.vertex_track_texture());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, static_cast<int32_t>(slot % Geometry::transform_texture_width),
+                        static_cast<int32_t>(slot / Geometry::transform_texture_width), 1, 1, GL_RGBA, GL_FLOAT, &texel);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        _swept_bounds.emplace_back(geometry.mesh_bounds(data_track.mesh));
+
+        // read the frame after the pair ahead, unless it is already held
+        auto next = after + 1 < frame_count ? after + 1 : 0;
+        if (held(next) == -1 && track.prefetched_frame != next) {
+            track.prefetched_frame = next;
+            track.prefetch = ThreadPool::global().dispatch([path = _data.path, data_track, next] {
+                std::vector<int16_t> texels;
+                VertexAnimationData::read_frame(path, data_track, static_cast<size_t>(next), texels);
+                return texels;
+            });
+        }
+    }
+    if (_staging_offset != 0u) {
+        _fences[_staging_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    return true;
+}
@@ -0,0 +1,113 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_VERTEX_ANIMATION_H
+#define LEARNOPENGL_VERTEX_ANIMATION_H
+
+#include <future>
+#include <optional>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// Vertex animation frames imported from the mesh files that keyframes point to, stored next to the scene. Each
+// frame holds one RGBA16I texel per vertex of its mesh: the displacement from the rest pose quantized to the
+// largest one of the frame (scales), and the normal in 8:8 octahedral coding; keyframes without a file are the rest
+// pose. Only the headers stay in memory, frames are read from the file on demand, from any thread.
+struct VertexAnimationData {
+
+    static constexpr uint32_t file_version = 1u;
+
+    struct Track {
+        uint32_t mesh;
+        uint32_t first_vertex;  // GeometryData::mesh_vertex_frame_offsets of the mesh
+        uint32_t vertex_count;
+        std::vector<float> times;   // of the keyframes, sorted
+        std::vector<float> scales;  // per frame, from texel units to displacement
+        glm::vec3 min_displacement;
+        glm::vec3 max_displacement;
+        uint64_t offset;  // of the first frame in the file
+    };
+
+    uint64_t key{0};
+    std::string path;
+    std::vector<Track> tracks;
+
+    [[nodiscard]] bool empty() const noexcept { return tracks.empty(); }
+    [[nodiscard]] static size_t frame_size(const Track &track) noexcept { return track.vertex_count * 4ul; }  // texel components
+
+    static void read_frame(const std::string &path, const Track &track, size_t frame, std::vector<int16_t> &texels);
+    void read_frame(size_t track, size_t frame, std::vector<int16_t> &texels) const { read_frame(path, tracks[track], frame, texels); }
+
+    // identifies the inputs of an import: the scene file and the mesh files it names, keyframes included
+    static uint64_t cache_key(const std::string &scene_path, const SceneInfo &info);
+
+    // converts the keyframe meshes of every vertex-animated mesh into frames at path, a file without tracks if there is none
+    static VertexAnimationData import(const SceneInfo &info, const GeometryData &geometry, const std::string &path, uint64_t key);
+
+    // the cached frames at path if they exist and were imported for key
+    static std::optional<VertexAnimationData> load(const std::string &path, uint64_t key);
+
+};
+
+// Plays back VertexAnimationData into the frame textures of Geometry. The two textures hold the keyframes
+// bracketing the current time of each mesh; when a mesh moves on to the next pair, only the frame it lacks is
+// uploaded, over the one it left behind, and the frame after that is read ahead on the thread pool. Uploads go
+// through a pixel unpack buffer split into one region per frame in flight, each large enough for every upload of an
+// update() and guarded by a single fence, persistently mapped where OpenGL 4.4 or ARB_buffer_storage is available
+// and written with glBufferSubData otherwise.
+class VertexAnimationStreamer {
+
+public:
+    static constexpr auto frames_in_flight = 3u;
+
+private:
+    struct Track {
+        int32_t frames[2]{-1, -1};  // keyframe held by each frame texture
+        int32_t prefetched_frame{-1};
+        std::future<std::vector<int16_t>> prefetch;
+    };
+
+    VertexAnimationData _data;
+    std::vector<Track> _tracks;
+    std::vector<Geometry::AABB> _swept_bounds;
+    std::vector<int16_t> _texels;
+    uint32_t _staging_buffer{0};
+    uint8_t *_staging_data{nullptr};  // persistently mapped, nullptr if not supported
+    size_t _staging_region_size{0};   // bytes, two frames of every track
+    size_t _staging_offset{0};        // bytes used of the current region
+    GLsync _fences[frames_in_flight]{};
+    uint32_t _staging_region{0};
+    float _time{0.0f};
+    bool _evaluated{false};
+
+    VertexAnimationStreamer() = default;
+    void _upload(const Geometry &geometry, size_t track, int32_t frame, uint32_t texture_index);
+
+public:
+    // grows the bounds of the vertex-animated meshes of geometry to cover all of their frames
+    static VertexAnimationStreamer create(VertexAnimationData data, Geometry &geometry);
+
+    ~VertexAnimationStreamer();
+    VertexAnimationStreamer(VertexAnimationStreamer &&) = default;
+    VertexAnimationStreamer(const VertexAnimationStreamer &) = delete;
+    VertexAnimationStreamer &operator=(VertexAnimationStreamer &&) = default;
+    VertexAnimationStreamer &operator=(const VertexAnimationStreamer &) = delete;
+
+    [[nodiscard]] bool empty() const noexcept { return _data.empty(); }
+    [[nodiscard]] size_t size() const noexcept { return _data.tracks.size(); }
+
+    // blends every vertex-animated mesh to the given time, returns whether any of them changed; does nothing if
+    // the time did not change
+    bool update(const Geometry &geometry, float time);
+
+    // the bounds of every mesh deformed by the last update(), e.g. for ShadowAtlas::invalidate()
+    [[nodiscard]] const std::vector<Geometry::AABB> &swept_bounds() const noexcept { return _swept_bounds; }
+
+};
+
+#endif //LEARNOPENGL_VERTEX_ANIMATION_H
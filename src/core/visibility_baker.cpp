@@ -0,0 +1,248 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "camera_animator.h"
+#include "frustum.h"
+#include "hasher.h"
+#include "occlusion_culler.h"
+#include "serialize.h"
+#include "thread_pool.h"
+#include "visibility_baker.h"
+
+namespace {
+
+constexpr auto baker_version = 3u;  // bump whenever the baked result changes for the same inputs, or the meshlets
+constexpr char file_magic[4] = {'L', 'P', 'V', 'S'};
+
+template<typename T>
+void write_vector(std::ofstream &file, const std::vector<T> &v) {
+    auto count = static_cast<uint64_t>(v.size());
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+template<typename T>
+void read_vector(std::ifstream &file, std::vector<T> &v) {
+    uint64_t count = 0u;
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (file) {
+        v.resize(count);
+        file.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+    }
+}
+
+}
+
+size_t VisibilityData::segment(float time) const noexcept {
+    auto total_time = end_time - start_time;
+    auto delta_time = time - start_time;
+    if (delta_time > total_time && total_time > 0.0f) {
+        delta_time -= std::floor(delta_time / total_time) * total_time;
+    }
+    auto index = static_cast<size_t>(std::max(delta_time, 0.0f) / segment_duration);
+    return std::min(index, segment_count() - 1u);
+}
+
+void VisibilityData::encode(const std::vector<bool> &visible) {
+
+    auto put = [this](uint32_t n) {
+        do {
+            auto byte = static_cast<uint8_t>(n & 0x7fu);
+            n >>= 7u;
+            runs.emplace_back(n == 0u ? byte : static_cast<uint8_t>(byte | 0x80u));
+        } while (n != 0u);
+    };
+
+    if (segment_offsets.empty()) { segment_offsets.emplace_back(0u); }
+    auto current = false;  // the first run is of hidden meshlets, possibly empty
+    auto length = 0u;
+    for (auto v : visible) {
+        if (v != current) {
+            put(length);
+            current = v;
+            length = 0u;
+        }
+        length++;
+    }
+    put(length);
+    segment_offsets.emplace_back(static_cast<uint32_t>(runs.size()));
+}
+
+void VisibilityData::decode(size_t segment, std::vector<bool> &visible) const {
+    visible.assign(meshlet_count, false);
+    auto p = runs.data() + segment_offsets[segment];
+    auto end = runs.data() + segment_offsets[segment + 1u];
+    auto current = false;
+    auto index = 0u;
+    while (p < end) {
+        auto n = 0u;
+        for (auto shift = 0u; p < end; shift += 7u) {
+            auto byte = *p++;
+            n |= (byte & 0x7fu) << shift;
+            if ((byte & 0x80u) == 0u) { break; }
+        }
+        auto run_end = std::min(index + n, meshlet_count);
+        if (current) { std::fill(visible.begin() + index, visible.begin() + run_end, true); }
+        index = run_end;
+        current = !current;
+    }
+}
+
+void VisibilityData::save(const std::string &path) const {
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error{serialize("Failed to write visibility sets: ", path)};
+    }
+    file.write(file_magic, sizeof(file_magic));
+    file.write(reinterpret_cast<const char *>(&file_version), sizeof(file_version));
+    file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+    file.write(reinterpret_cast<const char *>(&settings_key), sizeof(settings_key));
+    file.write(reinterpret_cast<const char *>(&start_time), sizeof(start_time));
+    file.write(reinterpret_cast<const char *>(&end_time), sizeof(end_time));
+    file.write(reinterpret_cast<const char *>(&segment_duration), sizeof(segment_duration));
+    file.write(reinterpret_cast<const char *>(&meshlet_count), sizeof(meshlet_count));
+    write_vector(file, segment_offsets);
+    write_vector(file, runs);
+    std::cout << "Saved visibility sets to: " << path << std::endl;
+}
+
+std::optional<VisibilityData> VisibilityData::load(const std::string &path, uint64_t key) {
+
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return std::nullopt;
+    }
+
+    char magic[4]{};
+    uint32_t version = 0u;
+    VisibilityData data;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(&data.key), sizeof(data.key));
+    file.read(reinterpret_cast<char *>(&data.settings_key), sizeof(data.settings_key));
+    if (!file || !std::equal(magic, magic + sizeof(magic), file_magic) || version != file_version) {
+        std::cout << "Ignoring unrecognized visibility sets: " << path << std::endl;
+        return std::nullopt;
+    }
+    if (data.key != key) {
+        std::cout << "Ignoring stale visibility sets: " << path << std::endl;
+        return std::nullopt;
+    }
+    file.read(reinterpret_cast<char *>(&data.start_time), sizeof(data.start_time));
+    file.read(reinterpret_cast<char *>(&data.end_time), sizeof(data.end_time));
+    file.read(reinterpret_cast<char *>(&data.segment_duration), sizeof(data.segment_duration));
+    file.read(reinterpret_cast<char *>(&data.meshlet_count), sizeof(data.meshlet_count));
+    read_vector(file, data.segment_offsets);
+    read_vector(file, data.runs);
+    if (!file || (!data.segment_offsets.empty() && data.segment_offsets.back() != data.runs.size())) {
+        std::cout << "Ignoring truncated visibility sets: " << path << std::endl;
+        return std::nullopt;
+    }
+    std::cout << "Loaded " << data.segment_count() << " visibility sets (" << data.runs.size() << " bytes) from: " << path << std::endl;
+    return data;
+}
+
+uint64_t VisibilityBaker::cache_key(const std::string &scene_path, const SceneInfo &info) {
+
+    Hasher hasher;
+    hasher.value(baker_version);
+
+    std::ifstream file{scene_path, std::ios::binary};
+    std::string content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    hasher.string(content);
+
+    for (auto &&mesh : info.meshes()) {
+        hasher.file_stamp(info.folder() + mesh.file_name);
+    }
+    return hasher.digest();
+}
+
+uint64_t VisibilityBaker::settings_key(const Settings &settings) {
+    Hasher hasher;
+    hasher.value(settings.segment_duration);
+    hasher.value(settings.samples_per_segment);
+    hasher.value(settings.resolution);
+    hasher.value(settings.near_plane);
+    return hasher.digest();
+}
+
+VisibilityData VisibilityBaker::bake(const SceneInfo &info, const GeometryData &geometry, const Settings &settings) {
+
+    VisibilityData data;
+    data.meshlet_count = static_cast<uint32_t>(geometry.meshlets.size());
+    data.segment_duration = settings.segment_duration;
+    data.settings_key = settings_key(settings);
+
+    auto &&cameras = info.cameras();
+    if (cameras.size() < 2u || settings.segment_duration <= 0.0f) {
+        std::cout << "No camera path to bake visibility along" << std::endl;
+        return data;
+    }
+    data.start_time = cameras.front().time;
+    data.end_time = cameras.back().time;
+    auto segment_count = std::max(static_cast<size_t>(std::ceil((data.end_time - data.start_time) / settings.segment_duration)), size_t{1u});
+    auto sample_count = std::max(settings.samples_per_segment, 2u);
+
+    // every opaque triangle occludes
+    OcclusionCuller::Settings culler_settings;
+    culler_settings.width = settings.resolution;
+    culler_settings.max_occluder_triangles = static_cast<uint32_t>(geometry.opaque_triangle_count);
+    auto culler = OcclusionCuller::create(geometry, culler_settings);
+    auto animator = CameraAnimator::create(info);
+
+    auto far_plane = glm::length(geometry.aabb.max - geometry.aabb.min) * 1.1f;
+    auto projection = glm::perspective(glm::radians(90.0f), 1.0f, settings.near_plane, far_plane);
+    const glm::vec3 directions[6]{{1.0f, 0.0f, 0.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}};
+    const glm::vec3 ups[6]{{0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}, {0.0f, -1.0f, 0.0f}};
+
+    std::vector<uint8_t> flags(geometry.meshlets.size());
+    std::vector<bool> visible(geometry.meshlets.size());
+    std::vector<float> times(segment_count * sample_count);
+    for (auto segment = 0ul; segment < segment_count; segment++) {
+        for (auto sample = 0u; sample < sample_count; sample++) {
+            auto t = static_cast<float>(segment) + static_cast<float>(sample) / static_cast<float>(sample_count - 1u);
+            times[segment * sample_count + sample] = std::min(data.start_time + t * settings.segment_duration, data.end_time);
+        }
+    }
+    CameraAnimator::Samples samples;
+    animator.sample(times.data(), times.size(), samples);
+
+    auto visible_sum = 0.0;
+    for (auto segment = 0ul; segment < segment_count; segment++) {
+        std::fill(flags.begin(), flags.end(), uint8_t{0u});
+        for (auto sample = 0u; sample < sample_count; sample++) {
+            auto eye = samples.eye(segment * sample_count + sample);
+            for (auto face = 0u; face < 6u; face++) {
+                auto view_projection = projection * glm::lookAt(eye, eye + directions[face], ups[face]);
+                culler.render(view_projection, 1.0f);
+                Frustum frustum{view_projection};
+                ThreadPool::global().parallel_for(flags.size(), [&](size_t i) {
+                    auto &&bounds = geometry.meshlets[i].bounds;
+                    if (flags[i] == 0u && frustum.classify(bounds.min, bounds.max) != Containment::OUTSIDE && culler.visible(bounds.min, bounds.max)) {
+                        flags[i] = 1u;
+                    }
+                });
+            }
+        }
+        auto count = 0ul;
+        for (auto i = 0ul; i < flags.size(); i++) {
+            visible[i] = flags[i] != 0u;
+            count += flags[i];
+        }
+        data.encode(visible);
+        visible_sum += static_cast<double>(count);
+        std::cout << "Visibility segment " << segment + 1u << "/" << segment_count << ": "
+                  << count << " of " << flags.size() << " meshlets" << std::endl;
+    }
+    std::cout << "Baked " << segment_count << " visibility sets, " << visible_sum / static_cast<double>(segment_count)
+              << " meshlets visible on average, " << data.runs.size() << " bytes" << std::endl;
+
+    return data;
+}
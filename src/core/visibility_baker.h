@@ -0,0 +1,74 @@
+//
+// Created by Mike Smith on 2019/10/18.
+//
+
+#ifndef LEARNOPENGL_VISIBILITY_BAKER_H
+#define LEARNOPENGL_VISIBILITY_BAKER_H
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+
+// Potentially visible sets of the meshlets along the scripted camera path, stored next to the scene. The path is cut
+// into segments of equal duration; the set of each segment is run-length coded on its own, as alternating runs of
+// hidden and visible meshlets in stream order, so that any segment decodes without the others.
+struct VisibilityData {
+
+    static constexpr uint32_t file_version = 2u;
+
+    uint64_t key{0};           // VisibilityBaker::cache_key() of the inputs, set by the caller before saving
+    uint64_t settings_key{0};  // VisibilityBaker::settings_key() of the bake, so LuisaBake knows when to bake again
+    float start_time{0.0f};
+    float end_time{0.0f};
+    float segment_duration{1.0f};
+    uint32_t meshlet_count{0};
+    std::vector<uint32_t> segment_offsets;  // into runs, one more than the segments
+    std::vector<uint8_t> runs;              // LEB128 run lengths
+
+    [[nodiscard]] bool empty() const noexcept { return segment_offsets.size() < 2u; }
+    [[nodiscard]] size_t segment_count() const noexcept { return empty() ? 0u : segment_offsets.size() - 1u; }
+
+    // the segment of the path at time, which wraps around like CameraAnimator::state()
+    [[nodiscard]] size_t segment(float time) const noexcept;
+
+    void encode(const std::vector<bool> &visible);
+    void decode(size_t segment, std::vector<bool> &visible) const;
+
+    void save(const std::string &path) const;
+
+    // the cached sets at path if they exist and were baked for key
+    static std::optional<VisibilityData> load(const std::string &path, uint64_t key);
+
+};
+
+// Offline visibility baking along the camera path on the CPU, without OpenGL. The path is sampled densely within
+// each segment, both ends included; at every sample all opaque triangles are rasterized by an OcclusionCuller into
+// the six faces of a cube around the eye, so that the sets hold for any orientation and field of view, and every
+// meshlet whose bounds pass the frustum and depth tests of a face is marked visible for the segment.
+class VisibilityBaker {
+
+public:
+    struct Settings {
+        float segment_duration{1.0f};      // seconds of camera animation per set
+        uint32_t samples_per_segment{8u};  // viewpoints, at least two
+        uint32_t resolution{256u};         // of the cube faces
+        float near_plane{0.01f};           // must not exceed the near plane of the renderer
+    };
+
+private:
+    VisibilityBaker() = default;
+
+public:
+    // identifies the inputs of a bake: the scene file and the meshes it names; the settings are kept apart, the sets
+    // carry their own segment duration and are used whatever they were baked with
+    static uint64_t cache_key(const std::string &scene_path, const SceneInfo &info);
+    static uint64_t settings_key(const Settings &settings);
+
+    static VisibilityData bake(const SceneInfo &info, const GeometryData &geometry, const Settings &settings);
+    static VisibilityData bake(const SceneInfo &info, const GeometryData &geometry) { return bake(info, geometry, Settings{}); }
+
+};
+
+#endif //LEARNOPENGL_VISIBILITY_BAKER_H